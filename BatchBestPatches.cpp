@@ -0,0 +1,360 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/*
+ * Find the best source patches for many target patches without the GUI.
+ * The targets are read from a text file with one "x y" target center per line.
+ * The output is written as CSV or JSON, depending on the extension of the output file name.
+ */
+
+// Custom
+#include "Parallel.h"
+#include "Patch.h"
+#include "ScoreCache.h"
+#include "SelfPatchCompare.h"
+#include "Types.h"
+
+// Submodules
+#include "ITKHelpers/ITKHelpers.h"
+#include "Mask/Mask.h"
+
+// ITK
+#include "itkImageFileReader.h"
+#include "itkTimeProbe.h"
+
+// STL
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+bool ReadTargets(const std::string& fileName, std::vector<itk::Index<2> >& targets);
+bool GetScoreFromName(const std::string& name, float Patch::*& score);
+void WriteCSV(const std::string& fileName, const std::vector<itk::Index<2> >& targets,
+              const std::vector<std::vector<Patch> >& matches, const unsigned int patchRadius);
+void WriteJSON(const std::string& fileName, const std::vector<itk::Index<2> >& targets,
+               const std::vector<std::vector<Patch> >& matches, const unsigned int patchRadius);
+
+int main(int argc, char *argv[])
+{
+  if(argc < 6)
+    {
+    std::cerr << "Only gave " << argc << " arguments!" << std::endl;
+    std::cerr << "Required arguments: image mask patchRadius targets.txt output.(csv|json)" << std::endl;
+    std::cerr << "Optional arguments: numberOfMatches(default 10) sortBy(totalAbsolute|averageAbsolute|totalSquared|averageSquared) numberOfThreads cacheDirectory" << std::endl;
+    return EXIT_FAILURE;
+    }
+  std::string imageFilename = argv[1];
+  std::string maskFilename = argv[2];
+  unsigned int patchRadius = 0;
+  std::stringstream(argv[3]) >> patchRadius;
+  std::string targetsFilename = argv[4];
+  std::string outputFilename = argv[5];
+
+  unsigned int numberOfMatches = 10;
+  if(argc > 6)
+    {
+    std::stringstream(argv[6]) >> numberOfMatches;
+    }
+
+  std::string scoreName = "totalAbsolute";
+  if(argc > 7)
+    {
+    scoreName = argv[7];
+    }
+  float Patch::*score = &Patch::TotalAbsoluteScore;
+  if(!GetScoreFromName(scoreName, score))
+    {
+    std::cerr << "Unknown score " << scoreName << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  unsigned int requestedThreads = 0;
+  if(argc > 8)
+    {
+    std::stringstream(argv[8]) >> requestedThreads;
+    }
+
+  // Results are only cached if a cache directory is given.
+  bool useCache = argc > 9;
+  ScoreCache cache;
+  if(useCache)
+    {
+    cache.SetDirectory(argv[9]);
+    }
+
+  bool writeJSON = outputFilename.size() > 5 && outputFilename.substr(outputFilename.size() - 5) == ".json";
+
+  std::cout << "Reading image: " << imageFilename << std::endl;
+  std::cout << "Reading mask: " << maskFilename << std::endl;
+
+  typedef itk::ImageFileReader<FloatVectorImageType> VectorImageReaderType;
+  VectorImageReaderType::Pointer imageReader = VectorImageReaderType::New();
+  imageReader->SetFileName(imageFilename.c_str());
+  imageReader->Update();
+  FloatVectorImageType::Pointer image = imageReader->GetOutput();
+
+  typedef itk::ImageFileReader<Mask> MaskReaderType;
+  MaskReaderType::Pointer maskReader = MaskReaderType::New();
+  maskReader->SetFileName(maskFilename.c_str());
+  maskReader->Update();
+
+  if(image->GetLargestPossibleRegion() != maskReader->GetOutput()->GetLargestPossibleRegion())
+    {
+    std::cerr << "Image and mask must be the same size!" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // Use the same mask convention as InteractiveBestPatchesWidget::LoadMask
+  Mask::Pointer mask = Mask::New();
+  ITKHelpers::DeepCopy(maskReader->GetOutput(), mask.GetPointer());
+  mask->SetValidValue(0);
+  mask->SetHoleValue(255);
+  mask->Cleanup();
+
+  std::vector<itk::Index<2> > targets;
+  if(!ReadTargets(targetsFilename, targets))
+    {
+    std::cerr << "Could not read targets from " << targetsFilename << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // The targets are compared with complete source patches, so their whole patch must be inside the image.
+  std::vector<itk::Index<2> > targetsInside;
+  for(unsigned int targetId = 0; targetId < targets.size(); ++targetId)
+    {
+    if(image->GetLargestPossibleRegion().IsInside(ITKHelpers::GetRegionInRadiusAroundPixel(targets[targetId], patchRadius)))
+      {
+      targetsInside.push_back(targets[targetId]);
+      }
+    else
+      {
+      std::cerr << "Skipping target " << targets[targetId] << ": its patch is not entirely inside the image." << std::endl;
+      }
+    }
+  targets.swap(targetsInside);
+
+  if(targets.empty())
+    {
+    std::cerr << "No usable targets were found in " << targetsFilename << std::endl;
+    return EXIT_FAILURE;
+    }
+  std::cout << "Read " << targets.size() << " targets." << std::endl;
+
+  // The source patches only depend on the mask and the patch size, so compute them once and share them between the threads.
+  // So does the planar copy of the image that the patches are compared in, which this makes (using all of the threads).
+  SelfPatchCompare sourcePatchFinder(image->GetNumberOfComponentsPerPixel());
+  sourcePatchFinder.SetImage(image);
+  sourcePatchFinder.SetMask(mask);
+  sourcePatchFinder.SetTargetRegion(ITKHelpers::GetRegionInRadiusAroundPixel(targets[0], patchRadius));
+  sourcePatchFinder.ComputeSourcePatches();
+  const std::vector<Patch>& sourcePatches = sourcePatchFinder.GetSourcePatches();
+
+  uint64_t imageHash = 0;
+  uint64_t maskHash = 0;
+  if(useCache)
+    {
+    imageHash = ScoreCache::HashImage(image);
+    maskHash = ScoreCache::HashMask(mask);
+    }
+
+  std::vector<std::vector<Patch> > matches(targets.size());
+  std::atomic<unsigned int> numberOfCacheHits(0);
+
+  itk::TimeProbe timer;
+  timer.Start();
+
+  // Each thread takes the next unprocessed target until there are none left.
+  std::atomic<size_t> nextTarget(0);
+  unsigned int numberOfThreads = Parallel::GetNumberOfThreads(requestedThreads);
+  Parallel::ParallelFor(numberOfThreads, [&](unsigned int)
+    {
+    SelfPatchCompare patchCompare(image->GetNumberOfComponentsPerPixel());
+    patchCompare.SetImage(image, sourcePatchFinder.GetShadow());
+    patchCompare.SetMask(mask);
+
+    PatchScoreComparison comparison(score);
+
+    for(size_t targetId = nextTarget++; targetId < targets.size(); targetId = nextTarget++)
+      {
+      itk::ImageRegion<2> targetRegion = ITKHelpers::GetRegionInRadiusAroundPixel(targets[targetId], patchRadius);
+      std::vector<Patch>& best = matches[targetId];
+
+      // A cached list can be used if it has at least as many matches as requested, or if it has all of the candidates.
+      uint64_t key = 0;
+      if(useCache)
+        {
+        key = ScoreCache::ComputeKey(imageHash, maskHash, targetRegion, scoreName);
+        uint64_t totalNumberOfCandidates = 0;
+        if(cache.Load(key, best, totalNumberOfCandidates) &&
+           (best.size() >= numberOfMatches || best.size() == totalNumberOfCandidates))
+          {
+          best.resize(std::min<size_t>(best.size(), numberOfMatches));
+          numberOfCacheHits++;
+          continue;
+          }
+        best.clear();
+        }
+
+      patchCompare.SetTargetRegion(targetRegion);
+      patchCompare.ComputeOffsets();
+
+      // Keep the best 'numberOfMatches' patches in a max-heap, so the worst of them is always at the front.
+      best.reserve(numberOfMatches + 1);
+      for(unsigned int i = 0; i < sourcePatches.size(); ++i)
+        {
+        Patch patch = sourcePatches[i];
+        patch.Id = i;
+        if(!patchCompare.ComputeAllScores(patch))
+          {
+          break; // The target has no valid pixels, so there is nothing to compare.
+          }
+        if(best.size() < numberOfMatches)
+          {
+          best.push_back(patch);
+          std::push_heap(best.begin(), best.end(), comparison);
+          }
+        else if(numberOfMatches > 0 && comparison(patch, best.front()))
+          {
+          std::pop_heap(best.begin(), best.end(), comparison);
+          best.back() = patch;
+          std::push_heap(best.begin(), best.end(), comparison);
+          }
+        }
+      std::sort_heap(best.begin(), best.end(), comparison);
+
+      if(useCache)
+        {
+        cache.Save(key, best, sourcePatches.size());
+        }
+      }
+    });
+
+  timer.Stop();
+  std::cout << "Processed " << targets.size() << " targets against " << sourcePatches.size() << " source patches with "
+            << numberOfThreads << " threads in " << timer.GetTotal() << "s" << std::endl;
+  if(useCache)
+    {
+    std::cout << numberOfCacheHits << " targets were loaded from the cache in " << cache.GetDirectory() << std::endl;
+    }
+
+  if(writeJSON)
+    {
+    WriteJSON(outputFilename, targets, matches, patchRadius);
+    }
+  else
+    {
+    WriteCSV(outputFilename, targets, matches, patchRadius);
+    }
+
+  return EXIT_SUCCESS;
+}
+
+bool ReadTargets(const std::string& fileName, std::vector<itk::Index<2> >& targets)
+{
+  std::ifstream fin(fileName.c_str());
+  if(!fin)
+    {
+    return false;
+    }
+
+  std::string line;
+  while(getline(fin, line))
+    {
+    if(line.empty() || line[0] == '#')
+      {
+      continue;
+      }
+    std::stringstream ss(line);
+    itk::Index<2> target;
+    if(ss >> target[0] >> target[1])
+      {
+      targets.push_back(target);
+      }
+    }
+  return true;
+}
+
+bool GetScoreFromName(const std::string& name, float Patch::*& score)
+{
+  if(name == "totalAbsolute")
+    {
+    score = &Patch::TotalAbsoluteScore;
+    }
+  else if(name == "averageAbsolute")
+    {
+    score = &Patch::AverageAbsoluteScore;
+    }
+  else if(name == "totalSquared")
+    {
+    score = &Patch::TotalSquaredScore;
+    }
+  else if(name == "averageSquared")
+    {
+    score = &Patch::AverageSquaredScore;
+    }
+  else
+    {
+    return false;
+    }
+  return true;
+}
+
+void WriteCSV(const std::string& fileName, const std::vector<itk::Index<2> >& targets,
+              const std::vector<std::vector<Patch> >& matches, const unsigned int patchRadius)
+{
+  std::ofstream fout(fileName.c_str());
+  fout << "targetX,targetY,rank,sourceX,sourceY,totalAbsolute,averageAbsolute,totalSquared,averageSquared" << std::endl;
+  for(unsigned int targetId = 0; targetId < targets.size(); ++targetId)
+    {
+    for(unsigned int rank = 0; rank < matches[targetId].size(); ++rank)
+      {
+      const Patch& patch = matches[targetId][rank];
+      fout << targets[targetId][0] << "," << targets[targetId][1] << "," << rank << ","
+           << patch.Region.GetIndex()[0] + patchRadius << "," << patch.Region.GetIndex()[1] + patchRadius << ","
+           << patch.TotalAbsoluteScore << "," << patch.AverageAbsoluteScore << ","
+           << patch.TotalSquaredScore << "," << patch.AverageSquaredScore << std::endl;
+      }
+    }
+}
+
+void WriteJSON(const std::string& fileName, const std::vector<itk::Index<2> >& targets,
+               const std::vector<std::vector<Patch> >& matches, const unsigned int patchRadius)
+{
+  std::ofstream fout(fileName.c_str());
+  fout << "[" << std::endl;
+  for(unsigned int targetId = 0; targetId < targets.size(); ++targetId)
+    {
+    fout << "  {\"target\": [" << targets[targetId][0] << ", " << targets[targetId][1] << "], \"matches\": [";
+    for(unsigned int rank = 0; rank < matches[targetId].size(); ++rank)
+      {
+      const Patch& patch = matches[targetId][rank];
+      fout << (rank == 0 ? "" : ",") << std::endl
+           << "    {\"source\": [" << patch.Region.GetIndex()[0] + patchRadius << ", " << patch.Region.GetIndex()[1] + patchRadius << "]"
+           << ", \"totalAbsolute\": " << patch.TotalAbsoluteScore
+           << ", \"averageAbsolute\": " << patch.AverageAbsoluteScore
+           << ", \"totalSquared\": " << patch.TotalSquaredScore
+           << ", \"averageSquared\": " << patch.AverageSquaredScore << "}";
+      }
+    fout << "]}" << (targetId + 1 < targets.size() ? "," : "") << std::endl;
+    }
+  fout << "]" << std::endl;
+}
@@ -0,0 +1,446 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/*
+ * Inpaint many images without the GUI. The input is either a directory, in which every image "name.ext"
+ * that has a mask "name_mask.ext" next to it is inpainted, or a text file with one "image mask [output]"
+ * per line. The results are written to the output directory as "name.mha" unless the manifest names an output.
+ *
+ * The files go through a pipeline: one thread reads images and masks, several workers inpaint them, and
+ * one thread writes the results. The queues between the stages are bounded, so however many files there
+ * are, at most a few images per worker are in memory at once.
+ *
+ * With a checkpoint interval, the state of each image is saved to "output.ckpt" as it is inpainted, and a run
+ * that is started again continues every image that has a checkpoint from it. The checkpoint of an image is
+ * removed once its result is written. With profiling, the time spent in each phase of each iteration of an
+ * image is written to "output.phases.csv" (see PhaseTimer.h).
+ */
+
+// Custom
+#include "BoundedQueue.h"
+#include "CriminisiInpainting.h"
+#include "MultiscaleCriminisiInpainting.h"
+#include "Parallel.h"
+#include "Types.h"
+
+// Submodules
+#include "ITKHelpers/ITKHelpers.h"
+#include "Mask/Mask.h"
+
+// ITK
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkTimeProbe.h"
+
+// STL
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Qt
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+
+// One image/mask pair as it moves through the pipeline.
+struct Job
+{
+  Job() : Id(0) {}
+
+  unsigned int Id;
+  FloatVectorImageType::Pointer Image;
+  Mask::Pointer MaskImage;
+  FloatVectorImageType::Pointer Result;
+};
+
+// The files of a pair and what happened to them. Each stage fills in its part.
+struct FileRecord
+{
+  FileRecord() : ReadTime(0), InpaintTime(0), WriteTime(0), Succeeded(false) {}
+
+  std::string ImageFileName;
+  std::string MaskFileName;
+  std::string OutputFileName;
+
+  double ReadTime;
+  double InpaintTime;
+  double WriteTime;
+  bool Succeeded;
+};
+
+bool ReadManifest(const std::string& fileName, const std::string& outputDirectory, std::vector<FileRecord>& files);
+bool FindPairsInDirectory(const std::string& directory, const std::string& outputDirectory, std::vector<FileRecord>& files);
+bool ReadPair(FileRecord& file, Job& job);
+void PrintSummary(const std::vector<FileRecord>& files, const double totalTime, const unsigned int numberOfWorkers);
+
+int main(int argc, char *argv[])
+{
+  if(argc < 4)
+    {
+    std::cerr << "Only gave " << argc << " arguments!" << std::endl;
+    std::cerr << "Required arguments: (inputDirectory|manifest.txt) outputDirectory patchRadius" << std::endl;
+    std::cerr << "Optional arguments: numberOfWorkers(default: one per core) queueSize(default: numberOfWorkers) numberOfLevels(default 1)"
+              << " checkpointInterval(default 0: no checkpoints) profile(default 0, 1 to write the phase times)" << std::endl;
+    return EXIT_FAILURE;
+    }
+  std::string input = argv[1];
+  std::string outputDirectory = argv[2];
+  unsigned int patchRadius = 0;
+  std::stringstream(argv[3]) >> patchRadius;
+
+  unsigned int requestedWorkers = 0;
+  if(argc > 4)
+    {
+    std::stringstream(argv[4]) >> requestedWorkers;
+    }
+  const unsigned int numberOfWorkers = Parallel::GetNumberOfThreads(requestedWorkers);
+
+  unsigned int queueSize = numberOfWorkers;
+  if(argc > 5)
+    {
+    std::stringstream(argv[5]) >> queueSize;
+    }
+
+  // With more than one level, the images are inpainted coarse to fine (see MultiscaleCriminisiInpainting.h).
+  unsigned int numberOfLevels = 1;
+  if(argc > 6)
+    {
+    std::stringstream(argv[6]) >> numberOfLevels;
+    }
+
+  unsigned int checkpointInterval = 0;
+  if(argc > 7)
+    {
+    std::stringstream(argv[7]) >> checkpointInterval;
+    }
+  if(checkpointInterval > 0 && numberOfLevels > 1)
+    {
+    std::cerr << "Checkpoints are only written when inpainting with one level, so they will not be used." << std::endl;
+    checkpointInterval = 0;
+    }
+
+  bool profile = false;
+  if(argc > 8)
+    {
+    std::stringstream(argv[8]) >> profile;
+    }
+  if(profile && numberOfLevels > 1)
+    {
+    std::cerr << "The phase times are only written when inpainting with one level, so they will not be written." << std::endl;
+    profile = false;
+    }
+
+  if(!QDir().mkpath(outputDirectory.c_str()))
+    {
+    std::cerr << "Could not create output directory " << outputDirectory << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  std::vector<FileRecord> files;
+  bool found = QFileInfo(input.c_str()).isDir() ? FindPairsInDirectory(input, outputDirectory, files) :
+                                                  ReadManifest(input, outputDirectory, files);
+  if(!found)
+    {
+    std::cerr << "Could not read " << input << std::endl;
+    return EXIT_FAILURE;
+    }
+  if(files.empty())
+    {
+    std::cerr << "No image/mask pairs were found in " << input << std::endl;
+    return EXIT_FAILURE;
+    }
+  std::cout << "Inpainting " << files.size() << " images with " << numberOfWorkers << " workers." << std::endl;
+
+  BoundedQueue<Job> readQueue(queueSize);
+  BoundedQueue<Job> writeQueue(queueSize);
+
+  itk::TimeProbe totalTimer;
+  totalTimer.Start();
+
+  // Read the pairs in order. A pair that cannot be read is skipped (and reported in the summary).
+  std::thread reader([&]()
+    {
+    for(unsigned int fileId = 0; fileId < files.size(); ++fileId)
+      {
+      Job job;
+      job.Id = fileId;
+      if(ReadPair(files[fileId], job))
+        {
+        readQueue.Push(job);
+        }
+      }
+    readQueue.Close();
+    });
+
+  // Write the results in the order they are finished.
+  std::thread writer([&]()
+    {
+    typedef itk::ImageFileWriter<FloatVectorImageType> WriterType;
+    Job job;
+    while(writeQueue.Pop(job))
+      {
+      FileRecord& file = files[job.Id];
+      itk::TimeProbe timer;
+      timer.Start();
+      try
+      {
+        WriterType::Pointer imageWriter = WriterType::New();
+        imageWriter->SetFileName(file.OutputFileName);
+        imageWriter->SetInput(job.Result);
+        imageWriter->Update();
+        file.Succeeded = true;
+        if(checkpointInterval > 0)
+          {
+          QFile::remove((file.OutputFileName + ".ckpt").c_str());
+          }
+      }
+      catch( itk::ExceptionObject & err )
+      {
+        std::cerr << "ExceptionObject caught writing " << file.OutputFileName << "!" << std::endl;
+        std::cerr << err << std::endl;
+      }
+      timer.Stop();
+      file.WriteTime = timer.GetTotal();
+      job = Job(); // Release the images before waiting for the next result
+      }
+    });
+
+  Parallel::ParallelFor(numberOfWorkers, [&](unsigned int)
+    {
+    Job job;
+    while(readQueue.Pop(job))
+      {
+      itk::TimeProbe timer;
+      timer.Start();
+
+      // An image that cannot be inpainted is reported in the summary, and the other images are still inpainted.
+      bool inpainted = true;
+      try
+      {
+        if(numberOfLevels > 1)
+          {
+          MultiscaleCriminisiInpainting inpainting;
+          inpainting.SetPatchRadius(patchRadius);
+          inpainting.SetNumberOfLevels(numberOfLevels);
+          inpainting.SetImage(job.Image);
+          inpainting.SetMask(job.MaskImage);
+          inpainting.Inpaint();
+          job.Result = inpainting.GetResult();
+          }
+        else
+          {
+          CriminisiInpainting inpainting;
+          inpainting.SetPatchRadius(patchRadius);
+          inpainting.SetImage(job.Image);
+          inpainting.SetMask(job.MaskImage);
+          if(checkpointInterval > 0)
+            {
+            // Continue from the checkpoint of an earlier run that did not finish this image.
+            const std::string checkpointFileName = files[job.Id].OutputFileName + ".ckpt";
+            inpainting.SetCheckpoint(checkpointFileName, checkpointInterval);
+            if(QFileInfo(checkpointFileName.c_str()).exists() && !inpainting.Resume(checkpointFileName))
+              {
+              std::cerr << "Could not resume from " << checkpointFileName << ", so " << files[job.Id].ImageFileName
+                        << " is inpainted from the start." << std::endl;
+              }
+            }
+          if(profile)
+            {
+            inpainting.SetProfilingOutput(files[job.Id].OutputFileName + ".phases.csv");
+            }
+          inpainting.Inpaint();
+          job.Result = inpainting.GetResult();
+          }
+      }
+      catch( itk::ExceptionObject & err )
+      {
+        std::cerr << "ExceptionObject caught inpainting " << files[job.Id].ImageFileName << "!" << std::endl;
+        std::cerr << err << std::endl;
+        inpainted = false;
+      }
+
+      timer.Stop();
+      files[job.Id].InpaintTime = timer.GetTotal();
+
+      job.Image = NULL;
+      job.MaskImage = NULL;
+      if(inpainted)
+        {
+        writeQueue.Push(job);
+        }
+      job = Job();
+      }
+    });
+
+  reader.join();
+  writeQueue.Close();
+  writer.join();
+
+  totalTimer.Stop();
+  PrintSummary(files, totalTimer.GetTotal(), numberOfWorkers);
+
+  for(unsigned int fileId = 0; fileId < files.size(); ++fileId)
+    {
+    if(!files[fileId].Succeeded)
+      {
+      return EXIT_FAILURE;
+      }
+    }
+  return EXIT_SUCCESS;
+}
+
+bool ReadPair(FileRecord& file, Job& job)
+{
+  itk::TimeProbe timer;
+  timer.Start();
+  try
+  {
+    typedef itk::ImageFileReader<FloatVectorImageType> VectorImageReaderType;
+    VectorImageReaderType::Pointer imageReader = VectorImageReaderType::New();
+    imageReader->SetFileName(file.ImageFileName);
+    imageReader->Update();
+    job.Image = imageReader->GetOutput();
+    job.Image->DisconnectPipeline();
+
+    typedef itk::ImageFileReader<Mask> MaskReaderType;
+    MaskReaderType::Pointer maskReader = MaskReaderType::New();
+    maskReader->SetFileName(file.MaskFileName);
+    maskReader->Update();
+
+    if(job.Image->GetLargestPossibleRegion() != maskReader->GetOutput()->GetLargestPossibleRegion())
+      {
+      std::cerr << "Image " << file.ImageFileName << " and mask " << file.MaskFileName << " must be the same size!" << std::endl;
+      return false;
+      }
+
+    // Use the same mask convention as InteractiveBestPatchesWidget::LoadMask
+    job.MaskImage = Mask::New();
+    ITKHelpers::DeepCopy(maskReader->GetOutput(), job.MaskImage.GetPointer());
+    job.MaskImage->SetValidValue(0);
+    job.MaskImage->SetHoleValue(255);
+    job.MaskImage->Cleanup();
+  }
+  catch( itk::ExceptionObject & err )
+  {
+    std::cerr << "ExceptionObject caught reading " << file.ImageFileName << "!" << std::endl;
+    std::cerr << err << std::endl;
+    return false;
+  }
+  timer.Stop();
+  file.ReadTime = timer.GetTotal();
+  return true;
+}
+
+bool ReadManifest(const std::string& fileName, const std::string& outputDirectory, std::vector<FileRecord>& files)
+{
+  std::ifstream fin(fileName.c_str());
+  if(!fin)
+    {
+    return false;
+    }
+
+  std::string line;
+  while(getline(fin, line))
+    {
+    if(line.empty() || line[0] == '#')
+      {
+      continue;
+      }
+    std::stringstream ss(line);
+    FileRecord file;
+    if(!(ss >> file.ImageFileName >> file.MaskFileName))
+      {
+      continue;
+      }
+    if(!(ss >> file.OutputFileName))
+      {
+      file.OutputFileName = outputDirectory + "/" + QFileInfo(file.ImageFileName.c_str()).completeBaseName().toStdString() + ".mha";
+      }
+    files.push_back(file);
+    }
+  return true;
+}
+
+bool FindPairsInDirectory(const std::string& directory, const std::string& outputDirectory, std::vector<FileRecord>& files)
+{
+  QDir dir(directory.c_str());
+  if(!dir.exists())
+    {
+    return false;
+    }
+
+  QStringList entries = dir.entryList(QDir::Files, QDir::Name);
+  for(int i = 0; i < entries.size(); ++i)
+    {
+    QFileInfo imageInfo(dir.filePath(entries[i]));
+    if(imageInfo.completeBaseName().endsWith("_mask"))
+      {
+      continue;
+      }
+    QFileInfo maskInfo(dir.filePath(imageInfo.completeBaseName() + "_mask." + imageInfo.suffix()));
+    if(!maskInfo.exists())
+      {
+      continue;
+      }
+
+    FileRecord file;
+    file.ImageFileName = imageInfo.filePath().toStdString();
+    file.MaskFileName = maskInfo.filePath().toStdString();
+    file.OutputFileName = outputDirectory + "/" + imageInfo.completeBaseName().toStdString() + ".mha";
+    files.push_back(file);
+    }
+  return true;
+}
+
+void PrintSummary(const std::vector<FileRecord>& files, const double totalTime, const unsigned int numberOfWorkers)
+{
+  double totalReadTime = 0;
+  double totalInpaintTime = 0;
+  double totalWriteTime = 0;
+  unsigned int numberOfSucceeded = 0;
+
+  std::cout << std::endl << std::setw(10) << "read(s)" << std::setw(12) << "inpaint(s)" << std::setw(10) << "write(s)"
+            << "  file" << std::endl;
+  std::cout << std::fixed << std::setprecision(3);
+  for(unsigned int fileId = 0; fileId < files.size(); ++fileId)
+    {
+    const FileRecord& file = files[fileId];
+    std::cout << std::setw(10) << file.ReadTime << std::setw(12) << file.InpaintTime << std::setw(10) << file.WriteTime
+              << "  " << file.ImageFileName << (file.Succeeded ? "" : " (FAILED)") << std::endl;
+
+    totalReadTime += file.ReadTime;
+    totalInpaintTime += file.InpaintTime;
+    totalWriteTime += file.WriteTime;
+    if(file.Succeeded)
+      {
+      numberOfSucceeded++;
+      }
+    }
+
+  std::cout << std::endl << numberOfSucceeded << " of " << files.size() << " images inpainted in " << totalTime << "s ("
+            << numberOfSucceeded / totalTime << " images/s)." << std::endl;
+  std::cout << "Total time spent reading " << totalReadTime << "s, inpainting " << totalInpaintTime
+            << "s, writing " << totalWriteTime << "s." << std::endl;
+  // If the workers were busy the whole time, the inpainting time is the number of workers times the total time.
+  std::cout << "The workers were busy " << 100.0 * totalInpaintTime / (numberOfWorkers * totalTime) << "% of the time." << std::endl;
+}
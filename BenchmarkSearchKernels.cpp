@@ -0,0 +1,272 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+/*
+ * Time the ways the best-patch searches (SelfPatchCompare::FindBestPatch() and the others) could add up
+ * the squared differences of a patch while stopping as soon as it can no longer be the best:
+ *
+ *  - interleaved: read the image, check the bound after every valid pixel (what SelfPatchCompare does)
+ *  - planar rows: read a PlanarShadowImage, add up each row of valid pixels plane by plane, check the bound after each row
+ *  - planar dense rows: the same over whole rows of a copy with a border of patchRadius, with the hole pixels weighted by 0
+ *
+ * The image is synthetic (smooth, with a little noise) with a round hole in the middle, and the targets are on
+ * the edge of the hole. All three must choose the same source patch.
+ */
+
+// Custom
+#include "PlanarShadowImage.h"
+#include "Types.h"
+
+// STL
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <vector>
+
+typedef FloatVectorImageType::OffsetValueType OffsetType;
+
+// The valid pixels of a target: their offsets in the image and in the planes, where each row of them ends, and a weight
+// (1 for valid, 0 for hole) for every pixel of the patch.
+struct Target
+{
+  itk::Index<2> Corner;
+  std::vector<OffsetType> ImageOffsets;
+  std::vector<OffsetType> PlaneOffsets;
+  std::vector<unsigned int> RowEnds;
+  std::vector<float> Weights;
+};
+
+static float InterleavedScore(const float* buffer, const unsigned int components, const OffsetType sourceCorner,
+                              const OffsetType targetCorner, const std::vector<OffsetType>& offsets, const float bestScore)
+{
+  float score = 0;
+  for(unsigned int i = 0; i < offsets.size() && score < bestScore; ++i)
+    {
+    const float* sourcePixel = buffer + (sourceCorner + offsets[i]) * components;
+    const float* targetPixel = buffer + (targetCorner + offsets[i]) * components;
+    for(unsigned int component = 0; component < components; ++component)
+      {
+      float difference = sourcePixel[component] - targetPixel[component];
+      score += difference * difference;
+      }
+    }
+  return score;
+}
+
+static float PlanarRowScore(const PlanarShadowImage& shadow, const OffsetType sourceCorner, const OffsetType targetCorner,
+                            const Target& target, const float bestScore)
+{
+  float score = 0;
+  unsigned int rowStart = 0;
+  for(unsigned int row = 0; row < target.RowEnds.size() && score < bestScore; ++row)
+    {
+    const unsigned int rowEnd = target.RowEnds[row];
+    for(unsigned int component = 0; component < shadow.GetNumberOfComponents(); ++component)
+      {
+      const float* source = shadow.GetPlane(component) + sourceCorner;
+      const float* targetPlane = shadow.GetPlane(component) + targetCorner;
+      for(unsigned int i = rowStart; i < rowEnd; ++i)
+        {
+        float difference = source[target.PlaneOffsets[i]] - targetPlane[target.PlaneOffsets[i]];
+        score += difference * difference;
+        }
+      }
+    rowStart = rowEnd;
+    }
+  return score;
+}
+
+static float PlanarDenseRowScore(const PlanarShadowImage& shadow, const OffsetType sourceCorner, const OffsetType targetCorner,
+                                 const Target& target, const unsigned int patchWidth, const float bestScore)
+{
+  float score = 0;
+  for(unsigned int row = 0; row < patchWidth && score < bestScore; ++row)
+    {
+    const float* weights = &target.Weights[row * patchWidth];
+    const OffsetType rowOffset = row * shadow.GetRowStride();
+    for(unsigned int component = 0; component < shadow.GetNumberOfComponents(); ++component)
+      {
+      const float* source = shadow.GetPlane(component) + sourceCorner + rowOffset;
+      const float* targetPlane = shadow.GetPlane(component) + targetCorner + rowOffset;
+      for(unsigned int column = 0; column < patchWidth; ++column)
+        {
+        float difference = source[column] - targetPlane[column];
+        score += weights[column] * difference * difference;
+        }
+      }
+    }
+  return score;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned int patchRadius = 3;
+  if(argc > 1)
+    {
+    std::stringstream(argv[1]) >> patchRadius;
+    }
+  unsigned int imageSize = 640;
+  if(argc > 2)
+    {
+    std::stringstream(argv[2]) >> imageSize;
+    }
+  const unsigned int patchWidth = 2 * patchRadius + 1;
+  const unsigned int components = 3;
+
+  itk::Index<2> imageCorner = {{0, 0}};
+  itk::Size<2> size = {{imageSize, imageSize * 3 / 4}};
+  itk::ImageRegion<2> region(imageCorner, size);
+
+  FloatVectorImageType::Pointer image = FloatVectorImageType::New();
+  image->SetRegions(region);
+  image->SetNumberOfComponentsPerPixel(components);
+  image->Allocate();
+
+  // A round hole in the middle.
+  const long centerX = size[0] / 2;
+  const long centerY = size[1] / 2;
+  const long holeRadius = size[1] / 8;
+  std::vector<unsigned char> hole(region.GetNumberOfPixels(), 0);
+
+  srand(0);
+  float* buffer = image->GetBufferPointer();
+  for(unsigned int y = 0; y < size[1]; ++y)
+    {
+    for(unsigned int x = 0; x < size[0]; ++x)
+      {
+      const size_t pixel = static_cast<size_t>(y) * size[0] + x;
+      for(unsigned int component = 0; component < components; ++component)
+        {
+        buffer[pixel * components + component] = 128.0f + 60.0f * std::sin(0.05f * x + component) +
+                                                  40.0f * std::cos(0.07f * y - 0.3f * component) + (rand() % 16);
+        }
+      const long dx = static_cast<long>(x) - centerX;
+      const long dy = static_cast<long>(y) - centerY;
+      hole[pixel] = dx * dx + dy * dy < holeRadius * holeRadius;
+      }
+    }
+
+  PlanarShadowImage shadow;
+  shadow.SetImage(image, patchRadius);
+
+  // The source patches are all of the patches without hole pixels.
+  std::vector<itk::Index<2> > sourceCorners;
+  for(unsigned int y = 0; y + patchWidth <= size[1]; ++y)
+    {
+    for(unsigned int x = 0; x + patchWidth <= size[0]; ++x)
+      {
+      bool valid = true;
+      for(unsigned int row = 0; row < patchWidth && valid; ++row)
+        {
+        for(unsigned int column = 0; column < patchWidth && valid; ++column)
+          {
+          valid = !hole[(y + row) * size[0] + x + column];
+          }
+        }
+      if(valid)
+        {
+        itk::Index<2> corner = {{x, y}};
+        sourceCorners.push_back(corner);
+        }
+      }
+    }
+
+  const unsigned int numberOfTargets = 16;
+  std::vector<Target> targets(numberOfTargets);
+  for(unsigned int targetId = 0; targetId < numberOfTargets; ++targetId)
+    {
+    Target& target = targets[targetId];
+    const float angle = 2.0f * 3.14159265f * targetId / numberOfTargets;
+    target.Corner[0] = centerX + static_cast<long>(holeRadius * std::cos(angle)) - patchRadius;
+    target.Corner[1] = centerY + static_cast<long>(holeRadius * std::sin(angle)) - patchRadius;
+    for(unsigned int row = 0; row < patchWidth; ++row)
+      {
+      for(unsigned int column = 0; column < patchWidth; ++column)
+        {
+        itk::Index<2> pixel = {{target.Corner[0] + column, target.Corner[1] + row}};
+        const bool valid = !hole[pixel[1] * size[0] + pixel[0]];
+        target.Weights.push_back(valid ? 1.0f : 0.0f);
+        if(valid)
+          {
+          target.ImageOffsets.push_back(image->ComputeOffset(pixel) - image->ComputeOffset(target.Corner));
+          target.PlaneOffsets.push_back(shadow.ComputeOffset(pixel) - shadow.ComputeOffset(target.Corner));
+          }
+        }
+      target.RowEnds.push_back(target.PlaneOffsets.size());
+      }
+    }
+
+  const char* kernelNames[3] = {"interleaved", "planar rows", "planar dense rows"};
+  double times[3] = {0, 0, 0};
+  bool same = true;
+  for(unsigned int targetId = 0; targetId < numberOfTargets; ++targetId)
+    {
+    const Target& target = targets[targetId];
+    unsigned int bestPatchIds[3] = {0, 0, 0};
+    for(unsigned int kernel = 0; kernel < 3; ++kernel)
+      {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      float bestScore = std::numeric_limits<float>::max();
+      for(unsigned int patchId = 0; patchId < sourceCorners.size(); ++patchId)
+        {
+        float score = 0;
+        if(kernel == 0)
+          {
+          score = InterleavedScore(buffer, components, image->ComputeOffset(sourceCorners[patchId]),
+                                   image->ComputeOffset(target.Corner), target.ImageOffsets, bestScore);
+          }
+        else if(kernel == 1)
+          {
+          score = PlanarRowScore(shadow, shadow.ComputeOffset(sourceCorners[patchId]), shadow.ComputeOffset(target.Corner),
+                                 target, bestScore);
+          }
+        else
+          {
+          score = PlanarDenseRowScore(shadow, shadow.ComputeOffset(sourceCorners[patchId]), shadow.ComputeOffset(target.Corner),
+                                      target, patchWidth, bestScore);
+          }
+        if(score < bestScore)
+          {
+          bestScore = score;
+          bestPatchIds[kernel] = patchId;
+          }
+        }
+      times[kernel] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      }
+    same = same && bestPatchIds[0] == bestPatchIds[1] && bestPatchIds[1] == bestPatchIds[2];
+    }
+
+  std::cout << "Patch radius " << patchRadius << ", " << sourceCorners.size() << " source patches, "
+            << numberOfTargets << " targets." << std::endl;
+  std::cout << std::fixed << std::setprecision(2);
+  for(unsigned int kernel = 0; kernel < 3; ++kernel)
+    {
+    std::cout << std::setw(18) << kernelNames[kernel] << ": " << 1000.0 * times[kernel] / numberOfTargets << " ms per target" << std::endl;
+    }
+
+  if(!same)
+    {
+    std::cerr << "The kernels did not choose the same source patches!" << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef BoundedQueue_H
+#define BoundedQueue_H
+
+/*
+ * A first in, first out queue for handing work between threads. It holds at most Capacity items:
+ * Push() waits while the queue is full, so a fast producer is slowed down to the speed of its
+ * consumers instead of using more and more memory. Pop() waits while the queue is empty.
+ * After Close(), Push() refuses new items and Pop() returns false once the queue has been drained.
+ */
+
+// STL
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+template <typename T>
+class BoundedQueue
+{
+public:
+  BoundedQueue(const size_t capacity = 16) : Capacity(capacity > 0 ? capacity : 1), Closed(false) {}
+
+  void SetCapacity(const size_t capacity)
+  {
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    this->Capacity = capacity > 0 ? capacity : 1;
+    this->NotFull.notify_all();
+  }
+
+  // Wait until there is room, then add the item. Returns false (and drops the item) if the queue is closed.
+  bool Push(T item)
+  {
+    std::unique_lock<std::mutex> lock(this->Mutex);
+    this->NotFull.wait(lock, [this]() { return this->Closed || this->Items.size() < this->Capacity; });
+    if(this->Closed)
+      {
+      return false;
+      }
+    this->Items.push_back(std::move(item));
+    this->NotEmpty.notify_one();
+    return true;
+  }
+
+  // Wait for an item and remove it. Returns false if the queue is closed and empty.
+  bool Pop(T& item)
+  {
+    std::unique_lock<std::mutex> lock(this->Mutex);
+    this->NotEmpty.wait(lock, [this]() { return this->Closed || !this->Items.empty(); });
+    if(this->Items.empty())
+      {
+      return false;
+      }
+    item = std::move(this->Items.front());
+    this->Items.pop_front();
+    this->NotFull.notify_one();
+    return true;
+  }
+
+  // Stop accepting items and wake up everyone who is waiting. Items already in the queue can still be popped.
+  void Close()
+  {
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    this->Closed = true;
+    this->NotEmpty.notify_all();
+    this->NotFull.notify_all();
+  }
+
+  // Accept items again after Close().
+  void Open()
+  {
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    this->Closed = false;
+  }
+
+  size_t GetSize()
+  {
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    return this->Items.size();
+  }
+
+private:
+  BoundedQueue(const BoundedQueue&); // Not implemented
+  void operator=(const BoundedQueue&); // Not implemented
+
+  std::deque<T> Items;
+  size_t Capacity;
+  bool Closed;
+
+  std::mutex Mutex;
+  std::condition_variable NotEmpty;
+  std::condition_variable NotFull;
+};
+
+#endif
@@ -0,0 +1,112 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "CIELab.h"
+
+// Custom
+#include "Parallel.h"
+
+// STL
+#include <algorithm>
+#include <iostream>
+
+namespace CIELab
+{
+
+namespace
+{
+// Pixels are converted in blocks: first the table lookups and the XYZ matrix for the whole block,
+// then the nonlinear function over plain arrays, which the compiler can vectorize.
+const size_t BlockSize = 256;
+
+unsigned char ToByte(const float value)
+{
+  return static_cast<unsigned char>(std::min(255.0f, std::max(0.0f, value)));
+}
+
+void ConvertPixels(const float* input, const unsigned int inputComponents, float* output, const size_t numberOfPixels)
+{
+  const float* linear = GetLinearizationTable();
+  float x[BlockSize];
+  float y[BlockSize];
+  float z[BlockSize];
+
+  for(size_t blockStart = 0; blockStart < numberOfPixels; blockStart += BlockSize)
+    {
+    const size_t blockSize = std::min(BlockSize, numberOfPixels - blockStart);
+    const float* pixel = input + blockStart * inputComponents;
+    for(size_t i = 0; i < blockSize; ++i, pixel += inputComponents)
+      {
+      const float red = linear[ToByte(pixel[0])];
+      const float green = linear[ToByte(pixel[1])];
+      const float blue = linear[ToByte(pixel[2])];
+      x[i] = (red * 0.4124f + green * 0.3576f + blue * 0.1805f) / 95.047f;
+      y[i] = (red * 0.2126f + green * 0.7152f + blue * 0.0722f) / 100.0f;
+      z[i] = (red * 0.0193f + green * 0.1192f + blue * 0.9505f) / 108.883f;
+      }
+
+    for(size_t i = 0; i < blockSize; ++i)
+      {
+      x[i] = F(x[i]);
+      y[i] = F(y[i]);
+      z[i] = F(z[i]);
+      }
+
+    float* lab = output + blockStart * 3;
+    for(size_t i = 0; i < blockSize; ++i, lab += 3)
+      {
+      lab[0] = 116.0f * y[i] - 16.0f;
+      lab[1] = 500.0f * (x[i] - y[i]);
+      lab[2] = 200.0f * (y[i] - z[i]);
+      }
+    }
+}
+} // end anonymous namespace
+
+void ConvertImage(const FloatVectorImageType* image, FloatVectorImageType* labImage, const unsigned int numberOfThreads)
+{
+  const unsigned int inputComponents = image->GetNumberOfComponentsPerPixel();
+  if(inputComponents < 3)
+    {
+    std::cerr << "CIELab::ConvertImage needs an image with at least 3 (RGB) components!" << std::endl;
+    return;
+    }
+
+  labImage->CopyInformation(image);
+  labImage->SetNumberOfComponentsPerPixel(3);
+  labImage->SetRegions(image->GetLargestPossibleRegion());
+  labImage->Allocate();
+
+  const size_t numberOfPixels = image->GetLargestPossibleRegion().GetNumberOfPixels();
+  const float* input = image->GetBufferPointer();
+  float* output = labImage->GetBufferPointer();
+
+  const unsigned int threads = Parallel::GetNumberOfThreads(numberOfThreads);
+  Parallel::ParallelFor(threads, [&](unsigned int threadId)
+    {
+    size_t begin;
+    size_t end;
+    Parallel::GetChunk(numberOfPixels, threads, threadId, begin, end);
+    ConvertPixels(input + begin * inputComponents, inputComponents, output + begin * 3, end - begin);
+    });
+
+  // The buffer may be the same one as before, so make sure copies of it (e.g. in SelfPatchCompare) are made again.
+  labImage->Modified();
+}
+
+} // end namespace CIELab
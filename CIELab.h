@@ -0,0 +1,112 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef CIELab_H
+#define CIELab_H
+
+/*
+ * Fast conversion of 8-bit sRGB to CIE L*a*b* (D65 white point), computing the same values as
+ * itk::Accessor::RGBToLabColorSpacePixelAccessor. The sRGB linearization (a pow() per channel)
+ * is a 256-entry table, and the cube root is an exact-to-float approximation (a bit trick refined
+ * by two Newton steps) instead of exp(log(x)/3).
+ */
+
+// Custom
+#include "Types.h"
+
+// STL
+#include <cmath>
+#include <cstring>
+
+#include <stdint.h>
+
+namespace CIELab
+{
+
+// The linear value (scaled to 0-100) of each 8-bit sRGB value.
+inline const float* GetLinearizationTable()
+{
+  struct Table
+  {
+    Table()
+    {
+      for(unsigned int i = 0; i < 256; ++i)
+        {
+        double value = static_cast<double>(i) / 255.0;
+        if(value > 0.04045)
+          {
+          value = pow((value + 0.055) / 1.055, 2.4);
+          }
+        else
+          {
+          value = value / 12.92;
+          }
+        Values[i] = static_cast<float>(value * 100.0);
+        }
+    }
+    float Values[256];
+  };
+  static const Table table; // Built once, the first time it is needed
+  return table.Values;
+}
+
+// The cube root of a positive number.
+inline float CubeRoot(const float x)
+{
+  // Dividing the exponent by 3 gives a guess within a few percent; each Newton step squares the relative error.
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  bits = bits / 3 + 709921077;
+  float y;
+  memcpy(&y, &bits, sizeof(y));
+  y = (2.0f * y + x / (y * y)) / 3.0f;
+  y = (2.0f * y + x / (y * y)) / 3.0f;
+  return y;
+}
+
+// The nonlinear function applied to X/Xn, Y/Yn and Z/Zn.
+inline float F(const float t)
+{
+  return t > 0.008856f ? CubeRoot(t) : 7.787f * t + 16.0f / 116.0f;
+}
+
+// Convert one 8-bit sRGB pixel to L, a, b.
+inline void ConvertPixel(const unsigned char r, const unsigned char g, const unsigned char b, float* lab)
+{
+  const float* linear = GetLinearizationTable();
+  const float red = linear[r];
+  const float green = linear[g];
+  const float blue = linear[b];
+
+  const float x = F((red * 0.4124f + green * 0.3576f + blue * 0.1805f) / 95.047f);
+  const float y = F((red * 0.2126f + green * 0.7152f + blue * 0.0722f) / 100.0f);
+  const float z = F((red * 0.0193f + green * 0.1192f + blue * 0.9505f) / 108.883f);
+
+  lab[0] = 116.0f * y - 16.0f;
+  lab[1] = 500.0f * (x - y);
+  lab[2] = 200.0f * (y - z);
+}
+
+// Convert an image whose first three components are RGB values (0-255) to a three component Lab image,
+// using several threads (all hardware threads if numberOfThreads is 0). The values are clamped to 0-255 and
+// truncated to 8 bits first, as when the image is converted to an RGBImageType.
+void ConvertImage(const FloatVectorImageType* image, FloatVectorImageType* labImage, const unsigned int numberOfThreads = 0);
+
+} // end namespace CIELab
+
+#endif
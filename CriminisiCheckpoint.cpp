@@ -0,0 +1,407 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "CriminisiCheckpoint.h"
+
+// STL
+#include <cstring>
+#include <iostream>
+
+#include <stdint.h>
+
+namespace
+{
+const char Magic[8] = {'C', 'R', 'I', 'M', 'C', 'K', 'P', 'T'};
+const uint32_t Version = 2;
+const uint32_t RecordMagic = 0x44524352; // "RCRD"
+
+struct FileHeader
+{
+  char Magic[8];
+  uint32_t Version;
+  uint32_t Size[2];
+  uint32_t NumberOfComponentsPerPixel;
+  uint32_t PatchRadius;
+  uint32_t TileSize;
+  uint32_t Reserved;
+};
+
+struct RecordHeader
+{
+  uint32_t Magic;
+  uint32_t Iteration;
+  uint32_t NumberOfSourceRegions;
+  uint32_t NumberOfTiles;
+  uint64_t PayloadSize;
+};
+
+// The number of buffer values (e.g. floats) per pixel. For a VectorImage this is the number of components,
+// and for an image of vectors it is 1 (the buffer holds whole vectors).
+template <typename TImage>
+size_t GetValuesPerPixel(const TImage* image)
+{
+  return image->GetPixelContainer()->Size() / image->GetLargestPossibleRegion().GetNumberOfPixels();
+}
+
+// The part of 'tile' that 'image' has pixels for. An image can cover only part of the image region
+// (the isophotes are only kept around the hole), and then only that part of each tile is saved.
+template <typename TImage>
+itk::ImageRegion<2> GetTileInImage(const TImage* image, const itk::ImageRegion<2>& inputTile)
+{
+  itk::ImageRegion<2> tile = inputTile;
+  if(!tile.Crop(image->GetLargestPossibleRegion()))
+    {
+    itk::Size<2> empty = {{0, 0}};
+    tile.SetSize(empty);
+    }
+  return tile;
+}
+
+// Add the pixels of 'tile' that are in the image, row by row, to the end of 'payload'.
+template <typename TImage>
+void AppendTile(std::vector<char>& payload, const TImage* image, const itk::ImageRegion<2>& inputTile)
+{
+  const itk::ImageRegion<2> tile = GetTileInImage(image, inputTile);
+  const size_t valuesPerPixel = GetValuesPerPixel(image);
+  const size_t rowBytes = tile.GetSize()[0] * valuesPerPixel * sizeof(typename TImage::InternalPixelType);
+  itk::Index<2> rowStart = tile.GetIndex();
+  for(unsigned int row = 0; row < tile.GetSize()[1]; ++row)
+    {
+    rowStart[1] = tile.GetIndex()[1] + row;
+    const char* source = reinterpret_cast<const char*>(image->GetBufferPointer() + image->ComputeOffset(rowStart) * valuesPerPixel);
+    payload.insert(payload.end(), source, source + rowBytes);
+    }
+}
+
+// Copy the pixels of 'tile' from 'data' (as written by AppendTile()) into the image, and advance 'data' past them.
+template <typename TImage>
+void ReadTile(const char*& data, TImage* image, const itk::ImageRegion<2>& inputTile)
+{
+  const itk::ImageRegion<2> tile = GetTileInImage(image, inputTile);
+  const size_t valuesPerPixel = GetValuesPerPixel(image);
+  const size_t rowBytes = tile.GetSize()[0] * valuesPerPixel * sizeof(typename TImage::InternalPixelType);
+  itk::Index<2> rowStart = tile.GetIndex();
+  for(unsigned int row = 0; row < tile.GetSize()[1]; ++row)
+    {
+    rowStart[1] = tile.GetIndex()[1] + row;
+    memcpy(image->GetBufferPointer() + image->ComputeOffset(rowStart) * valuesPerPixel, data, rowBytes);
+    data += rowBytes;
+    }
+}
+
+template <typename TImage>
+size_t GetTileBytes(const TImage* image, const itk::ImageRegion<2>& tile)
+{
+  return GetTileInImage(image, tile).GetNumberOfPixels() * GetValuesPerPixel(image) * sizeof(typename TImage::InternalPixelType);
+}
+
+} // end anonymous namespace
+
+const unsigned int CriminisiCheckpoint::TileSize;
+
+CriminisiCheckpoint::CriminisiCheckpoint()
+{
+  this->NumberOfTiles[0] = 0;
+  this->NumberOfTiles[1] = 0;
+  this->NumberOfSavedSourceRegions = 0;
+  this->PatchRadius = 0;
+  this->RewriteNeeded = false;
+}
+
+void CriminisiCheckpoint::SetImageRegion(const itk::ImageRegion<2>& region)
+{
+  this->ImageRegion = region;
+  this->NumberOfTiles[0] = (region.GetSize()[0] + TileSize - 1) / TileSize;
+  this->NumberOfTiles[1] = (region.GetSize()[1] + TileSize - 1) / TileSize;
+  this->ModifiedTiles.assign(this->NumberOfTiles[0] * this->NumberOfTiles[1], 0);
+}
+
+itk::ImageRegion<2> CriminisiCheckpoint::GetTileRegion(const unsigned int tileX, const unsigned int tileY) const
+{
+  itk::Index<2> corner = this->ImageRegion.GetIndex();
+  corner[0] += tileX * TileSize;
+  corner[1] += tileY * TileSize;
+
+  itk::Size<2> size;
+  size.Fill(TileSize);
+
+  itk::ImageRegion<2> tile(corner, size);
+  tile.Crop(this->ImageRegion);
+  return tile;
+}
+
+void CriminisiCheckpoint::MarkModified(const itk::ImageRegion<2>& inputRegion)
+{
+  itk::ImageRegion<2> region = inputRegion;
+  if(this->ModifiedTiles.empty() || !region.Crop(this->ImageRegion))
+    {
+    return;
+    }
+
+  const unsigned int firstX = (region.GetIndex()[0] - this->ImageRegion.GetIndex()[0]) / TileSize;
+  const unsigned int firstY = (region.GetIndex()[1] - this->ImageRegion.GetIndex()[1]) / TileSize;
+  const unsigned int lastX = (region.GetIndex()[0] - this->ImageRegion.GetIndex()[0] + region.GetSize()[0] - 1) / TileSize;
+  const unsigned int lastY = (region.GetIndex()[1] - this->ImageRegion.GetIndex()[1] + region.GetSize()[1] - 1) / TileSize;
+  for(unsigned int tileY = firstY; tileY <= lastY; ++tileY)
+    {
+    for(unsigned int tileX = firstX; tileX <= lastX; ++tileX)
+      {
+      this->ModifiedTiles[tileY * this->NumberOfTiles[0] + tileX] = 1;
+      }
+    }
+}
+
+bool CriminisiCheckpoint::Write(const std::string& fileName, const State& state, const unsigned int patchRadius)
+{
+  this->FileName = fileName;
+  this->PatchRadius = patchRadius;
+  this->RewriteNeeded = false;
+  SetImageRegion(state.Image->GetLargestPossibleRegion());
+  this->ModifiedTiles.assign(this->ModifiedTiles.size(), 1);
+  this->NumberOfSavedSourceRegions = 0;
+
+  // Write to a temporary file and rename it, so that the previous checkpoint is only replaced by a complete one.
+  std::string temporaryFileName = fileName + ".tmp";
+  FILE* file = fopen(temporaryFileName.c_str(), "wb");
+  if(!file)
+    {
+    std::cerr << "Could not write checkpoint file " << temporaryFileName << std::endl;
+    return false;
+    }
+
+  FileHeader header;
+  memset(&header, 0, sizeof(FileHeader));
+  memcpy(header.Magic, Magic, sizeof(Magic));
+  header.Version = Version;
+  header.Size[0] = this->ImageRegion.GetSize()[0];
+  header.Size[1] = this->ImageRegion.GetSize()[1];
+  header.NumberOfComponentsPerPixel = state.Image->GetNumberOfComponentsPerPixel();
+  header.PatchRadius = patchRadius;
+  header.TileSize = TileSize;
+  bool success = fwrite(&header, sizeof(FileHeader), 1, file) == 1;
+  success = success && WriteRecord(file, state);
+  success = (fclose(file) == 0) && success;
+
+  if(!success || rename(temporaryFileName.c_str(), fileName.c_str()) != 0)
+    {
+    std::cerr << "Could not write checkpoint file " << fileName << std::endl;
+    remove(temporaryFileName.c_str());
+    this->FileName.clear();
+    return false;
+    }
+  return true;
+}
+
+bool CriminisiCheckpoint::Append(const State& state)
+{
+  if(this->FileName.empty())
+    {
+    std::cerr << "Write() must be called before Append()!" << std::endl;
+    return false;
+    }
+
+  // After a failed append the end of the file may hold part of a record, and nothing after it could be read back.
+  if(this->RewriteNeeded)
+    {
+    return Write(this->FileName, state, this->PatchRadius);
+    }
+
+  FILE* file = fopen(this->FileName.c_str(), "ab");
+  if(!file)
+    {
+    std::cerr << "Could not open checkpoint file " << this->FileName << std::endl;
+    return false;
+    }
+
+  bool success = WriteRecord(file, state);
+  success = (fclose(file) == 0) && success;
+  if(!success)
+    {
+    std::cerr << "Could not append to checkpoint file " << this->FileName << std::endl;
+    this->RewriteNeeded = true;
+    }
+  return success;
+}
+
+bool CriminisiCheckpoint::WriteRecord(FILE* file, const State& state)
+{
+  std::vector<char> payload;
+
+  const unsigned int numberOfSourceRegions = state.SourceRegions.size() - this->NumberOfSavedSourceRegions;
+  for(unsigned int i = this->NumberOfSavedSourceRegions; i < state.SourceRegions.size(); ++i)
+    {
+    int32_t corner[2];
+    corner[0] = state.SourceRegions[i].GetIndex()[0];
+    corner[1] = state.SourceRegions[i].GetIndex()[1];
+    const char* bytes = reinterpret_cast<const char*>(corner);
+    payload.insert(payload.end(), bytes, bytes + sizeof(corner));
+    }
+
+  unsigned int numberOfTiles = 0;
+  for(unsigned int tileY = 0; tileY < this->NumberOfTiles[1]; ++tileY)
+    {
+    for(unsigned int tileX = 0; tileX < this->NumberOfTiles[0]; ++tileX)
+      {
+      if(!this->ModifiedTiles[tileY * this->NumberOfTiles[0] + tileX])
+        {
+        continue;
+        }
+      uint32_t position[2] = {tileX, tileY};
+      const char* bytes = reinterpret_cast<const char*>(position);
+      payload.insert(payload.end(), bytes, bytes + sizeof(position));
+
+      itk::ImageRegion<2> tile = GetTileRegion(tileX, tileY);
+      AppendTile(payload, state.Image, tile);
+      AppendTile(payload, state.MaskImage, tile);
+      AppendTile(payload, state.ConfidenceImage, tile);
+      AppendTile(payload, state.IsophoteImage, tile);
+      numberOfTiles++;
+      }
+    }
+
+  RecordHeader header;
+  header.Magic = RecordMagic;
+  header.Iteration = state.Iteration;
+  header.NumberOfSourceRegions = numberOfSourceRegions;
+  header.NumberOfTiles = numberOfTiles;
+  header.PayloadSize = payload.size();
+
+  bool success = fwrite(&header, sizeof(RecordHeader), 1, file) == 1;
+  success = success && (payload.empty() || fwrite(payload.data(), 1, payload.size(), file) == payload.size());
+  success = success && fwrite(&header.PayloadSize, sizeof(header.PayloadSize), 1, file) == 1;
+  success = (fflush(file) == 0) && success;
+
+  if(success)
+    {
+    this->ModifiedTiles.assign(this->ModifiedTiles.size(), 0);
+    this->NumberOfSavedSourceRegions = state.SourceRegions.size();
+    }
+  return success;
+}
+
+bool CriminisiCheckpoint::Read(const std::string& fileName, State& state, const unsigned int patchRadius)
+{
+  FILE* file = fopen(fileName.c_str(), "rb");
+  if(!file)
+    {
+    std::cerr << "Could not open checkpoint file " << fileName << std::endl;
+    return false;
+    }
+
+  SetImageRegion(state.Image->GetLargestPossibleRegion());
+
+  FileHeader header;
+  bool valid = fread(&header, sizeof(FileHeader), 1, file) == 1 &&
+               memcmp(header.Magic, Magic, sizeof(Magic)) == 0 &&
+               header.Version == Version &&
+               header.Size[0] == this->ImageRegion.GetSize()[0] &&
+               header.Size[1] == this->ImageRegion.GetSize()[1] &&
+               header.NumberOfComponentsPerPixel == state.Image->GetNumberOfComponentsPerPixel() &&
+               header.PatchRadius == patchRadius &&
+               header.TileSize == TileSize;
+  if(!valid)
+    {
+    std::cerr << "Checkpoint file " << fileName << " does not match this image and patch radius!" << std::endl;
+    fclose(file);
+    return false;
+    }
+
+  itk::Size<2> patchSize;
+  patchSize.Fill(2 * patchRadius + 1);
+
+  state.SourceRegions.clear();
+  unsigned int numberOfRecords = 0;
+  std::vector<char> payload;
+  RecordHeader record;
+  while(fread(&record, sizeof(RecordHeader), 1, file) == 1)
+    {
+    // Read the whole record and check that it is complete before changing anything.
+    uint64_t trailingPayloadSize = 0;
+    payload.resize(record.PayloadSize);
+    bool complete = record.Magic == RecordMagic &&
+                    (payload.empty() || fread(payload.data(), 1, payload.size(), file) == payload.size()) &&
+                    fread(&trailingPayloadSize, sizeof(trailingPayloadSize), 1, file) == 1 &&
+                    trailingPayloadSize == record.PayloadSize;
+    if(!complete)
+      {
+      std::cerr << "Ignoring an incomplete record at the end of checkpoint file " << fileName << std::endl;
+      break;
+      }
+
+    const char* data = payload.data();
+    const char* end = data + payload.size();
+    if(static_cast<size_t>(end - data) < record.NumberOfSourceRegions * 2 * sizeof(int32_t))
+      {
+      std::cerr << "Checkpoint file " << fileName << " is corrupt!" << std::endl;
+      fclose(file);
+      return false;
+      }
+    for(unsigned int i = 0; i < record.NumberOfSourceRegions; ++i)
+      {
+      int32_t corner[2];
+      memcpy(corner, data, sizeof(corner));
+      data += sizeof(corner);
+      itk::Index<2> index;
+      index[0] = corner[0];
+      index[1] = corner[1];
+      state.SourceRegions.push_back(itk::ImageRegion<2>(index, patchSize));
+      }
+
+    for(unsigned int i = 0; i < record.NumberOfTiles; ++i)
+      {
+      uint32_t position[2];
+      bool inside = static_cast<size_t>(end - data) >= sizeof(position);
+      if(inside)
+        {
+        memcpy(position, data, sizeof(position));
+        data += sizeof(position);
+        inside = position[0] < this->NumberOfTiles[0] && position[1] < this->NumberOfTiles[1];
+        }
+      itk::ImageRegion<2> tile;
+      if(inside)
+        {
+        tile = GetTileRegion(position[0], position[1]);
+        inside = static_cast<size_t>(end - data) >= GetTileBytes(state.Image, tile) + GetTileBytes(state.MaskImage, tile) +
+                                                     GetTileBytes(state.ConfidenceImage, tile) + GetTileBytes(state.IsophoteImage, tile);
+        }
+      if(!inside)
+        {
+        std::cerr << "Checkpoint file " << fileName << " is corrupt!" << std::endl;
+        fclose(file);
+        return false;
+        }
+      ReadTile(data, state.Image, tile);
+      ReadTile(data, state.MaskImage, tile);
+      ReadTile(data, state.ConfidenceImage, tile);
+      ReadTile(data, state.IsophoteImage, tile);
+      }
+
+    state.Iteration = record.Iteration;
+    numberOfRecords++;
+    }
+  fclose(file);
+
+  if(numberOfRecords == 0)
+    {
+    std::cerr << "Checkpoint file " << fileName << " has no complete records!" << std::endl;
+    return false;
+    }
+
+  state.MaskImage->Modified();
+  return true;
+}
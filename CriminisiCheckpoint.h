@@ -0,0 +1,113 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef CriminisiCheckpoint_H
+#define CriminisiCheckpoint_H
+
+/*
+ * This class saves the state of a CriminisiInpainting run to a single file so the run can be resumed.
+ * The images are divided into TileSize x TileSize tiles. Write() starts a file with every tile, and
+ * each Append() adds a record with only the tiles that were marked as modified since the last
+ * checkpoint, and the source patches that were added since then:
+ *
+ *   header: "CRIMCKPT", version, image size, components per pixel, patch radius, tile size
+ *   records: iteration, number of new source patches, number of tiles, payload size,
+ *            payload (source patch corners, then for each tile: its position and its pixels in
+ *            the image, the mask, the confidence image and the isophote image), payload size again
+ *
+ * An image that only covers part of the image region (the isophote image only covers a band around
+ * the hole) only has the pixels of each tile that it covers saved.
+ *
+ * The payload size is repeated at the end of a record, so a record that was only partly written
+ * (e.g. because the program was killed) is recognized and ignored by Read().
+ */
+
+// Custom
+#include "Types.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// ITK
+#include "itkImageRegion.h"
+
+// STL
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class CriminisiCheckpoint
+{
+public:
+  // The parts of the inpainting state that are saved. Everything else can be computed from these.
+  struct State
+  {
+    FloatVectorImageType* Image;
+    Mask* MaskImage;
+    FloatScalarImageType* ConfidenceImage;
+    FloatVector2ImageType* IsophoteImage;
+
+    // The source patches, in the order they were added.
+    std::vector<itk::ImageRegion<2> > SourceRegions;
+
+    unsigned int Iteration;
+  };
+
+  CriminisiCheckpoint();
+
+  // The width and height of a tile in pixels.
+  static const unsigned int TileSize = 64;
+
+  // Replace the file with one containing the whole state. Later calls to Append() add to this file.
+  bool Write(const std::string& fileName, const State& state, const unsigned int patchRadius);
+
+  // Remember that the pixels in 'region' changed.
+  void MarkModified(const itk::ImageRegion<2>& region);
+
+  // Add the modified tiles, and the source regions after the ones already saved, to the file given to Write().
+  bool Append(const State& state);
+
+  // Read a file into 'state'. The images must already be allocated with the size of the saved images;
+  // the saved source regions are put in state.SourceRegions. Returns false if the file cannot be used.
+  bool Read(const std::string& fileName, State& state, const unsigned int patchRadius);
+
+private:
+  // Size the tile grid for an image region.
+  void SetImageRegion(const itk::ImageRegion<2>& region);
+
+  itk::ImageRegion<2> GetTileRegion(const unsigned int tileX, const unsigned int tileY) const;
+
+  // Append a record with the modified tiles and the source regions starting at NumberOfSavedSourceRegions to 'file'.
+  bool WriteRecord(FILE* file, const State& state);
+
+  std::string FileName;
+  unsigned int PatchRadius;
+
+  // Set when an Append() failed, so the next one writes a new file instead.
+  bool RewriteNeeded;
+
+  itk::ImageRegion<2> ImageRegion;
+  unsigned int NumberOfTiles[2];
+
+  // Non-zero for the tiles that changed since the last checkpoint.
+  std::vector<unsigned char> ModifiedTiles;
+
+  unsigned int NumberOfSavedSourceRegions;
+};
+
+#endif
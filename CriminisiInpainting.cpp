@@ -19,29 +19,38 @@
 #include "CriminisiInpainting.h"
 
 // Custom
-#include "Helpers.h"
-#include "RotateVectors.h"
+#include "CIELab.h"
+#include "Parallel.h"
+#include "RegionHelpers.h"
 
-#include "SelfPatchCompare.h"
-#include "SelfPatchCompareColor.h"
-#include "SelfPatchCompareAll.h"
+// Submodules
+#include "ITKHelpers/ITKHelpers.h"
 
 // STL
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
+#include <limits>
 
 // VXL
 #include <vnl/vnl_double_2.h>
 
-// ITK
-#include "itkRGBToLuminanceImageFilter.h"
+const unsigned int CriminisiInpainting::MaskExpansionRadius;
 
 CriminisiInpainting::CriminisiInpainting()
 {
+  qRegisterMetaType<ImageRegionType>("itk::ImageRegion<2>");
+
   this->PatchRadius.Fill(3);
 
   this->BoundaryImage = UnsignedCharScalarImageType::New();
   this->BoundaryNormals = FloatVector2ImageType::New();
   this->IsophoteImage = FloatVector2ImageType::New();
+  this->SourceOffsetImage = OffsetImageType::New();
+  this->SearchRadius = 0;
+  this->LocalSearchRadius = 0;
+  this->LocalSearchRingWidth = 1;
+  this->LocalSearchThreshold = 0;
   this->PriorityImage = FloatScalarImageType::New();
   this->OriginalMask = Mask::New();
   this->CurrentMask = Mask::New();
@@ -55,8 +64,18 @@ CriminisiInpainting::CriminisiInpainting()
   this->DebugImages = false;
   this->DebugMessages = false;
   this->Iteration = 0;
+  this->PriorityUpdateRadius = 0;
+  this->NumberOfHolePixels = 0;
+  this->CheckpointInterval = 0;
+  this->NumberOfFronts = 1;
+
+  const char* phaseNames[NumberOfPhases] = {"FindBoundary", "ComputeBoundaryNormals", "ComputeDataTerms", "ComputePriorities",
+                                            "FindHighestPriority", "FindSourceRegion", "CopyPatch", "UpdateConfidences",
+                                            "UpdateMask", "AddSourcePatches", "Checkpoint"};
+  this->Timer.SetPhaseNames(std::vector<std::string>(phaseNames, phaseNames + NumberOfPhases));
   
   this->Stop = false;
+  this->Initialized = false;
 }
 
 void CriminisiInpainting::SetDifferenceType(const int differenceType)
@@ -110,36 +129,35 @@ void CriminisiInpainting::ComputeSourcePatches()
 
   try
   {
-    this->SourcePatches.clear();
+    this->PatchCompare.ClearSourcePatches();
     itk::ImageRegionConstIterator<FloatVectorImageType> imageIterator(this->OriginalImage, this->OriginalImage->GetLargestPossibleRegion());
 
     while(!imageIterator.IsAtEnd())
       {
       itk::Index<2> currentPixel = imageIterator.GetIndex();
-      itk::ImageRegion<2> region = Helpers::GetRegionInRadiusAroundPixel(currentPixel, this->PatchRadius[0]);
+      itk::ImageRegion<2> region = ITKHelpers::GetRegionInRadiusAroundPixel(currentPixel, this->PatchRadius[0]);
     
       if(this->CurrentMask->GetLargestPossibleRegion().IsInside(region))
 	{
 	if(this->CurrentMask->IsValid(region))
 	  {
-	  this->SourcePatches.push_back(region);
+	  this->PatchCompare.AddSourcePatch(region);
 	  }
 	}
     
       ++imageIterator;
       }
-    std::cout << "There are " << this->SourcePatches.size() << " source patches." << std::endl;
-    if(this->SourcePatches.size() == 0)
+    std::cout << "There are " << this->PatchCompare.GetSourcePatches().size() << " source patches." << std::endl;
+    if(this->PatchCompare.GetSourcePatches().size() == 0)
       {
-      std::cerr << "There must be at least 1 source patch!" << std::endl;
-      exit(-1);
+      throw itk::ExceptionObject(__FILE__, __LINE__, "There must be at least 1 source patch!", "CriminisiInpainting::ComputeSourcePatches");
       }
   }// end try
   catch( itk::ExceptionObject & err )
   {
     std::cerr << "ExceptionObject caught in ComputeSourcePatches!" << std::endl;
     std::cerr << err << std::endl;
-    exit(-1);
+    throw;
   }
 
 }
@@ -148,25 +166,33 @@ void CriminisiInpainting::SetPatchRadius(const unsigned int radius)
 {
   // Since this is the radius of the patch, there are no restrictions for the radius to be odd or even.
   this->PatchRadius.Fill(radius);
+  this->Initialized = false;
 }
 
 void CriminisiInpainting::SetImage(FloatVectorImageType::Pointer image)
 {
+  this->Initialized = false;
+
   // Store the original image
-  Helpers::DeepCopyVectorImage<FloatVectorImageType>(image, this->OriginalImage);
+  ITKHelpers::DeepCopy(image.GetPointer(), this->OriginalImage.GetPointer());
   
   // Initialize the result to the original image
-  Helpers::DeepCopyVectorImage<FloatVectorImageType>(image, this->CurrentImage);
+  ITKHelpers::DeepCopy(image.GetPointer(), this->CurrentImage.GetPointer());
   
-  RGBImageType::Pointer rgbImage = RGBImageType::New();
-  Helpers::VectorImageToRGBImage(this->CurrentImage, rgbImage);
-  
-  Helpers::RGBImageToCIELabImage(rgbImage, this->CIELabImage);
-  Helpers::DebugWriteImageConditional<FloatVectorImageType>(this->CIELabImage, "Debug/SetImage.CIELab.mha", this->DebugImages);
+  CIELab::ConvertImage(this->CurrentImage, this->CIELabImage);
+  if(this->DebugImages)
+    {
+    this->DebugWriter.Write(this->CIELabImage.GetPointer(), "Debug/SetImage.CIELab.mha", DebugImageWriter::ImageLayer);
+    }
+
+  // Patches are compared in CIELab.
+  this->PatchCompare.SetNumberOfComponentsPerPixel(this->CIELabImage->GetNumberOfComponentsPerPixel());
 }
 
 void CriminisiInpainting::SetMask(Mask::Pointer mask)
 {
+  this->Initialized = false;
+
   // Initialize the CurrentMask to the OriginalMask
   //Helpers::DeepCopy<Mask>(mask, this->CurrentMask);
   this->CurrentMask->DeepCopyFrom(mask);
@@ -176,11 +202,32 @@ void CriminisiInpainting::SetMask(Mask::Pointer mask)
   this->OriginalMask->DeepCopyFrom(mask);
 }
 
+DebugImageWriter* CriminisiInpainting::GetDebugImageWriter()
+{
+  return &this->DebugWriter;
+}
+
 void CriminisiInpainting::SetDebugMessages(const bool flag)
 {
   this->DebugMessages = flag;
 }
 
+void CriminisiInpainting::SetProfiling(const bool enabled)
+{
+  this->Timer.SetEnabled(enabled);
+}
+
+void CriminisiInpainting::SetProfilingOutput(const std::string& fileName)
+{
+  this->ProfilingOutputFileName = fileName;
+  this->Timer.SetEnabled(true);
+}
+
+const PhaseTimer& CriminisiInpainting::GetPhaseTimer() const
+{
+  return this->Timer;
+}
+
 void CriminisiInpainting::SetDebugImages(const bool flag)
 {
   this->DebugImages = flag;
@@ -191,7 +238,7 @@ void CriminisiInpainting::ExpandMask()
   // Expand the mask - this is necessary to prevent the isophotes from being undefined in the target region
   typedef itk::FlatStructuringElement<2> StructuringElementType;
   StructuringElementType::RadiusType radius;
-  radius.Fill(2); // Just a little bit of expansion
+  radius.Fill(MaskExpansionRadius); // Just a little bit of expansion
   //radius.Fill(this->PatchRadius[0]); // This was working, but huge expansion
   //radius.Fill(2.0* this->PatchRadius[0]);
 
@@ -204,7 +251,7 @@ void CriminisiInpainting::ExpandMask()
   
   if(this->DebugImages)
     {
-    Helpers::WriteImage<Mask>(expandMaskFilter->GetOutput(), "Debug/ExpandMask.expandedMask.mha");
+    this->DebugWriter.Write(expandMaskFilter->GetOutput(), "Debug/ExpandMask.expandedMask.mha", DebugImageWriter::MaskLayer);
     }
     
   //Helpers::DeepCopy<Mask>(expandMaskFilter->GetOutput(), this->CurrentMask);
@@ -212,7 +259,7 @@ void CriminisiInpainting::ExpandMask()
 
   //WriteScaledImage<Mask>(this->Mask, "expandedMask.mhd");
 #if defined(INTERACTIVE)
-  emit RefreshSignal();
+  emit RefreshSignal(this->CurrentMask->GetLargestPossibleRegion());
 #endif
 }
 
@@ -246,7 +293,7 @@ void CriminisiInpainting::InitializeConfidence()
   rescaleFilter->SetOutputMaximum(1);
   rescaleFilter->Update();
 
-  Helpers::DeepCopy<FloatScalarImageType>(rescaleFilter->GetOutput(), this->ConfidenceImage);
+  ITKHelpers::DeepCopy(rescaleFilter->GetOutput(), this->ConfidenceImage.GetPointer());
   //WriteImage<FloatImageType>(this->ConfidenceImage, "InitialConfidence.mhd");
 }
 
@@ -261,7 +308,7 @@ void CriminisiInpainting::InitializeData()
 void CriminisiInpainting::InitializeImage()
 {
   // Initialize to the input
-  Helpers::DeepCopyVectorImage<FloatVectorImageType>(this->OriginalImage, this->CurrentImage);
+  ITKHelpers::DeepCopy(this->OriginalImage.GetPointer(), this->CurrentImage.GetPointer());
   
   // We set hole pixels to green so we can visually ensure these pixels are not being copied during the inpainting
   FloatVectorImageType::PixelType green;
@@ -281,7 +328,7 @@ void CriminisiInpainting::InitializeImage()
     ++maskIterator;
     }
 #if defined(INTERACTIVE)
-  emit RefreshSignal();
+  emit RefreshSignal(this->CurrentMask->GetLargestPossibleRegion());
 #endif
 }
 
@@ -297,41 +344,45 @@ void CriminisiInpainting::Initialize()
 {
   try
   {
+    this->Timer.Clear();
     InitializeMask();
+    CountHolePixels();
     if(this->DebugImages)
       {
-      Helpers::WriteImage<Mask>(this->CurrentMask, "Debug/Initialize.CurrentMask.mha");
+      this->DebugWriter.Write(this->CurrentMask.GetPointer(), "Debug/Initialize.CurrentMask.mha", DebugImageWriter::MaskLayer);
       }
       
     InitializeImage();
     if(this->DebugImages)
       {
-      Helpers::WriteImage<FloatVectorImageType>(this->CurrentImage, "Debug/Initialize.CurrentImage.mha");
+      this->DebugWriter.Write(this->CurrentImage.GetPointer(), "Debug/Initialize.CurrentImage.mha", DebugImageWriter::ImageLayer);
       }
       
     // Do this before we mask the image with the expanded mask
     ComputeIsophotes();
     if(this->DebugImages)
       {
-      Helpers::WriteImage<FloatVector2ImageType>(this->IsophoteImage, "Debug/Initialize.IsophoteImage.mha");
+      this->DebugWriter.Write(this->IsophoteImage.GetPointer(), "Debug/Initialize.IsophoteImage.mha", DebugImageWriter::IsophoteLayer);
       }
+    InitializeSourceOffsets();
     
     InitializeData();
     if(this->DebugImages)
       {
-      Helpers::WriteImage<FloatScalarImageType>(this->DataImage, "Debug/Initialize.DataImage.mha");
+      this->DebugWriter.Write(this->DataImage.GetPointer(), "Debug/Initialize.DataImage.mha", DebugImageWriter::DataLayer);
       }
       
     InitializePriority();
+    InitializeBlurKernel();
     if(this->DebugImages)
       {
-      Helpers::WriteImage<FloatScalarImageType>(this->PriorityImage, "Debug/Initialize.PriorityImage.mha");
+      this->DebugWriter.Write(this->PriorityImage.GetPointer(), "Debug/Initialize.PriorityImage.mha", DebugImageWriter::PriorityLayer);
       }
       
     InitializeConfidence();
     if(this->DebugImages)
       {
-      Helpers::WriteImage<FloatScalarImageType>(this->ConfidenceImage, "Debug/Initialize.ConfidenceImage.mha");
+      this->DebugWriter.Write(this->ConfidenceImage.GetPointer(), "Debug/Initialize.ConfidenceImage.mha", DebugImageWriter::ConfidenceLayer);
       }
       
     // Debugging outputs
@@ -339,522 +390,1102 @@ void CriminisiInpainting::Initialize()
     //WriteImage<UnsignedCharImageType>(this->Mask, "InitialMask.mhd");
     //WriteImage<FloatImageType>(this->ConfidenceImage, "InitialConfidence.mhd");
     //WriteImage<VectorImageType>(this->IsophoteImage, "InitialIsophotes.mhd");
+
+    this->PatchCompare.SetImage(this->CIELabImage);
+    this->PatchCompare.SetMask(this->CurrentMask);
+    ComputeSourcePatches();
+
+    ComputeBoundaryAndPriorities();
+
+    this->Iteration = 0;
+    this->Stop = false;
+    this->FillOrder = FillOrderReport();
+
+    if(!this->CheckpointFileName.empty())
+      {
+      PhaseTimer::Scope scope(this->Timer, CheckpointPhase);
+      this->Checkpoint.Write(this->CheckpointFileName, GetCheckpointState(), this->PatchRadius[0]);
+      }
+    this->Timer.EndInitialization();
+    this->Initialized = true;
   }
   catch( itk::ExceptionObject & err )
   {
     std::cerr << "ExceptionObject caught in Initialize!" << std::endl;
     std::cerr << err << std::endl;
-    exit(-1);
+    throw;
   }
 }
 
-void CriminisiInpainting::Inpaint()
+void CriminisiInpainting::ComputeBoundaryAndPriorities()
 {
-  //std::cout << "CriminisiInpainting::Inpaint()" << std::endl;
+  // The boundary and the priorities are computed once here, and then only updated around each patch that is filled.
+  {
+  PhaseTimer::Scope scope(this->Timer, FindBoundaryPhase);
+  FindBoundary();
+  }
+  {
+  PhaseTimer::Scope scope(this->Timer, ComputeBoundaryNormalsPhase);
+  ComputeBoundaryNormals(this->CurrentMask->GetLargestPossibleRegion());
+  }
+  {
+  PhaseTimer::Scope scope(this->Timer, ComputeDataTermsPhase);
+  ComputeAllDataTerms();
+  }
+  {
+  PhaseTimer::Scope scope(this->Timer, ComputePrioritiesPhase);
+  ComputeAllPriorities();
+  }
+  DebugMessage("Computed priorities.");
+  if(this->DebugImages)
+    {
+    this->DebugWriter.Write(this->BoundaryNormals.GetPointer(), "Debug/Initialize.BoundaryNormals.mha", DebugImageWriter::BoundaryNormalsLayer);
+    }
+
+  // Computing the normals of the whole image used a lot of scratch memory. Give it back, and make room for the largest per-iteration buffers up front.
+  this->Scratch.Release();
+  this->Scratch.Reserve(GetScratchSize());
+}
+
+void CriminisiInpainting::SetCheckpoint(const std::string& fileName, const unsigned int interval)
+{
+  this->CheckpointFileName = fileName;
+  this->CheckpointInterval = interval;
+}
+
+CriminisiCheckpoint::State CriminisiInpainting::GetCheckpointState()
+{
+  CriminisiCheckpoint::State state;
+  state.Image = this->CurrentImage.GetPointer();
+  state.MaskImage = this->CurrentMask.GetPointer();
+  state.ConfidenceImage = this->ConfidenceImage.GetPointer();
+  state.IsophoteImage = this->IsophoteImage.GetPointer();
+  state.SourceRegions.reserve(this->PatchCompare.GetSourcePatches().size());
+  for(unsigned int i = 0; i < this->PatchCompare.GetSourcePatches().size(); ++i)
+    {
+    state.SourceRegions.push_back(this->PatchCompare.GetSourcePatches()[i].Region);
+    }
+  state.Iteration = this->Iteration;
+  return state;
+}
+
+bool CriminisiInpainting::WriteCheckpoint()
+{
+  if(this->CheckpointFileName.empty())
+    {
+    std::cerr << "SetCheckpoint() must be called before WriteCheckpoint()!" << std::endl;
+    return false;
+    }
+  return this->Checkpoint.Append(GetCheckpointState());
+}
+
+bool CriminisiInpainting::Resume(const std::string& fileName)
+{
+  // The images are overwritten below, so whatever was initialized before is gone even if the file cannot be used.
+  this->Initialized = false;
   try
   {
-    // Start the procedure
+    this->Timer.Clear();
+
+    // Allocate the images that are restored (and the ones computed from them) without computing what the checkpoint replaces.
+    const itk::ImageRegion<2> region = this->OriginalImage->GetLargestPossibleRegion();
+    this->CurrentMask->DeepCopyFrom(this->OriginalMask);
+    ITKHelpers::DeepCopy(this->OriginalImage.GetPointer(), this->CurrentImage.GetPointer());
+    this->ConfidenceImage->SetRegions(region);
+    this->ConfidenceImage->Allocate();
+    this->IsophoteImage->SetRegions(GetIsophoteRegion());
+    this->IsophoteImage->Allocate();
+    InitializeSourceOffsets();
+    InitializeData();
+    InitializePriority();
+    InitializeBlurKernel();
+
+    CriminisiCheckpoint::State state = GetCheckpointState();
+    if(!this->Checkpoint.Read(fileName, state, this->PatchRadius[0]))
+      {
+      return false;
+      }
+    this->Iteration = state.Iteration;
+    std::cout << "Resuming at iteration " << this->Iteration << std::endl;
+
+    // The patches copied into the CIELab image were conversions of the pixels copied into CurrentImage,
+    // so converting the restored image gives the same values (except in the hole, which is never compared).
+    CIELab::ConvertImage(this->CurrentImage, this->CIELabImage);
+
+    this->PatchCompare.SetImage(this->CIELabImage);
+    this->PatchCompare.SetMask(this->CurrentMask);
+    this->PatchCompare.ClearSourcePatches();
+    for(unsigned int i = 0; i < state.SourceRegions.size(); ++i)
+      {
+      this->PatchCompare.AddSourcePatch(state.SourceRegions[i]);
+      }
+
+    // Everything else is a function of the restored images, so computing it again gives the state the run was in.
+    CountHolePixels();
+    ComputeBoundaryAndPriorities();
+
     this->Stop = false;
+
+    // Start a new, compact checkpoint file from the restored state.
+    if(!this->CheckpointFileName.empty())
+      {
+      PhaseTimer::Scope scope(this->Timer, CheckpointPhase);
+      this->Checkpoint.Write(this->CheckpointFileName, GetCheckpointState(), this->PatchRadius[0]);
+      }
+    this->Timer.EndInitialization();
+    this->Initialized = true;
+  }
+  catch( itk::ExceptionObject & err )
+  {
+    std::cerr << "ExceptionObject caught in Resume!" << std::endl;
+    std::cerr << err << std::endl;
+    throw;
+  }
+  return true;
+}
+
+void CriminisiInpainting::Inpaint()
+{
+  //std::cout << "CriminisiInpainting::Inpaint()" << std::endl;
+  if(!this->Initialized)
+    {
     Initialize();
-    ComputeSourcePatches();
+    }
 
-    this->Iteration = 0;
-    while(HasMoreToInpaint() && !this->Stop)
+  while(HasMoreToInpaint() && !this->Stop)
+    {
+    if(!Iterate())
       {
-      std::cout << "Iteration: " << this->Iteration << std::endl;
+      break;
+      }
+    }
 
-      FindBoundary();
-      if(this->DebugImages)
-	{
-	Helpers::WriteImage<UnsignedCharScalarImageType>(this->BoundaryImage, "Debug/BoundaryImage.mha");
-	}
-      DebugMessage("Found boundary.");
-    
-      ComputeBoundaryNormals();
-      if(this->DebugImages)
-	{
-	Helpers::WriteImage<FloatVector2ImageType>(this->BoundaryNormals, "Debug/BoundaryNormals.mha");
-	}
-      DebugMessage("Computed boundary normals.");
+  if(this->NumberOfFronts > 1)
+    {
+    std::cout << "Filled " << this->FillOrder.NumberOfPatches << " patches with " << this->NumberOfFronts << " fronts. "
+              << this->FillOrder.NumberOfPatchesOutOfOrder << " were not the highest priority target when they were filled";
+    if(this->FillOrder.NumberOfPatches > 0)
+      {
+      std::cout << " (average rank " << static_cast<double>(this->FillOrder.TotalRank) / this->FillOrder.NumberOfPatches
+                << ", maximum rank " << this->FillOrder.MaximumRank << ")";
+      }
+    std::cout << "." << std::endl;
+    }
 
-      ComputeAllDataTerms();
-    
-      ComputeAllPriorities();
-      DebugMessage("Computed priorities.");
-      
-      itk::Index<2> pixelToFill = FindHighestPriority(this->PriorityImage);
-      DebugMessage<itk::Index<2> >("Highest priority found to be ", pixelToFill);
-      //std::cout << "Filling: " << pixelToFill << std::endl;
+  if(this->Timer.IsEnabled())
+    {
+    if(this->ProfilingOutputFileName.empty())
+      {
+      this->Timer.PrintSummary(std::cout);
+      }
+    else if(!this->Timer.WriteCSV(this->ProfilingOutputFileName))
+      {
+      std::cerr << "Could not write the phase times to " << this->ProfilingOutputFileName << std::endl;
+      }
+    }
 
-      //this->DebugWritePatch(pixelToFill, "PatchToFill", this->Iteration); // this must be done here because it is before the filling
+  // Make sure all of the debugging images are on disk before returning.
+  this->DebugWriter.Flush();
 
-      //itk::Index<2> bestMatchPixel = SelfPatchMatch<TImage, UnsignedCharImageType>(this->Image, this->Mask, pixelToFill, this->PatchRadius[0], iteration, this->Weights);
-      //std::cout << "Best match pixel: " << bestMatchPixel << std::endl;
+  // Another call starts over.
+  this->Initialized = false;
+}
 
-      itk::ImageRegion<2> targetRegion = Helpers::GetRegionInRadiusAroundPixel(pixelToFill, this->PatchRadius[0]);
+bool CriminisiInpainting::Iterate()
+{
+  try
+  {
+    if(this->DebugMessages)
+      {
+      std::cout << "Iteration: " << this->Iteration << std::endl;
+      }
+    this->FilledRegion = itk::ImageRegion<2>();
 
-      
-      //unsigned int bestMatchSourcePatchId = BestPatch<FloatVectorImageType>(this->CurrentImage, this->CurrentMask, this->SourcePatches, targetRegion);
-      
-      DebugMessage("Finding best patch...");
-      
-      SelfPatchCompare* patchCompare;
-      patchCompare = new SelfPatchCompareColor(this->CurrentImage->GetNumberOfComponentsPerPixel());
-      
-      //patchCompare->SetImage(this->CurrentImage);
-      patchCompare->SetImage(this->CIELabImage);
-      patchCompare->SetMask(this->CurrentMask);
-      patchCompare->SetSourceRegions(this->SourcePatches);
-      patchCompare->SetTargetRegion(targetRegion);
-      unsigned int bestMatchSourcePatchId = patchCompare->FindBestPatch();
-      //DebugMessage<unsigned int>("Found best patch to be ", bestMatchSourcePatchId);
-      //std::cout << "Found best patch to be " << bestMatchSourcePatchId << std::endl;
-      
-      //this->DebugWritePatch(this->SourcePatches[bestMatchSourcePatchId], "SourcePatch.png");
-      //this->DebugWritePatch(targetRegion, "TargetPatch.png");
-      
-      // Copy the patch. This is the actual inpainting step.
-      Helpers::CopySelfPatchIntoValidRegion<FloatVectorImageType>(this->CurrentImage, this->CurrentMask, this->SourcePatches[bestMatchSourcePatchId], targetRegion);
+    if(this->PriorityQueue.IsEmpty())
+      {
+      std::cerr << "There are pixels left to fill, but none of them are on the boundary!" << std::endl;
+      return false;
+      }
 
-      // Copy the new confidences into the confidence image
-      UpdateConfidences(targetRegion);
+    if(this->NumberOfFronts > 1)
+      {
+      FillMultipleFronts();
+      }
+    else
+      {
+      itk::Index<2> pixelToFill;
+      {
+      PhaseTimer::Scope scope(this->Timer, FindHighestPriorityPhase);
+      pixelToFill = FindHighestPriority();
+      }
+      DebugMessage<itk::Index<2> >("Highest priority found to be ", pixelToFill);
 
-      // The isophotes can be copied because they would only change slightly if recomputed.
-      Helpers::CopySelfPatchIntoValidRegion<FloatVector2ImageType>(this->IsophoteImage, this->CurrentMask, this->SourcePatches[bestMatchSourcePatchId], targetRegion);
+      DebugMessage("Finding best patch...");
+      itk::ImageRegion<2> targetRegion = ITKHelpers::GetRegionInRadiusAroundPixel(pixelToFill, this->PatchRadius[0]);
+      itk::ImageRegion<2> sourceRegion;
+      {
+      PhaseTimer::Scope scope(this->Timer, FindSourceRegionPhase);
+      sourceRegion = FindSourceRegion(targetRegion, this->SearchOffsets);
+      }
+      FillTarget(pixelToFill, sourceRegion);
+      }
 
-      // Update the mask
-      this->UpdateMask(pixelToFill);
-      DebugMessage("Updated mask.");
-      
-      // Sanity check everything
-      DebugWriteAllImages();
+    this->Iteration++;
 
-      this->Iteration++;
+    if(!this->CheckpointFileName.empty() && this->CheckpointInterval > 0 && this->Iteration % this->CheckpointInterval == 0)
+      {
+      PhaseTimer::Scope scope(this->Timer, CheckpointPhase);
+      WriteCheckpoint();
+      }
+    this->Timer.EndIteration(this->Iteration - 1);
 #if defined(INTERACTIVE)
-      emit RefreshSignal();
+    // Only the filled patches need to be redisplayed.
+    emit RefreshSignal(this->FilledRegion);
 #endif
-      } // end while(HasMoreToInpaint) loop
-
   }// end try
   catch( itk::ExceptionObject & err )
   {
-    std::cerr << "ExceptionObject caught in Inpaint!" << std::endl;
+    std::cerr << "ExceptionObject caught in Iterate!" << std::endl;
     std::cerr << err << std::endl;
-    exit(-1);
+    throw;
   }
+  return true;
 }
 
-void CriminisiInpainting::ComputeIsophotes()
+void CriminisiInpainting::FillTarget(const itk::Index<2>& pixelToFill, const itk::ImageRegion<2>& sourceRegion)
 {
-  
-  try
+  // Everything allocated from Scratch for the last patch is done with.
+  this->Scratch.Reset();
+
+  itk::ImageRegion<2> targetRegion = ITKHelpers::GetRegionInRadiusAroundPixel(pixelToFill, this->PatchRadius[0]);
+
   {
-    Helpers::DebugWriteImageConditional<FloatVectorImageType>(this->CurrentImage, "Debug/ComputeIsophotes.input.mha", this->DebugImages);
-    
-    /*
-    // This only works when the image is RGB
-    typedef itk::VectorMagnitudeImageFilter<FloatVectorImageType, UnsignedCharScalarImageType>  VectorMagnitudeFilterType;
-    VectorMagnitudeFilterType::Pointer magnitudeFilter = VectorMagnitudeFilterType::New();
-    magnitudeFilter->SetInput(this->OriginalImage); // We use the original image here because the image that has been painted green inside the hole has a strong gradient around the hole.
-    magnitudeFilter->Update();
-    */
-    RGBImageType::Pointer rgbImage = RGBImageType::New();
-    Helpers::VectorImageToRGBImage(this->OriginalImage, rgbImage);
-    
-    Helpers::DebugWriteImageConditional<RGBImageType>(rgbImage, "Debug/ComputeIsophotes.rgb.mha", this->DebugImages);
+  PhaseTimer::Scope scope(this->Timer, CopyPatchPhase);
 
-    typedef itk::RGBToLuminanceImageFilter< RGBImageType, FloatScalarImageType > LuminanceFilterType;
-    LuminanceFilterType::Pointer luminanceFilter = LuminanceFilterType::New();
-    luminanceFilter->SetInput(rgbImage);
-    luminanceFilter->Update();
-  
-    Helpers::DebugWriteImageConditional<FloatScalarImageType>(luminanceFilter->GetOutput(), "Debug/ComputeIsophotes.luminance.mha", this->DebugImages);
-    
-    // Blur the image to compute better gradient estimates
-    typedef itk::DiscreteGaussianImageFilter<FloatScalarImageType, FloatScalarImageType >  BlurFilterType;
-    BlurFilterType::Pointer blurFilter = BlurFilterType::New();
-    blurFilter->SetInput(luminanceFilter->GetOutput());
-    blurFilter->SetVariance(2);
-    blurFilter->Update();
-
-    Helpers::DebugWriteImageConditional<FloatScalarImageType>(blurFilter->GetOutput(), "Debug/ComputeIsophotes.blurred.mha", true);
-    
-    // Compute the gradient
-    // Template parameters are <TInputImage, TOperatorValueType, TOutputValueType>
-    typedef itk::GradientImageFilter<FloatScalarImageType, float, float>  GradientFilterType;
-    GradientFilterType::Pointer gradientFilter = GradientFilterType::New();
-    gradientFilter->SetInput(blurFilter->GetOutput());
-    gradientFilter->Update();
-
-    Helpers::DebugWriteImageConditional<FloatVector2ImageType>(gradientFilter->GetOutput(), "Debug/ComputeIsophotes.gradient.mha", this->DebugImages);
- 
-    // Rotate the gradient 90 degrees to obtain isophotes from gradient
-    typedef itk::UnaryFunctorImageFilter<FloatVector2ImageType, FloatVector2ImageType,
-    RotateVectors<
-      FloatVector2ImageType::PixelType,
-      FloatVector2ImageType::PixelType> > FilterType;
-
-    FilterType::Pointer rotateFilter = FilterType::New();
-    rotateFilter->SetInput(gradientFilter->GetOutput());
-    rotateFilter->Update();
-
-    Helpers::DebugWriteImageConditional<FloatVector2ImageType>(rotateFilter->GetOutput(), "Debug/ComputeIsophotes.rotatedGradient.mha", this->DebugImages);
-      
-    // Mask the isophote image with the expanded version of the inpainting mask.
-    // That is, keep only the values outside of the expanded mask. To do this, we have to first invert the mask.
+  // Copy the patch. This is the actual inpainting step.
+  CopyPatchIntoHole(this->CurrentImage.GetPointer(), sourceRegion, targetRegion);
 
-    // Invert the mask
-    typedef itk::InvertIntensityImageFilter <Mask> InvertIntensityImageFilterType;
-    InvertIntensityImageFilterType::Pointer invertMaskFilter = InvertIntensityImageFilterType::New();
-    invertMaskFilter->SetInput(this->CurrentMask);
-    invertMaskFilter->Update();
+  // Keep the image that patches are compared in up to date, so that later targets overlapping this one see the new pixels.
+  // The searches read it directly, so there is no planar copy of it to update.
+  CopyPatchIntoHole(this->CIELabImage.GetPointer(), sourceRegion, targetRegion);
 
-    if(this->DebugImages)
+  CopyIsophotesIntoHole(sourceRegion, targetRegion);
+
+  // Remember where each hole pixel came from.
+  const itk::ImageRegion<2> offsetRegion = this->SourceOffsetImage->GetLargestPossibleRegion();
+  const itk::Offset<2> sourceOffset = sourceRegion.GetIndex() - targetRegion.GetIndex();
+  for(unsigned int row = 0; row < targetRegion.GetSize()[1]; ++row)
+    {
+    for(unsigned int column = 0; column < targetRegion.GetSize()[0]; ++column)
       {
-      Helpers::WriteImage<Mask>(invertMaskFilter->GetOutput(), "Debug/ComputeIsophotes.invertedMask.mha");
+      itk::Index<2> index = {{targetRegion.GetIndex()[0] + column, targetRegion.GetIndex()[1] + row}};
+      if(offsetRegion.IsInside(index) && this->CurrentMask->IsHole(index))
+        {
+        this->SourceOffsetImage->SetPixel(index, sourceOffset);
+        }
       }
+    }
+  }
 
-    //std::cout << "rotateFilter: " << rotateFilter->GetOutput()->GetLargestPossibleRegion() << std::endl;
-    //std::cout << "invertMaskFilter: " << invertMaskFilter->GetOutput()->GetLargestPossibleRegion() << std::endl;
-    
-    // Keep only values outside the masked region
-    typedef itk::MaskImageFilter< FloatVector2ImageType, Mask, FloatVector2ImageType > MaskFilterType;
-    MaskFilterType::Pointer maskFilter = MaskFilterType::New();
-    maskFilter->SetInput1(rotateFilter->GetOutput());
-    maskFilter->SetInput2(invertMaskFilter->GetOutput());
-    maskFilter->Update();
+  // Copy the new confidences into the confidence image
+  {
+  PhaseTimer::Scope scope(this->Timer, UpdateConfidencesPhase);
+  UpdateConfidences(targetRegion);
+  }
 
-    if(this->DebugImages)
-      {
-      Helpers::WriteImage<FloatVector2ImageType>(maskFilter->GetOutput(), "Debug/ComputeIsophotes.maskedIsophotes.mha");
-      }
-      
-    Helpers::DeepCopy<FloatVector2ImageType>(maskFilter->GetOutput(), this->IsophoteImage);
-   
+  // Update the mask
+  {
+  PhaseTimer::Scope scope(this->Timer, UpdateMaskPhase);
+  this->UpdateMask(pixelToFill);
   }
-  catch( itk::ExceptionObject & err )
+  DebugMessage("Updated mask.");
+  this->Checkpoint.MarkModified(targetRegion);
+  RegionHelpers::ExpandToInclude(this->FilledRegion, CropToValidRegion(targetRegion));
+
   {
-    std::cerr << "ExceptionObject caught in ComputeIsophotes!" << std::endl;
-    std::cerr << err << std::endl;
-    exit(-1);
+  PhaseTimer::Scope scope(this->Timer, FindBoundaryPhase);
+  UpdateBoundary(targetRegion);
   }
+  DebugMessage("Updated boundary.");
+
+  {
+  PhaseTimer::Scope scope(this->Timer, AddSourcePatchesPhase);
+  AddSourcePatches(targetRegion);
+  }
+
+  // Only the normals and priorities near the filled patch can have changed.
+  itk::ImageRegion<2> dirtyRegion = targetRegion;
+  dirtyRegion.PadByRadius(this->PriorityUpdateRadius);
+  dirtyRegion = CropToValidRegion(dirtyRegion);
+
+  {
+  PhaseTimer::Scope scope(this->Timer, ComputeBoundaryNormalsPhase);
+  ComputeBoundaryNormals(dirtyRegion);
+  }
+  DebugMessage("Computed boundary normals.");
+
+  {
+  PhaseTimer::Scope scope(this->Timer, ComputePrioritiesPhase);
+  UpdatePriorities(dirtyRegion);
+  }
+  DebugMessage("Updated priorities.");
+
+  // Sanity check everything that changed
+  DebugWriteAllImages(dirtyRegion);
 }
 
-void CriminisiInpainting::StopInpainting()
+void CriminisiInpainting::FillMultipleFronts()
 {
-  this->Stop = true;
+  // Two targets are independent if neither is in the region the other's fill changes (its patch padded by
+  // PriorityUpdateRadius), and neither patch is in the region the other's new confidences are computed from
+  // (its patch padded by PatchRadius). Then filling one does not change the pixels, confidences or priority of the other.
+  const long radius = this->PatchRadius[0];
+  const long conflictDistance = 2 * radius + std::max(radius, static_cast<long>(this->PriorityUpdateRadius));
+
+  // Take the highest priority targets that are independent of all of the ones taken before them. Looking much further
+  // down the queue than the number of fronts rarely finds more, so the search is limited.
+  {
+  PhaseTimer::Scope scope(this->Timer, FindHighestPriorityPhase);
+  this->FrontTargets.clear();
+  this->TakenPriorities.clear();
+  const unsigned int maximumNumberOfCandidates = 4 * this->NumberOfFronts;
+  while(!this->PriorityQueue.IsEmpty() && this->FrontTargets.size() < this->NumberOfFronts &&
+        this->TakenPriorities.size() < maximumNumberOfCandidates)
+    {
+    const unsigned int key = this->PriorityQueue.GetTop();
+    this->TakenPriorities.push_back(std::make_pair(key, this->PriorityQueue.GetTopPriority()));
+    this->PriorityQueue.Remove(key);
+
+    const itk::Index<2> candidate = this->PriorityImage->ComputeIndex(key);
+    bool independent = true;
+    for(unsigned int i = 0; i < this->FrontTargets.size() && independent; ++i)
+      {
+      independent = std::abs(candidate[0] - this->FrontTargets[i][0]) > conflictDistance ||
+                    std::abs(candidate[1] - this->FrontTargets[i][1]) > conflictDistance;
+      }
+    if(independent)
+      {
+      this->FrontTargets.push_back(candidate);
+      }
+    }
+
+  // Put everything back. The targets leave the queue as they are filled, like any other boundary pixel.
+  for(unsigned int i = 0; i < this->TakenPriorities.size(); ++i)
+    {
+    this->PriorityQueue.Set(this->TakenPriorities[i].first, this->TakenPriorities[i].second);
+    }
+  }
+
+  // The searches only read the images, so they can all run at once.
+  const unsigned int numberOfTargets = this->FrontTargets.size();
+  this->FrontSourceRegions.resize(numberOfTargets);
+  if(this->FrontOffsets.size() < numberOfTargets)
+    {
+    this->FrontOffsets.resize(numberOfTargets);
+    }
+  {
+  PhaseTimer::Scope scope(this->Timer, FindSourceRegionPhase);
+  Parallel::ParallelFor(numberOfTargets, [this](unsigned int targetId)
+    {
+    itk::ImageRegion<2> targetRegion = ITKHelpers::GetRegionInRadiusAroundPixel(this->FrontTargets[targetId], this->PatchRadius[0]);
+    this->FrontSourceRegions[targetId] = FindSourceRegion(targetRegion, this->FrontOffsets[targetId]);
+    });
+  }
+
+  // Fill the targets in priority order. Just before each fill, its rank in the queue tells how far it is from the
+  // target a single front would fill next (0 if it is the same one).
+  for(unsigned int targetId = 0; targetId < numberOfTargets; ++targetId)
+    {
+    const unsigned int key = this->PriorityImage->ComputeOffset(this->FrontTargets[targetId]);
+    if(!this->PriorityQueue.Contains(key))
+      {
+      continue;
+      }
+    const unsigned int rank = this->PriorityQueue.GetRank(key);
+    this->FillOrder.NumberOfPatches++;
+    if(rank > 0)
+      {
+      this->FillOrder.NumberOfPatchesOutOfOrder++;
+      }
+    this->FillOrder.TotalRank += rank;
+    this->FillOrder.MaximumRank = std::max(this->FillOrder.MaximumRank, rank);
+
+    FillTarget(this->FrontTargets[targetId], this->FrontSourceRegions[targetId]);
+    }
 }
 
-bool CriminisiInpainting::HasMoreToInpaint()
+itk::ImageRegion<2> CriminisiInpainting::FindSourceRegion(const itk::ImageRegion<2>& targetRegion,
+                                                         std::vector<FloatVectorImageType::OffsetValueType>& validOffsets) const
 {
-  try
-  {
-    if(this->DebugImages)
+  if(this->SearchHints)
+    {
+    // Collect the distinct hints of the hole pixels of the target.
+    itk::Offset<2> hints[MaximumNumberOfHints];
+    unsigned int numberOfHints = 0;
+    itk::ImageRegion<2> hintRegion = targetRegion;
+    if(hintRegion.Crop(this->SearchHints->GetLargestPossibleRegion()))
       {
-      Helpers::WriteImage<Mask>(this->CurrentMask, "Debug/HasMoreToInpaint.input.png");
+      itk::ImageRegionConstIteratorWithIndex<OffsetImageType> hintIterator(this->SearchHints, hintRegion);
+      for(; !hintIterator.IsAtEnd() && numberOfHints < MaximumNumberOfHints; ++hintIterator)
+        {
+        const itk::Offset<2> hint = hintIterator.Get();
+        if((hint[0] == 0 && hint[1] == 0) || !this->CurrentMask->IsHole(hintIterator.GetIndex()) ||
+           std::find(hints, hints + numberOfHints, hint) != hints + numberOfHints)
+          {
+          continue;
+          }
+        hints[numberOfHints++] = hint;
+        }
       }
-      
-    itk::ImageRegionIterator<Mask> maskIterator(this->CurrentMask, this->CurrentMask->GetLargestPossibleRegion());
 
-    while(!maskIterator.IsAtEnd())
+    this->PatchCompare.ComputeOffsets(targetRegion, validOffsets);
+    float bestScore = std::numeric_limits<float>::max();
+    itk::ImageRegion<2> bestRegion;
+    bool found = false;
+    for(unsigned int i = 0; i < numberOfHints; ++i)
       {
-  //     if(this->Debug)
-  //       {
-  //       std::cout << "HasMoreToInpaint - mask pixel: " << static_cast<unsigned int>(maskIterator.Get()) << std::endl;
-  //       }
-      if(this->CurrentMask->IsHole(maskIterator.GetIndex()))
-	{
-	return true;
-	}
+      itk::Size<2> onePixel = {{1, 1}};
+      itk::ImageRegion<2> cornerWindow(targetRegion.GetIndex() + hints[i], onePixel);
+      cornerWindow.PadByRadius(this->SearchRadius);
+      if(this->PatchCompare.FindBestPatchInWindow(targetRegion, validOffsets, cornerWindow, bestScore, bestRegion))
+        {
+        found = true;
+        }
+      }
+    if(found)
+      {
+      return bestRegion;
+      }
+    }
 
-      ++maskIterator;
+  if(this->LocalSearchRadius > 0)
+    {
+    this->PatchCompare.ComputeOffsets(targetRegion, validOffsets);
+    const float acceptableScore = this->LocalSearchThreshold * validOffsets.size();
+    const itk::Index<2> center = targetRegion.GetIndex();
+    float bestScore = std::numeric_limits<float>::max();
+    itk::ImageRegion<2> bestRegion;
+
+    // The first step is the square around the target, and each further step the ring around the squares searched so far.
+    unsigned int radius = std::min(this->LocalSearchRingWidth, this->LocalSearchRadius);
+    itk::Size<2> onePixel = {{1, 1}};
+    itk::ImageRegion<2> firstWindow(center, onePixel);
+    firstWindow.PadByRadius(radius);
+    bool found = this->PatchCompare.FindBestPatchInWindow(targetRegion, validOffsets, firstWindow, bestScore, bestRegion);
+    while(!(found && bestScore <= acceptableScore) && radius < this->LocalSearchRadius)
+      {
+      const unsigned int outerRadius = std::min(radius + this->LocalSearchRingWidth, this->LocalSearchRadius);
+      if(this->PatchCompare.FindBestPatchInRing(targetRegion, validOffsets, center, radius, outerRadius, bestScore, bestRegion))
+        {
+        found = true;
+        }
+      radius = outerRadius;
+      }
+    if(found && bestScore <= acceptableScore)
+      {
+      return bestRegion;
       }
+    }
 
-    // If no pixels were holes, then we don't have any more to inpaint.
-    return false;
+  unsigned int bestPatchId = this->PatchCompare.FindBestPatch(targetRegion, validOffsets);
+  return this->PatchCompare.GetSourcePatches()[bestPatchId].Region;
+}
+
+void CriminisiInpainting::SetLocalSearch(const unsigned int windowRadius, const unsigned int ringWidth, const float threshold)
+{
+  this->LocalSearchRadius = windowRadius;
+  this->LocalSearchRingWidth = ringWidth > 0 ? ringWidth : 1;
+  this->LocalSearchThreshold = threshold;
+}
+
+void CriminisiInpainting::SetSearchHints(OffsetImageType::Pointer hints, const unsigned int searchRadius)
+{
+  this->SearchHints = hints;
+  this->SearchRadius = searchRadius;
+}
+
+OffsetImageType::Pointer CriminisiInpainting::GetSourceOffsetImage()
+{
+  return this->SourceOffsetImage;
+}
+
+void CriminisiInpainting::InitializeSourceOffsets()
+{
+  itk::Offset<2> zero = {{0, 0}};
+  this->SourceOffsetImage->SetRegions(GetIsophoteRegion());
+  this->SourceOffsetImage->Allocate();
+  this->SourceOffsetImage->FillBuffer(zero);
+}
+
+void CriminisiInpainting::SetNumberOfFronts(const unsigned int numberOfFronts)
+{
+  this->NumberOfFronts = numberOfFronts > 0 ? numberOfFronts : 1;
+}
+
+CriminisiInpainting::FillOrderReport CriminisiInpainting::GetFillOrderReport() const
+{
+  return this->FillOrder;
+}
+
+void CriminisiInpainting::ComputeIsophotes()
+{
+  try
+  {
+    // Isophotes are only read at boundary pixels and in the patches around them, so only the band around the hole is computed.
+    this->IsophoteImage->SetRegions(GetIsophoteRegion());
+    this->IsophoteImage->Allocate();
+    ComputeIsophotes(this->IsophoteImage->GetLargestPossibleRegion(), this->IsophoteImage->GetBufferPointer());
   }
   catch( itk::ExceptionObject & err )
   {
-    std::cerr << "ExceptionObject caught in HasMoreToInpaint!" << std::endl;
+    std::cerr << "ExceptionObject caught in ComputeIsophotes!" << std::endl;
     std::cerr << err << std::endl;
-    exit(-1);
+    throw;
   }
 }
 
-void CriminisiInpainting::FindBoundary()
+void CriminisiInpainting::ComputeIsophotes(const itk::ImageRegion<2>& region, FloatVector2Type* isophotes)
 {
-  try
-  {
-    // Compute the "outer" boundary of the region to fill. That is, we want the boundary pixels to be in the source region.
+  const itk::ImageRegion<2> imageRegion = this->CIELabImage->GetLargestPossibleRegion();
+  const long width = imageRegion.GetSize()[0];
+  const unsigned int components = this->CIELabImage->GetNumberOfComponentsPerPixel();
+  const float* lightness = this->CIELabImage->GetBufferPointer();
+  const unsigned char* mask = this->CurrentMask->GetBufferPointer();
+  const unsigned char holeValue = this->CurrentMask->GetHoleValue();
 
-    if(this->DebugImages)
+  // L is 0-100; scale the gradients to the 0-255 range the data term (and Alpha) is meant for.
+  const float scale = 2.55f / 8.0f;
+
+  for(unsigned int row = 0; row < region.GetSize()[1]; ++row)
+    {
+    itk::Index<2> index;
+    index[1] = region.GetIndex()[1] + row;
+    for(unsigned int column = 0; column < region.GetSize()[0]; ++column, ++isophotes)
       {
-      Helpers::WriteImage<Mask>(this->CurrentMask, "Debug/FindBoundary.CurrentMask.mha");
-      Helpers::WriteImage<Mask>(this->CurrentMask, "Debug/FindBoundary.CurrentMask.png");
+      index[0] = region.GetIndex()[0] + column;
+      const long offset = this->CIELabImage->ComputeOffset(index);
+      if(mask[offset] == holeValue)
+        {
+        (*isophotes)[0] = 0;
+        (*isophotes)[1] = 0;
+        continue;
+        }
+
+      // The 3x3 neighborhood. Neighbors outside of the image or in the hole take the value of the center pixel,
+      // so the isophotes do not depend on what the hole contains.
+      const float center = lightness[offset * components];
+      float neighborhood[3][3];
+      for(int y = -1; y <= 1; ++y)
+        {
+        for(int x = -1; x <= 1; ++x)
+          {
+          itk::Index<2> neighbor = {{index[0] + x, index[1] + y}};
+          const long neighborOffset = offset + y * width + x;
+          neighborhood[y + 1][x + 1] = (imageRegion.IsInside(neighbor) && mask[neighborOffset] != holeValue) ?
+                                       lightness[neighborOffset * components] : center;
+          }
+        }
+
+      // The Sobel operator as its separable factors: smooth with [1 2 1] across the derivative direction, then take the central difference.
+      float left = 0;
+      float right = 0;
+      float top = 0;
+      float bottom = 0;
+      for(unsigned int i = 0; i < 3; ++i)
+        {
+        const float weight = (i == 1) ? 2.0f : 1.0f;
+        left += weight * neighborhood[i][0];
+        right += weight * neighborhood[i][2];
+        top += weight * neighborhood[0][i];
+        bottom += weight * neighborhood[2][i];
+        }
+      const float gradientX = (right - left) * scale;
+      const float gradientY = (bottom - top) * scale;
+
+      // The isophote is the gradient rotated by 90 degrees.
+      (*isophotes)[0] = -gradientY;
+      (*isophotes)[1] = gradientX;
       }
+    }
+}
 
-    // Create a binary image (throw away the "dont use" pixels)
-    Mask::Pointer holeOnly = Mask::New();
-    holeOnly->DeepCopyFrom(this->CurrentMask);
-    
-    itk::ImageRegionIterator<Mask> maskIterator(holeOnly, holeOnly->GetLargestPossibleRegion());
-    // This should result in a white hole on a black background
-    while(!maskIterator.IsAtEnd())
+itk::ImageRegion<2> CriminisiInpainting::GetIsophoteRegion()
+{
+  const itk::ImageRegion<2> imageRegion = this->OriginalMask->GetLargestPossibleRegion();
+  const unsigned char* mask = this->OriginalMask->GetBufferPointer();
+  const unsigned char holeValue = this->OriginalMask->GetHoleValue();
+
+  // Find the bounding box of the hole.
+  long minimum[2] = {static_cast<long>(imageRegion.GetSize()[0]), static_cast<long>(imageRegion.GetSize()[1])};
+  long maximum[2] = {-1, -1};
+  for(unsigned int y = 0; y < imageRegion.GetSize()[1]; ++y)
+    {
+    const unsigned char* row = mask + static_cast<size_t>(y) * imageRegion.GetSize()[0];
+    for(unsigned int x = 0; x < imageRegion.GetSize()[0]; ++x)
       {
-      itk::Index<2> currentPixel = maskIterator.GetIndex();
-      if(!holeOnly->IsHole(currentPixel))
-	{
-	holeOnly->SetPixel(currentPixel, holeOnly->GetValidValue());
-	}
-      ++maskIterator;
+      if(row[x] == holeValue)
+        {
+        minimum[0] = std::min(minimum[0], static_cast<long>(x));
+        maximum[0] = std::max(maximum[0], static_cast<long>(x));
+        minimum[1] = std::min(minimum[1], static_cast<long>(y));
+        maximum[1] = std::max(maximum[1], static_cast<long>(y));
+        }
       }
+    }
 
-    if(this->DebugImages)
+  if(maximum[0] < 0)
+    {
+    // There is nothing to fill, so the isophotes are never used.
+    return imageRegion;
+    }
+
+  itk::ImageRegion<2> region;
+  for(unsigned int i = 0; i < 2; ++i)
+    {
+    region.SetIndex(i, imageRegion.GetIndex()[i] + minimum[i]);
+    region.SetSize(i, maximum[i] - minimum[i] + 1);
+    }
+  region.PadByRadius(MaskExpansionRadius + this->PatchRadius[0] + 1);
+  return CropToValidRegion(region);
+}
+
+void CriminisiInpainting::CopyIsophotesIntoHole(const itk::ImageRegion<2>& sourceRegion, const itk::ImageRegion<2>& targetRegion)
+{
+  // The isophotes can be copied because they would only change slightly if recomputed.
+  FloatVector2Type* sourceIsophotes = this->Scratch.Allocate<FloatVector2Type>(sourceRegion.GetNumberOfPixels());
+  ComputeIsophotes(sourceRegion, sourceIsophotes);
+
+  const itk::ImageRegion<2> isophoteRegion = this->IsophoteImage->GetLargestPossibleRegion();
+  for(unsigned int row = 0; row < targetRegion.GetSize()[1]; ++row)
+    {
+    for(unsigned int column = 0; column < targetRegion.GetSize()[0]; ++column)
       {
-      Helpers::WriteImage<Mask>(this->CurrentMask, "Debug/FindBoundary.HoleOnly.mha");
-      Helpers::WriteImage<Mask>(this->CurrentMask, "Debug/FindBoundary.HoleOnly.png");
+      itk::Index<2> index = {{targetRegion.GetIndex()[0] + column, targetRegion.GetIndex()[1] + row}};
+      if(isophoteRegion.IsInside(index) && this->CurrentMask->IsHole(index))
+        {
+        this->IsophoteImage->SetPixel(index, sourceIsophotes[row * targetRegion.GetSize()[0] + column]);
+        }
       }
-      
-    // Since the hole is white, we want the foreground value of the contour filter to be black. This means that the boundary will
-    // be detected in the black pixel region, which is on the outside edge of the hole like we want. However,
-    // The BinaryContourImageFilter will change all non-boundary pixels to the background color, so the resulting output will be inverted -
-    // the boundary pixels will be black and the non-boundary pixels will be white.
-    
-    // Find the boundary
-    typedef itk::BinaryContourImageFilter <Mask, Mask> binaryContourImageFilterType;
-    binaryContourImageFilterType::Pointer binaryContourFilter = binaryContourImageFilterType::New();
-    binaryContourFilter->SetInput(holeOnly);
-    binaryContourFilter->SetFullyConnected(true);
-    binaryContourFilter->SetForegroundValue(holeOnly->GetValidValue());
-    binaryContourFilter->SetBackgroundValue(holeOnly->GetHoleValue());
-    binaryContourFilter->Update();
+    }
+}
+
+void CriminisiInpainting::StopInpainting()
+{
+  this->Stop = true;
+}
+
+bool CriminisiInpainting::HasMoreToInpaint()
+{
+  return this->NumberOfHolePixels > 0;
+}
+
+void CriminisiInpainting::CountHolePixels()
+{
+  this->NumberOfHolePixels = 0;
+  itk::ImageRegionConstIterator<Mask> maskIterator(this->CurrentMask, this->CurrentMask->GetLargestPossibleRegion());
+  while(!maskIterator.IsAtEnd())
+    {
+    if(maskIterator.Get() == this->CurrentMask->GetHoleValue())
+      {
+      this->NumberOfHolePixels++;
+      }
+    ++maskIterator;
+    }
+  DebugMessage<unsigned int>("Number of hole pixels: ", this->NumberOfHolePixels);
+}
+
+void CriminisiInpainting::FindBoundary()
+{
+  try
+  {
+    // Compute the "outer" boundary of the region to fill. That is, we want the boundary pixels to be in the source region.
 
     if(this->DebugImages)
       {
-      Helpers::WriteImage<Mask>(binaryContourFilter->GetOutput(), "Debug/FindBoundary.Boundary.mha");
-      Helpers::WriteImage<Mask>(binaryContourFilter->GetOutput(), "Debug/FindBoundary.Boundary.png");
+      this->DebugWriter.Write(this->CurrentMask.GetPointer(), "Debug/FindBoundary.CurrentMask.mha", DebugImageWriter::MaskLayer);
+      this->DebugWriter.Write(this->CurrentMask.GetPointer(), "Debug/FindBoundary.CurrentMask.png", DebugImageWriter::MaskLayer);
       }
 
-    // Since we want to interpret non-zero pixels as boundary pixels, we must invert the image.
-    typedef itk::InvertIntensityImageFilter <Mask> InvertIntensityImageFilterType;
-    InvertIntensityImageFilterType::Pointer invertIntensityFilter = InvertIntensityImageFilterType::New();
-    invertIntensityFilter->SetInput(binaryContourFilter->GetOutput());
-    invertIntensityFilter->SetMaximum(255);
-    invertIntensityFilter->Update();
-    
-    //this->BoundaryImage = binaryContourFilter->GetOutput();
-    //this->BoundaryImage->Graft(binaryContourFilter->GetOutput());
-    Helpers::DeepCopy<UnsignedCharScalarImageType>(invertIntensityFilter->GetOutput(), this->BoundaryImage);
+    this->BoundaryImage->SetRegions(this->CurrentMask->GetLargestPossibleRegion());
+    this->BoundaryImage->Allocate();
+    this->BoundaryImage->FillBuffer(0);
+    this->BoundaryPixels.Initialize(this->BoundaryImage->GetLargestPossibleRegion().GetNumberOfPixels());
+
+    itk::ImageRegionConstIteratorWithIndex<Mask> maskIterator(this->CurrentMask, this->CurrentMask->GetLargestPossibleRegion());
+    while(!maskIterator.IsAtEnd())
+      {
+      UpdateBoundaryPixel(maskIterator.GetIndex());
+      ++maskIterator;
+      }
 
     if(this->DebugImages)
       {
-      Helpers::WriteImage<UnsignedCharScalarImageType>(this->BoundaryImage, "Debug/FindBoundary.BoundaryImage.mha");
+      this->DebugWriter.Write(this->BoundaryImage.GetPointer(), "Debug/FindBoundary.BoundaryImage.mha", DebugImageWriter::BoundaryLayer);
       }
   }
   catch( itk::ExceptionObject & err )
   {
     std::cerr << "ExceptionObject caught in FindBoundary!" << std::endl;
     std::cerr << err << std::endl;
-    exit(-1);
+    throw;
   }
 }
 
+void CriminisiInpainting::UpdateBoundary(const itk::ImageRegion<2>& filledRegion)
+{
+  // Filling a pixel can remove it from the boundary (it was a hole) or remove its neighbors from the boundary
+  // (they no longer touch a hole), so the region grown by one pixel covers every change.
+  itk::ImageRegion<2> region = filledRegion;
+  region.PadByRadius(1);
+  region = CropToValidRegion(region);
+
+  itk::ImageRegionConstIteratorWithIndex<Mask> maskIterator(this->CurrentMask, region);
+  while(!maskIterator.IsAtEnd())
+    {
+    UpdateBoundaryPixel(maskIterator.GetIndex());
+    ++maskIterator;
+    }
+}
+
+void CriminisiInpainting::UpdateBoundaryPixel(const itk::Index<2>& pixel)
+{
+  bool onBoundary = false;
+  if(!this->CurrentMask->IsHole(pixel))
+    {
+    itk::ImageRegion<2> neighborhood = CropToValidRegion(ITKHelpers::GetRegionInRadiusAroundPixel(pixel, 1));
+    itk::ImageRegionConstIteratorWithIndex<Mask> neighborIterator(this->CurrentMask, neighborhood);
+    while(!neighborIterator.IsAtEnd())
+      {
+      if(this->CurrentMask->IsHole(neighborIterator.GetIndex()))
+        {
+        onBoundary = true;
+        break;
+        }
+      ++neighborIterator;
+      }
+    }
+
+  if(onBoundary)
+    {
+    this->BoundaryImage->SetPixel(pixel, 255);
+    this->BoundaryPixels.Insert(this->BoundaryImage->ComputeOffset(pixel));
+    }
+  else
+    {
+    this->BoundaryImage->SetPixel(pixel, 0);
+    this->BoundaryPixels.Erase(this->BoundaryImage->ComputeOffset(pixel));
+    }
+}
+
 void CriminisiInpainting::UpdateMask(const itk::Index<2> inputPixel)
 {
   try
   {
-    // Create a black patch
-    Mask::Pointer blackPatch = Mask::New();
-    //Helpers::CreateBlankPatch<UnsignedCharScalarImageType>(blackPatch, this->PatchRadius[0]);
-    Helpers::CreateConstantPatch<Mask>(blackPatch, this->CurrentMask->GetValidValue(), this->PatchRadius[0]);
-    itk::Index<2> pixel;
-    pixel[0] = inputPixel[0] - blackPatch->GetLargestPossibleRegion().GetSize()[0]/2;
-    pixel[1] = inputPixel[1] - blackPatch->GetLargestPossibleRegion().GetSize()[1]/2;
-
-    // Paste it into the mask
-    typedef itk::PasteImageFilter <Mask, Mask> PasteImageFilterType;
-    PasteImageFilterType::Pointer pasteFilter = PasteImageFilterType::New();
-    //pasteFilter->SetInput(0, this->CurrentMask);
-    //pasteFilter->SetInput(1, blackPatch);
-    pasteFilter->SetSourceImage(blackPatch);
-    pasteFilter->SetDestinationImage(this->CurrentMask);
-    pasteFilter->SetSourceRegion(blackPatch->GetLargestPossibleRegion());
-    pasteFilter->SetDestinationIndex(pixel);
-    pasteFilter->Update();
-
-    // Not sure how Mask::DeepCopyFrom would work on the output of a filter, so do this manually.
-    Helpers::DeepCopy<Mask>(pasteFilter->GetOutput(), this->CurrentMask);
-    this->CurrentMask->SetHoleValue(this->OriginalMask->GetHoleValue());
-    this->CurrentMask->SetValidValue(this->OriginalMask->GetValidValue());
+    // Mark the whole patch (the part of it inside the image) as valid, directly in the mask buffer.
+    itk::ImageRegion<2> region = CropToValidRegion(ITKHelpers::GetRegionInRadiusAroundPixel(inputPixel, this->PatchRadius[0]));
+
+    const Mask::PixelType holeValue = this->CurrentMask->GetHoleValue();
+    const Mask::PixelType validValue = this->CurrentMask->GetValidValue();
+    itk::ImageRegionIterator<Mask> maskIterator(this->CurrentMask, region);
+    while(!maskIterator.IsAtEnd())
+      {
+      if(maskIterator.Get() == holeValue)
+        {
+        this->NumberOfHolePixels--;
+        }
+      maskIterator.Set(validValue);
+      ++maskIterator;
+      }
+
+    // The boundary normal filters read the mask, so they must know it changed.
+    this->CurrentMask->Modified();
   }
   catch( itk::ExceptionObject & err )
   {
     std::cerr << "ExceptionObject caught in UpdateMask!" << std::endl;
     std::cerr << err << std::endl;
-    exit(-1);
+    throw;
   }
 }
 
-void CriminisiInpainting::ComputeBoundaryNormals()
+void CriminisiInpainting::AddSourcePatches(const itk::ImageRegion<2>& filledRegion)
 {
   try
   {
-    // Blur the mask, compute the gradient, then keep the normals only at the original mask boundary
-    
-    if(this->DebugImages)
+    // Only patches that overlap the filled region can have just become entirely valid. Their centers are within
+    // PatchRadius of the region, and (like all source patches) they must be entirely inside the image.
+    const unsigned int radius = this->PatchRadius[0];
+    const itk::ImageRegion<2> imageRegion = this->CurrentMask->GetLargestPossibleRegion();
+    if(imageRegion.GetSize()[0] <= 2 * radius || imageRegion.GetSize()[1] <= 2 * radius)
       {
-      Helpers::WriteImage<UnsignedCharScalarImageType>(this->BoundaryImage, "Debug/ComputeBoundaryNormals.BoundaryImage.mha");
-      Helpers::WriteImage<Mask>(this->CurrentMask, "Debug/ComputeBoundaryNormals.CurrentMask.mha");
+      return;
+      }
+    itk::Index<2> innerCorner = imageRegion.GetIndex();
+    innerCorner[0] += radius;
+    innerCorner[1] += radius;
+    itk::Size<2> innerSize = imageRegion.GetSize();
+    innerSize[0] -= 2 * radius;
+    innerSize[1] -= 2 * radius;
+
+    itk::ImageRegion<2> centers = filledRegion;
+    centers.PadByRadius(radius);
+    if(!centers.Crop(itk::ImageRegion<2>(innerCorner, innerSize)))
+      {
+      return;
       }
-      
-    // Blur the mask
-    typedef itk::DiscreteGaussianImageFilter< Mask, FloatScalarImageType >  BlurFilterType;
-    BlurFilterType::Pointer gaussianFilter = BlurFilterType::New();
-    gaussianFilter->SetInput(this->CurrentMask);
-    gaussianFilter->SetVariance(2);
-    gaussianFilter->Update();
 
-    if(this->DebugImages)
+    // Count the hole pixels of every candidate patch with a summed area table over all of the patches.
+    itk::ImageRegion<2> window = centers;
+    window.PadByRadius(radius);
+
+    const unsigned int width = window.GetSize()[0];
+    const unsigned int height = window.GetSize()[1];
+    const unsigned int rowLength = width + 1;
+    unsigned int* holeCounts = this->Scratch.Allocate<unsigned int>(rowLength * (height + 1));
+    std::fill(holeCounts, holeCounts + rowLength, 0u);
+
+    const Mask::PixelType holeValue = this->CurrentMask->GetHoleValue();
+    itk::ImageRegionConstIterator<Mask> maskIterator(this->CurrentMask, window);
+    for(unsigned int y = 0; y < height; ++y)
       {
-      Helpers::WriteImage<FloatScalarImageType>(gaussianFilter->GetOutput(), "Debug/ComputeBoundaryNormals.BlurredMask.mha");
+      unsigned int rowCount = 0;
+      holeCounts[(y + 1) * rowLength] = 0;
+      for(unsigned int x = 0; x < width; ++x)
+        {
+        if(maskIterator.Get() == holeValue)
+          {
+          rowCount++;
+          }
+        holeCounts[(y + 1) * rowLength + x + 1] = holeCounts[y * rowLength + x + 1] + rowCount;
+        ++maskIterator;
+        }
       }
 
-    // Compute the gradient of the blurred mask
-    typedef itk::GradientImageFilter< FloatScalarImageType, float, float>  GradientFilterType;
-    GradientFilterType::Pointer gradientFilter = GradientFilterType::New();
-    gradientFilter->SetInput(gaussianFilter->GetOutput());
-    gradientFilter->Update();
+    const unsigned int patchSize = 2 * radius + 1;
+    itk::ImageRegionConstIteratorWithIndex<Mask> centerIterator(this->CurrentMask, centers);
+    while(!centerIterator.IsAtEnd())
+      {
+      itk::ImageRegion<2> patch = ITKHelpers::GetRegionInRadiusAroundPixel(centerIterator.GetIndex(), radius);
+      unsigned int x0 = patch.GetIndex()[0] - window.GetIndex()[0];
+      unsigned int y0 = patch.GetIndex()[1] - window.GetIndex()[1];
+      unsigned int x1 = x0 + patchSize;
+      unsigned int y1 = y0 + patchSize;
+      unsigned int holes = holeCounts[y1 * rowLength + x1] - holeCounts[y0 * rowLength + x1]
+                         - holeCounts[y1 * rowLength + x0] + holeCounts[y0 * rowLength + x0];
+      if(holes == 0)
+        {
+        this->PatchCompare.AddSourcePatch(patch); // Does nothing if the patch is already a source patch
+        }
+      ++centerIterator;
+      }
+  }
+  catch( itk::ExceptionObject & err )
+  {
+    std::cerr << "ExceptionObject caught in AddSourcePatches!" << std::endl;
+    std::cerr << err << std::endl;
+    throw;
+  }
+}
 
-    if(this->DebugImages)
+void CriminisiInpainting::ComputeBoundaryNormals(const itk::ImageRegion<2>& region)
+{
+  try
+  {
+    // Blur the mask, compute the gradient, then keep the normals only at the mask boundary.
+    // This computes the same thing as DiscreteGaussianImageFilter followed by GradientImageFilter (both with
+    // zero flux Neumann boundaries), but only as much of it as 'region' needs, in buffers from Scratch.
+
+    if(this->BoundaryNormals->GetLargestPossibleRegion() != this->CurrentMask->GetLargestPossibleRegion())
       {
-      Helpers::WriteImage<FloatVector2ImageType>(gradientFilter->GetOutput(), "Debug/ComputeBoundaryNormals.BlurredMaskGradient.mha");
+      this->BoundaryNormals->SetRegions(this->CurrentMask->GetLargestPossibleRegion());
+      this->BoundaryNormals->Allocate();
       }
 
-    // Only keep the normals at the boundary
-    typedef itk::MaskImageFilter< FloatVector2ImageType, UnsignedCharScalarImageType, FloatVector2ImageType > MaskFilterType;
-    MaskFilterType::Pointer maskFilter = MaskFilterType::New();
-    //maskFilter->SetInput1(gradientFilter->GetOutput());
-    //maskFilter->SetInput2(this->BoundaryImage);
-    maskFilter->SetInput(gradientFilter->GetOutput());
-    maskFilter->SetMaskImage(this->BoundaryImage);
-    maskFilter->Update();
+    const long imageWidth = this->CurrentMask->GetLargestPossibleRegion().GetSize()[0];
+    const long imageHeight = this->CurrentMask->GetLargestPossibleRegion().GetSize()[1];
+    const long kernelRadius = this->BlurKernel.size() / 2;
+
+    // The gradient in 'region' needs the blurred mask one pixel further out.
+    itk::ImageRegion<2> blurRegion = region;
+    blurRegion.PadByRadius(1);
+    blurRegion = CropToValidRegion(blurRegion);
+    const long blurX = blurRegion.GetIndex()[0];
+    const long blurY = blurRegion.GetIndex()[1];
+    const long blurWidth = blurRegion.GetSize()[0];
+    const long blurHeight = blurRegion.GetSize()[1];
+
+    // Blur along x, on all of the rows that the blur along y will need.
+    const long firstRow = std::max(0L, blurY - kernelRadius);
+    const long lastRow = std::min(imageHeight - 1, blurY + blurHeight - 1 + kernelRadius);
+    float* horizontal = this->Scratch.Allocate<float>((lastRow - firstRow + 1) * blurWidth);
+    const Mask::PixelType* maskBuffer = this->CurrentMask->GetBufferPointer();
+    for(long y = firstRow; y <= lastRow; ++y)
+      {
+      const Mask::PixelType* maskRow = maskBuffer + y * imageWidth;
+      float* output = horizontal + (y - firstRow) * blurWidth;
+      for(long x = 0; x < blurWidth; ++x)
+        {
+        float sum = 0;
+        for(long k = -kernelRadius; k <= kernelRadius; ++k)
+          {
+          long sampleX = std::min(imageWidth - 1, std::max(0L, blurX + x + k));
+          sum += this->BlurKernel[k + kernelRadius] * maskRow[sampleX];
+          }
+        output[x] = sum;
+        }
+      }
 
-    if(this->DebugImages)
+    // Blur along y.
+    float* blurred = this->Scratch.Allocate<float>(blurWidth * blurHeight);
+    for(long y = 0; y < blurHeight; ++y)
       {
-      Helpers::WriteImage<FloatVector2ImageType>(maskFilter->GetOutput(), "Debug/ComputeBoundaryNormals.BoundaryNormalsUnnormalized.mha");
+      for(long x = 0; x < blurWidth; ++x)
+        {
+        float sum = 0;
+        for(long k = -kernelRadius; k <= kernelRadius; ++k)
+          {
+          long sampleY = std::min(imageHeight - 1, std::max(0L, blurY + y + k));
+          sum += this->BlurKernel[k + kernelRadius] * horizontal[(sampleY - firstRow) * blurWidth + x];
+          }
+        blurred[y * blurWidth + x] = sum;
+        }
       }
-      
-    //this->BoundaryNormals = maskFilter->GetOutput();
-    //this->BoundaryNormals->Graft(maskFilter->GetOutput());
-    Helpers::DeepCopy<FloatVector2ImageType>(maskFilter->GetOutput(), this->BoundaryNormals);
 
-    // Normalize the vectors because we just care about their direction (the Data term computation calls for the normalized boundary normal)
-    itk::ImageRegionIterator<FloatVector2ImageType> boundaryNormalsIterator(this->BoundaryNormals, this->BoundaryNormals->GetLargestPossibleRegion());
-    itk::ImageRegionConstIterator<UnsignedCharScalarImageType> boundaryIterator(this->BoundaryImage, this->BoundaryImage->GetLargestPossibleRegion());
+    // Keep only the normals at the boundary. Normalize them because we just care about their direction
+    // (the Data term computation calls for the normalized boundary normal).
+    itk::ImageRegionIteratorWithIndex<FloatVector2ImageType> boundaryNormalsIterator(this->BoundaryNormals, region);
+    itk::ImageRegionConstIterator<UnsignedCharScalarImageType> boundaryIterator(this->BoundaryImage, region);
 
+    FloatVector2ImageType::PixelType zero;
+    zero.Fill(0);
     while(!boundaryNormalsIterator.IsAtEnd())
       {
       if(boundaryIterator.Get()) // The pixel is on the boundary
         {
-        FloatVector2ImageType::PixelType p = boundaryNormalsIterator.Get();
+        const long x = boundaryNormalsIterator.GetIndex()[0];
+        const long y = boundaryNormalsIterator.GetIndex()[1];
+        const long left = std::max(0L, x - 1) - blurX;
+        const long right = std::min(imageWidth - 1, x + 1) - blurX;
+        const long up = std::max(0L, y - 1) - blurY;
+        const long down = std::min(imageHeight - 1, y + 1) - blurY;
+
+        FloatVector2ImageType::PixelType p;
+        p[0] = 0.5f * (blurred[(y - blurY) * blurWidth + right] - blurred[(y - blurY) * blurWidth + left]);
+        p[1] = 0.5f * (blurred[down * blurWidth + (x - blurX)] - blurred[up * blurWidth + (x - blurX)]);
         p.Normalize();
         boundaryNormalsIterator.Set(p);
         }
+      else
+        {
+        boundaryNormalsIterator.Set(zero);
+        }
       ++boundaryNormalsIterator;
       ++boundaryIterator;
       }
-
-    if(this->DebugImages)
-      {
-      Helpers::WriteImage<FloatVector2ImageType>(this->BoundaryNormals, "Debug/ComputeBoundaryNormals.BoundaryNormals.mha");
-      }
   }
   catch( itk::ExceptionObject & err )
   {
     std::cerr << "ExceptionObject caught in ComputeBoundaryNormals!" << std::endl;
     std::cerr << err << std::endl;
-    exit(-1);
+    throw;
   }
 }
 
-itk::Index<2> CriminisiInpainting::FindHighestPriority(FloatScalarImageType::Pointer priorityImage)
+itk::Index<2> CriminisiInpainting::FindHighestPriority()
+{
+  // Ties go to the first pixel in raster order, as they did when the whole priority image was scanned.
+  DebugMessage<float>("Highest priority: ", this->PriorityQueue.GetTopPriority());
+  return this->PriorityImage->ComputeIndex(this->PriorityQueue.GetTop());
+}
+
+void CriminisiInpainting::ComputeAllPriorities()
 {
   try
   {
-    // We would rather explicity find the maximum on the boundary
-    /*
-    typedef itk::MinimumMaximumImageCalculator <FloatScalarImageType> ImageCalculatorFilterType;
-    ImageCalculatorFilterType::Pointer imageCalculatorFilter = ImageCalculatorFilterType::New ();
-    imageCalculatorFilter->SetImage(priorityImage);
-    imageCalculatorFilter->Compute();
-    
-    DebugMessage<float>("Highest priority: ", imageCalculatorFilter->GetMaximum());
-    DebugMessage<float>("Lowest priority: ", imageCalculatorFilter->GetMinimum());
-    
-    return imageCalculatorFilter->GetIndexOfMaximum();
-    */
-    float maxPriority = 0; // priorities are non-negative, so anything better than 0 will win
-    itk::Index<2> locationOfMaxPriority;
-    itk::ImageRegionConstIteratorWithIndex<UnsignedCharScalarImageType> boundaryIterator(this->BoundaryImage, this->BoundaryImage->GetLargestPossibleRegion());
+    this->PriorityQueue.Initialize(this->PriorityImage->GetLargestPossibleRegion().GetNumberOfPixels());
 
-    while(!boundaryIterator.IsAtEnd())
+    // Only compute priorities for pixels on the boundary
+    for(IndexedSet::ConstIterator iterator = this->BoundaryPixels.Begin(); iterator != this->BoundaryPixels.End(); ++iterator)
       {
-      if(boundaryIterator.Get())
-	{
-	if(this->PriorityImage->GetPixel(boundaryIterator.GetIndex()) > maxPriority)
-	  {
-	  maxPriority = this->PriorityImage->GetPixel(boundaryIterator.GetIndex());
-	  locationOfMaxPriority = boundaryIterator.GetIndex();
-	  }
-	}
-      ++boundaryIterator;
+      itk::Index<2> pixel = this->PriorityImage->ComputeIndex(*iterator);
+      float priority = ComputePriority(pixel);
+      this->PriorityImage->SetPixel(pixel, priority);
+      this->PriorityQueue.Set(*iterator, priority);
       }
-    DebugMessage<float>("Highest priority: ", maxPriority);
-    return locationOfMaxPriority;
+    DebugMessage<unsigned int>("Number of boundary pixels: ", this->BoundaryPixels.GetSize());
   }
   catch( itk::ExceptionObject & err )
   {
-    std::cerr << "ExceptionObject caught in FindHighestPriority!" << std::endl;
+    std::cerr << "ExceptionObject caught in ComputeAllPriorities!" << std::endl;
     std::cerr << err << std::endl;
-    exit(-1);
+    throw;
   }
 }
 
-void CriminisiInpainting::ComputeAllPriorities()
+void CriminisiInpainting::UpdatePriorities(const itk::ImageRegion<2>& region)
 {
   try
   {
-    // Only compute priorities for pixels on the boundary
-    itk::ImageRegionConstIterator<UnsignedCharScalarImageType> boundaryIterator(this->BoundaryImage, this->BoundaryImage->GetLargestPossibleRegion());
-    itk::ImageRegionIterator<FloatScalarImageType> priorityIterator(this->PriorityImage, this->PriorityImage->GetLargestPossibleRegion());
+    itk::ImageRegionConstIteratorWithIndex<UnsignedCharScalarImageType> boundaryIterator(this->BoundaryImage, region);
 
-    // Blank the priority image.
-    this->PriorityImage->FillBuffer(0);
-
-    // The main loop is over the boundary image. We only want to compute priorities at boundary pixels.
-    unsigned int boundaryPixelCounter = 0;
     while(!boundaryIterator.IsAtEnd())
       {
+      itk::Index<2> currentPixel = boundaryIterator.GetIndex();
+      unsigned int offset = this->PriorityImage->ComputeOffset(currentPixel);
       if(boundaryIterator.Get() != 0) // Pixel is on the boundary
-	{
-	float priority = ComputePriority(boundaryIterator.GetIndex());
-	//DebugMessage<float>("Priority: ", priority);
-	priorityIterator.Set(priority);
-	boundaryPixelCounter++;
-	}    
+        {
+        this->DataImage->SetPixel(currentPixel, ComputeDataTerm(currentPixel));
+        float priority = ComputePriority(currentPixel);
+        this->PriorityImage->SetPixel(currentPixel, priority);
+        this->PriorityQueue.Set(offset, priority);
+        }
+      else if(this->PriorityQueue.Contains(offset)) // Pixel has just left the boundary
+        {
+        this->DataImage->SetPixel(currentPixel, 0);
+        this->PriorityImage->SetPixel(currentPixel, 0);
+        this->PriorityQueue.Remove(offset);
+        }
       ++boundaryIterator;
-      ++priorityIterator;
       }
-    DebugMessage<unsigned int>("Number of boundary pixels: ", boundaryPixelCounter);
   }
   catch( itk::ExceptionObject & err )
   {
-    std::cerr << "ExceptionObject caught in ComputeAllPriorities!" << std::endl;
+    std::cerr << "ExceptionObject caught in UpdatePriorities!" << std::endl;
     std::cerr << err << std::endl;
-    exit(-1);
+    throw;
   }
 }
 
+void CriminisiInpainting::InitializeBlurKernel()
+{
+  // The same kernel DiscreteGaussianImageFilter would use with this variance (and its default maximum error and kernel width).
+  itk::GaussianOperator<float, 2> gaussianOperator;
+  gaussianOperator.SetDirection(0);
+  gaussianOperator.SetVariance(2);
+  gaussianOperator.SetMaximumError(0.01);
+  gaussianOperator.SetMaximumKernelWidth(32);
+  gaussianOperator.CreateDirectional();
+
+  this->BlurKernel.assign(gaussianOperator.Begin(), gaussianOperator.End());
+
+  // The gradient of the blurred mask looks one more pixel away.
+  this->PriorityUpdateRadius = gaussianOperator.GetRadius(0) + 1;
+}
+
+size_t CriminisiInpainting::GetScratchSize()
+{
+  // The largest of each buffer one iteration takes from Scratch (see UpdateConfidences(), CopyIsophotesIntoHole(), AddSourcePatches()
+  // and ComputeBoundaryNormals()),
+  // plus some room for alignment.
+  const size_t patchSize = GetPatchSize()[0];
+  const size_t confidenceWindow = patchSize + 2 * this->PatchRadius[0] + 1;
+  const size_t blurWindow = patchSize + 2 * this->PriorityUpdateRadius + 2;
+  const size_t blurRows = blurWindow + this->BlurKernel.size();
+  const size_t sourcePatchWindow = patchSize + 4 * this->PatchRadius[0] + 1;
+  return confidenceWindow * confidenceWindow * sizeof(double) + sourcePatchWindow * sourcePatchWindow * sizeof(unsigned int)
+         + (blurRows + blurWindow) * blurWindow * sizeof(float) + patchSize * patchSize * sizeof(FloatVector2Type) + 256;
+}
+
 float CriminisiInpainting::ComputePriority(const itk::Index<2>& queryPixel)
 {
   //double confidence = ComputeConfidenceTerm(queryPixel);
@@ -876,7 +1507,7 @@ float CriminisiInpainting::ComputeConfidenceTerm(const itk::Index<2>& queryPixel
     // Allow for regions on/near the image border
 
     itk::ImageRegion<2> region = this->CurrentMask->GetLargestPossibleRegion();
-    region.Crop(Helpers::GetRegionInRadiusAroundPixel(queryPixel, this->PatchRadius[0]));
+    region.Crop(ITKHelpers::GetRegionInRadiusAroundPixel(queryPixel, this->PatchRadius[0]));
     itk::ImageRegionConstIterator<Mask> maskIterator(this->CurrentMask, region);
     itk::ImageRegionConstIterator<FloatScalarImageType> confidenceIterator(this->ConfidenceImage, region);
 
@@ -908,7 +1539,7 @@ float CriminisiInpainting::ComputeConfidenceTerm(const itk::Index<2>& queryPixel
   {
     std::cerr << "ExceptionObject caught in ComputeConfidenceTerm!" << std::endl;
     std::cerr << err << std::endl;
-    exit(-1);
+    throw;
   }
 }
 
@@ -940,55 +1571,74 @@ float CriminisiInpainting::ComputeDataTerm(const itk::Index<2>& queryPixel)
   {
     std::cerr << "ExceptionObject caught in ComputeDataTerm!" << std::endl;
     std::cerr << err << std::endl;
-    exit(-1);
+    throw;
   }
 }
 
-// This struct is used by UpdateConfidences to keep track of the pixels and their values that should be replaced.
-// We have to do this in a two pass fashion because the old neighboring values cannot be changed until all new values
-// have been computed.
-struct UpdatePixel
-{
-  UpdatePixel(const itk::Index<2>& i, const float v) : index(i), value(v) {}
-  itk::Index<2> index;
-  float value;
-};
-
 void CriminisiInpainting::UpdateConfidences(const itk::ImageRegion<2>& inputRegion)
 {
   try
   {
     // Force the region to update to be entirely inside the image
     itk::ImageRegion<2> region = CropToValidRegion(inputRegion);
-    
-    // Use an iterator to find masked pixels. Compute their new value, and save it in a vector of pixels and their new values.
-    // Do not update the pixels until after all new values have been computed, because we want to use the old values in all of
-    // the computations.
-    itk::ImageRegionConstIterator<Mask> maskIterator(this->CurrentMask, region);
 
-    std::vector<UpdatePixel> pixelsToUpdate;
-    while(!maskIterator.IsAtEnd())
+    // The confidence of a pixel is the sum of the confidences of the valid pixels in the patch around it, divided by the area of the patch.
+    // Build a summed area table of confidence*validity over every pixel that the patches around 'region' cover, so each sum is 4 lookups.
+    // The table is built from the old values before any are replaced, so all new values are computed from the old ones.
+    itk::ImageRegion<2> window = region;
+    window.PadByRadius(this->PatchRadius[0]);
+    window = CropToValidRegion(window);
+
+    const unsigned int width = window.GetSize()[0];
+    const unsigned int height = window.GetSize()[1];
+    const unsigned int rowLength = width + 1;
+    double* confidenceSums = this->Scratch.Allocate<double>(rowLength * (height + 1));
+    std::fill(confidenceSums, confidenceSums + rowLength, 0.0);
+
+    const Mask::PixelType validValue = this->CurrentMask->GetValidValue();
+    itk::ImageRegionConstIterator<Mask> maskIterator(this->CurrentMask, window);
+    itk::ImageRegionConstIterator<FloatScalarImageType> confidenceIterator(this->ConfidenceImage, window);
+    for(unsigned int y = 0; y < height; ++y)
       {
-      if(this->CurrentMask->IsHole(maskIterator.GetIndex()))
-	{
-	itk::Index<2> currentPixel = maskIterator.GetIndex();
-	pixelsToUpdate.push_back(UpdatePixel(currentPixel, ComputeConfidenceTerm(currentPixel)));
-	}
-
-      ++maskIterator;
-      } // end while looop with iterator
+      double rowSum = 0;
+      confidenceSums[(y + 1) * rowLength] = 0;
+      for(unsigned int x = 0; x < width; ++x)
+        {
+        if(maskIterator.Get() == validValue)
+          {
+          rowSum += confidenceIterator.Get();
+          }
+        confidenceSums[(y + 1) * rowLength + x + 1] = confidenceSums[y * rowLength + x + 1] + rowSum;
+        ++maskIterator;
+        ++confidenceIterator;
+        }
+      }
 
-    // Actually update the pixels
-    for(unsigned int i = 0; i < pixelsToUpdate.size(); ++i)
+    const float areaOfPatch = static_cast<float>(GetNumberOfPixelsInPatch());
+    itk::ImageRegionConstIteratorWithIndex<Mask> holeIterator(this->CurrentMask, region);
+    while(!holeIterator.IsAtEnd())
       {
-      this->ConfidenceImage->SetPixel(pixelsToUpdate[i].index, pixelsToUpdate[i].value);
+      if(this->CurrentMask->IsHole(holeIterator.GetIndex()))
+        {
+        // Allow for patches on/near the image border
+        itk::ImageRegion<2> patch = CropToValidRegion(ITKHelpers::GetRegionInRadiusAroundPixel(holeIterator.GetIndex(), this->PatchRadius[0]));
+        unsigned int x0 = patch.GetIndex()[0] - window.GetIndex()[0];
+        unsigned int y0 = patch.GetIndex()[1] - window.GetIndex()[1];
+        unsigned int x1 = x0 + patch.GetSize()[0];
+        unsigned int y1 = y0 + patch.GetSize()[1];
+        double sum = confidenceSums[y1 * rowLength + x1] - confidenceSums[y0 * rowLength + x1]
+                   - confidenceSums[y1 * rowLength + x0] + confidenceSums[y0 * rowLength + x0];
+        this->ConfidenceImage->SetPixel(holeIterator.GetIndex(), sum / areaOfPatch);
+        }
+
+      ++holeIterator;
       }
   } // end try
   catch( itk::ExceptionObject & err )
   {
     std::cerr << "ExceptionObject caught in UpdateConfidences!" << std::endl;
     std::cerr << err << std::endl;
-    exit(-1);
+    throw;
   }
 }
 
@@ -997,29 +1647,19 @@ void CriminisiInpainting::ComputeAllDataTerms()
 {
   try
   {
-    itk::ImageRegionConstIteratorWithIndex<UnsignedCharScalarImageType> boundaryIterator(this->BoundaryImage, this->BoundaryImage->GetLargestPossibleRegion());
-
-    // Blank the data term image
-    this->DataImage->FillBuffer(0);
-
-    while(!boundaryIterator.IsAtEnd())
+    for(IndexedSet::ConstIterator iterator = this->BoundaryPixels.Begin(); iterator != this->BoundaryPixels.End(); ++iterator)
       {
-      if(boundaryIterator.Get() != 0) // This is a pixel on the current boundary
-	{
-	itk::Index<2> currentPixel = boundaryIterator.GetIndex();
-	float dataTerm = ComputeDataTerm(currentPixel);
-	this->DataImage->SetPixel(currentPixel, dataTerm);
-	//DebugMessage<float>("Set DataTerm to ", dataTerm);
-	}
-
-      ++boundaryIterator;
+      itk::Index<2> pixel = this->DataImage->ComputeIndex(*iterator);
+      float dataTerm = ComputeDataTerm(pixel);
+      this->DataImage->SetPixel(pixel, dataTerm);
+      //DebugMessage<float>("Set DataTerm to ", dataTerm);
       }
   }
   catch( itk::ExceptionObject & err )
   {
     std::cerr << "ExceptionObject caught in ComputeAllDataTerms!" << std::endl;
     std::cerr << err << std::endl;
-    exit(-1);
+    throw;
   }
 }
 
@@ -1027,7 +1667,7 @@ bool CriminisiInpainting::IsValidPatch(const itk::Index<2>& queryPixel, const un
 {
   // This function checks if a patch is completely inside the image and not intersecting the mask
 
-  itk::ImageRegion<2> region = Helpers::GetRegionInRadiusAroundPixel(queryPixel, radius);
+  itk::ImageRegion<2> region = ITKHelpers::GetRegionInRadiusAroundPixel(queryPixel, radius);
   return this->CurrentMask->IsValid(region);
 }
 
@@ -1035,14 +1675,14 @@ FloatVector2Type CriminisiInpainting::GetAverageIsophote(const itk::Index<2>& qu
 {
   try
   {
-    if(!this->CurrentMask->GetLargestPossibleRegion().IsInside(Helpers::GetRegionInRadiusAroundPixel(queryPixel, this->PatchRadius[0])))
+    if(!this->CurrentMask->GetLargestPossibleRegion().IsInside(ITKHelpers::GetRegionInRadiusAroundPixel(queryPixel, this->PatchRadius[0])))
       {
       FloatVector2Type v;
       v[0] = 0; v[1] = 0;
       return v;
       }
 
-    itk::ImageRegionConstIterator<Mask> iterator(this->CurrentMask,Helpers::GetRegionInRadiusAroundPixel(queryPixel, this->PatchRadius[0]));
+    itk::ImageRegionConstIterator<Mask> iterator(this->CurrentMask,ITKHelpers::GetRegionInRadiusAroundPixel(queryPixel, this->PatchRadius[0]));
 
     std::vector<FloatVector2Type> vectors;
 
@@ -1080,7 +1720,7 @@ FloatVector2Type CriminisiInpainting::GetAverageIsophote(const itk::Index<2>& qu
   {
     std::cerr << "ExceptionObject caught in GetAverageIsophote!" << std::endl;
     std::cerr << err << std::endl;
-    exit(-1);
+    throw;
   }
 }
 
@@ -1106,3 +1746,31 @@ itk::ImageRegion<2> CriminisiInpainting::CropToValidRegion(const itk::ImageRegio
   
   return region;
 }
+
+void CriminisiInpainting::DebugMessage(const char* message)
+{
+  if(this->DebugMessages)
+    {
+    std::cout << message << std::endl;
+    }
+}
+
+void CriminisiInpainting::DebugWriteAllImages(const itk::ImageRegion<2>& region)
+{
+  if(!this->DebugImages || !this->DebugWriter.IsIterationSelected(this->Iteration))
+    {
+    return;
+    }
+
+  std::stringstream ss;
+  ss << std::setfill('0') << std::setw(4) << this->Iteration;
+  std::string iteration = ss.str();
+  this->DebugWriter.WriteRegion(this->CurrentImage.GetPointer(), region, "Debug/CurrentImage_" + iteration + ".mha", DebugImageWriter::ImageLayer);
+  this->DebugWriter.WriteRegion(this->CurrentMask.GetPointer(), region, "Debug/CurrentMask_" + iteration + ".mha", DebugImageWriter::MaskLayer);
+  this->DebugWriter.WriteRegion(this->ConfidenceImage.GetPointer(), region, "Debug/Confidence_" + iteration + ".mha", DebugImageWriter::ConfidenceLayer);
+  this->DebugWriter.WriteRegion(this->PriorityImage.GetPointer(), region, "Debug/Priority_" + iteration + ".mha", DebugImageWriter::PriorityLayer);
+  this->DebugWriter.WriteRegion(this->DataImage.GetPointer(), region, "Debug/Data_" + iteration + ".mha", DebugImageWriter::DataLayer);
+  this->DebugWriter.WriteRegion(this->BoundaryImage.GetPointer(), region, "Debug/Boundary_" + iteration + ".mha", DebugImageWriter::BoundaryLayer);
+  this->DebugWriter.WriteRegion(this->BoundaryNormals.GetPointer(), region, "Debug/BoundaryNormals_" + iteration + ".mha", DebugImageWriter::BoundaryNormalsLayer);
+  this->DebugWriter.WriteRegion(this->IsophoteImage.GetPointer(), region, "Debug/Isophotes_" + iteration + ".mha", DebugImageWriter::IsophoteLayer);
+}
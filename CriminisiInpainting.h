@@ -20,7 +20,13 @@
 #define CriminisiInpainting_h
 
 // Custom
-#include "Helpers.h"
+#include "CriminisiCheckpoint.h"
+#include "DebugImageWriter.h"
+#include "IndexedPriorityQueue.h"
+#include "IndexedSet.h"
+#include "PhaseTimer.h"
+#include "ScratchArena.h"
+#include "SelfPatchCompare.h"
 #include "Types.h"
 
 // ITK
@@ -35,13 +41,16 @@
 #include "itkCovariantVector.h"
 #include "itkDiscreteGaussianImageFilter.h"
 #include "itkFlatStructuringElement.h"
+#include "itkGaussianOperator.h"
 #include "itkGradientImageFilter.h"
 #include "itkImage.h"
 #include "itkImageDuplicator.h"
 #include "itkImageFileReader.h"
 #include "itkImageFileWriter.h"
 #include "itkImageRegionIterator.h"
+#include "itkImageRegionIteratorWithIndex.h"
 #include "itkImageRegionConstIterator.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
 #include "itkInvertIntensityImageFilter.h"
 #include "itkMaskImageFilter.h"
 #include "itkMinimumMaximumImageCalculator.h"
@@ -56,17 +65,27 @@
 #include <vtkSmartPointer.h>
 
 // STL
+#include <algorithm>
 #include <iomanip> // setfill, setw
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
 
 // Qt
+#include <QMetaType>
 #include <QObject>
 
+// So RefreshSignal can be connected to slots in other threads (queued connections). The constructor registers it.
+typedef itk::ImageRegion<2> ImageRegionType;
+Q_DECLARE_METATYPE(ImageRegionType)
 
 class CriminisiInpainting : public QObject
 {
   Q_OBJECT
 signals:
-  void RefreshSignal();
+  // The pixels of the result (and the mask) in 'region' changed. ImageDisplayUpdater redraws only these.
+  void RefreshSignal(const itk::ImageRegion<2>& region);
 
 public:
 
@@ -77,8 +96,68 @@ public:
   // Constructor
   CriminisiInpainting();
 
-  // The real work is done here.
+  // The real work is done here. This is Initialize() followed by Iterate() until the hole is filled (or StopInpainting() is called).
+  // If Resume() was called, it continues from the restored state instead of calling Initialize().
+  // Like Initialize(), Iterate() and Resume(), it throws an itk::ExceptionObject if the image cannot be inpainted
+  // (e.g. if the mask leaves no source patches).
   void Inpaint();
+
+  // Prepare to inpaint the image and mask that have been set.
+  void Initialize();
+
+  // Fill one patch. Returns false if nothing could be filled.
+  bool Iterate();
+
+  // Determine whether or not the inpainting is completed, i.e. whether there are any pixels in the mask that still need to be filled.
+  bool HasMoreToInpaint();
+
+  // Save the state to 'fileName' when Initialize() (or Resume()) is called, and then every 'interval' iterations
+  // (0 to only save it when WriteCheckpoint() is called). Only the parts of the images that changed are added each time.
+  void SetCheckpoint(const std::string& fileName, const unsigned int interval);
+
+  // Add the changes since the last checkpoint to the checkpoint file.
+  bool WriteCheckpoint();
+
+  // Fill up to this many patches per iteration, at the highest priority targets that do not affect each other.
+  // Their best patches are searched for at the same time. The default, 1, is the original algorithm.
+  void SetNumberOfFronts(const unsigned int numberOfFronts);
+
+  // How far the order patches were filled in (with several fronts) is from the order of the original algorithm.
+  // The rank of a patch is the number of boundary pixels with a higher priority when it was filled; with one
+  // front it is always 0. The source patches are also chosen without the patches that the other fills of the
+  // same iteration make available, which this does not measure.
+  struct FillOrderReport
+  {
+    FillOrderReport() : NumberOfPatches(0), NumberOfPatchesOutOfOrder(0), TotalRank(0), MaximumRank(0) {}
+
+    unsigned int NumberOfPatches;
+    unsigned int NumberOfPatchesOutOfOrder;
+    unsigned long TotalRank;
+    unsigned int MaximumRank;
+  };
+  FillOrderReport GetFillOrderReport() const;
+
+  // Search for the source patch of a target only near where the hints say its hole pixels come from: the hint at a
+  // pixel is the offset from it to the pixel it should be copied from (e.g. the upsampled offsets of an inpainting of
+  // a downsampled image, see MultiscaleCriminisiInpainting). Only source patches whose corners are within
+  // 'searchRadius' of the corner of the target plus a hint are compared. A target without hints, or without any
+  // source patches near them, is searched for everywhere. Pixels without a hint hold a zero offset.
+  void SetSearchHints(OffsetImageType::Pointer hints, const unsigned int searchRadius);
+
+  // Search for the source patch of a target near the target first: in a square around it that grows by 'ringWidth'
+  // pixels at a time, up to 'windowRadius', until a patch with an average squared difference (per compared pixel)
+  // of at most 'threshold' is found. Only if there is none in the whole window are all source patches searched.
+  // A window radius of 0 (the default) always searches all of them.
+  void SetLocalSearch(const unsigned int windowRadius, const unsigned int ringWidth, const float threshold);
+
+  // The offset from each filled pixel to the pixel it was copied from (zero for the other pixels), in the band around
+  // the hole. Patches filled before a Resume() are not known.
+  OffsetImageType::Pointer GetSourceOffsetImage();
+
+  // Continue a run from a checkpoint file. Call this instead of Initialize() (then Iterate(), or Inpaint() to finish the run),
+  // after SetImage(), SetMask() and SetPatchRadius() have been called exactly as for the run that wrote the file.
+  // Returns false if the file cannot be used.
+  bool Resume(const std::string& fileName);
   
   // Specify the image to inpaint.
   void SetImage(FloatVectorImageType::Pointer image);
@@ -91,8 +170,21 @@ public:
 
   // Specify if you want to see debugging outputs.
   void SetDebugImages(const bool);
+
+  // The debugging images are written by this in the background. Use it to choose which layers are written, and how often.
+  DebugImageWriter* GetDebugImageWriter();
   
   void SetDebugMessages(const bool);
+
+  // Measure the time spent in each phase of every iteration. This is off by default. When it is on, Inpaint() prints a
+  // summary of the times at the end, unless SetProfilingOutput() was given a file to write them to.
+  void SetProfiling(const bool enabled);
+
+  // Turn profiling on, and write the times to 'fileName' (see PhaseTimer::WriteCSV()) at the end of Inpaint().
+  void SetProfilingOutput(const std::string& fileName);
+
+  // The times measured since the last Initialize() (or Resume()), e.g. to write them to a CSV file.
+  const PhaseTimer& GetPhaseTimer() const;
   
   // Compute the confidence values for pixels that were just inpainted.
   void UpdateConfidences(const itk::ImageRegion<2>&);
@@ -130,7 +222,10 @@ public:
 private:
 
   // This is the suggested value in Criminisi's paper, but it does not change anything at all, as we find argmax of the priorities, and alpha is a simple scaling factor of the priorities.
-  static const float Alpha = 255;
+  static constexpr float Alpha = 255.0f;
+
+  // The radius by which ExpandMask() grows the hole.
+  static const unsigned int MaskExpansionRadius = 2;
   
   // Image to inpaint. This should not be modified throughout the algorithm.
   FloatVectorImageType::Pointer OriginalImage;
@@ -146,6 +241,9 @@ private:
   
   // This mask is updated as patches are copied.
   Mask::Pointer CurrentMask;
+
+  // The number of hole pixels in CurrentMask, kept up to date by UpdateMask().
+  unsigned int NumberOfHolePixels;
   
   // Keep track of the confidence of each pixel
   FloatScalarImageType::Pointer ConfidenceImage;
@@ -156,22 +254,110 @@ private:
   // The patch radius.
   itk::Size<2> PatchRadius;
 
-  // Store the computed isophotes.
+  // Store the computed isophotes. Only the band around the hole that the boundary and the patches centered on it
+  // can reach (see GetIsophoteRegion()) is kept, so the largest possible region of this image is that band.
   FloatVector2ImageType::Pointer IsophoteImage;
   
-  // Keep track of the edge of the region to inpaint.
+  // Keep track of the edge of the region to inpaint. A pixel is on the boundary if it is not a hole but one of its 8 neighbors is.
+  // BoundaryImage is non-zero exactly at the pixels (keyed by their offset in the image) in BoundaryPixels.
   UnsignedCharScalarImageType::Pointer BoundaryImage;
+  IndexedSet BoundaryPixels;
   
   // Store the computed boundary normals.
   FloatVector2ImageType::Pointer BoundaryNormals;
 
+  // The normals are the gradient of the mask blurred with this (separable, normalized) Gaussian kernel.
+  std::vector<float> BlurKernel;
+
   // Keep track of the priority of each pixel.
   FloatScalarImageType::Pointer PriorityImage;
 
+  // The boundary pixels, keyed by their offset in the image, ordered by priority.
+  IndexedPriorityQueue<float> PriorityQueue;
+
+  // How far from a filled patch the boundary normals (and so the data terms and priorities) can change.
+  unsigned int PriorityUpdateRadius;
+
+  // Finds the best source patch for each target. It is kept for the whole run so that its buffers are reused.
+  SelfPatchCompare PatchCompare;
+
+  // Temporary buffers for one iteration. This is reset at the start of every iteration.
+  ScratchArena Scratch;
+
+  // Checkpoints are written to this file (if it is not empty) every CheckpointInterval iterations.
+  CriminisiCheckpoint Checkpoint;
+  std::string CheckpointFileName;
+  unsigned int CheckpointInterval;
+
+  // The part of the state that is saved in a checkpoint.
+  CriminisiCheckpoint::State GetCheckpointState();
+
+  // The most patches filled in one iteration.
+  unsigned int NumberOfFronts;
+
+  // The targets chosen in this iteration, the best source region for each, and working space for their searches.
+  std::vector<itk::Index<2> > FrontTargets;
+  std::vector<itk::ImageRegion<2> > FrontSourceRegions;
+  std::vector<std::vector<FloatVectorImageType::OffsetValueType> > FrontOffsets;
+
+  // The keys (and priorities) taken out of the PriorityQueue while choosing the targets.
+  std::vector<std::pair<unsigned int, float> > TakenPriorities;
+
+  FillOrderReport FillOrder;
+
+  // See SetSearchHints().
+  OffsetImageType::Pointer SearchHints;
+  unsigned int SearchRadius;
+
+  // See SetLocalSearch().
+  unsigned int LocalSearchRadius;
+  unsigned int LocalSearchRingWidth;
+  float LocalSearchThreshold;
+
+  // The phases that are timed. UpdateBoundary() counts as FindBoundary and UpdatePriorities() (which computes the
+  // data terms and the priorities of the same pixels) as ComputePriorities.
+  enum Phase { FindBoundaryPhase, ComputeBoundaryNormalsPhase, ComputeDataTermsPhase, ComputePrioritiesPhase,
+               FindHighestPriorityPhase, FindSourceRegionPhase, CopyPatchPhase, UpdateConfidencesPhase, UpdateMaskPhase,
+               AddSourcePatchesPhase, CheckpointPhase, NumberOfPhases };
+  PhaseTimer Timer;
+
+  // Where Inpaint() writes the times. If this is empty, it prints a summary of them instead.
+  std::string ProfilingOutputFileName;
+
+  // The most distinct hints in one target patch that are searched around.
+  static const unsigned int MaximumNumberOfHints = 8;
+
+  // See GetSourceOffsetImage().
+  OffsetImageType::Pointer SourceOffsetImage;
+
+  // Allocate SourceOffsetImage over the band around the hole, with no offsets.
+  void InitializeSourceOffsets();
+
+  // Working space for the search of a single front.
+  std::vector<FloatVectorImageType::OffsetValueType> SearchOffsets;
+
+  // Find the best source region for a target: near its hints if there are any, otherwise in the local search window
+  // (if one is set and it has a good enough patch), otherwise among all source patches.
+  // This does not modify the object, so several targets can be searched at once.
+  itk::ImageRegion<2> FindSourceRegion(const itk::ImageRegion<2>& targetRegion,
+                                       std::vector<FloatVectorImageType::OffsetValueType>& validOffsets) const;
+
+  // The bounding box of the patches filled in this iteration, which is sent with RefreshSignal.
+  itk::ImageRegion<2> FilledRegion;
+
+  // Fill the hole pixels of the patch around 'pixelToFill' from 'sourceRegion', and update everything that depends on them.
+  void FillTarget(const itk::Index<2>& pixelToFill, const itk::ImageRegion<2>& sourceRegion);
+
+  // Choose up to NumberOfFronts independent targets, find their best patches at the same time, and fill them.
+  void FillMultipleFronts();
+
+  // Find the boundary and compute its normals, data terms and priorities from the current images. Initialize() and Resume() use this.
+  void ComputeBoundaryAndPriorities();
+
+  // Compute the data terms at all boundary pixels.
   void ComputeAllDataTerms();
   
   // Functions
-  void Initialize();
   void InitializeMask();
   void InitializeConfidence();
   void InitializeData();
@@ -179,7 +365,8 @@ private:
   void InitializeImage();
 
   // Debugging
-  void DebugWriteAllImages();
+  // Write the part of every layer inside 'region' (the part that changed in this iteration).
+  void DebugWriteAllImages(const itk::ImageRegion<2>& region);
   void DebugWriteAllImages(const itk::Index<2>& pixelToFill, const itk::Index<2>& bestMatchPixel, const unsigned int iteration);
   void DebugWritePatch(const itk::Index<2>& pixel, const std::string& filePrefix, const unsigned int iteration);
   void DebugWritePatch(const itk::ImageRegion<2>& region, const std::string& filename);
@@ -197,24 +384,48 @@ private:
 
   itk::Size<2> GetPatchSize();
 
-  // Find the boundary of a region.
+  // Find the boundary of the whole hole. This is only needed once; afterwards UpdateBoundary() keeps it current.
   void FindBoundary();
+
+  // Update the boundary after the pixels in 'filledRegion' have been filled. Only pixels within one pixel of the region can change.
+  void UpdateBoundary(const itk::ImageRegion<2>& filledRegion);
+
+  // Determine if a pixel is on the boundary of the hole, and add it to or remove it from the boundary accordingly.
+  void UpdateBoundaryPixel(const itk::Index<2>& pixel);
   
-  // Compute the isophotes.
+  // Compute the isophotes in the band around the hole.
   void ComputeIsophotes();
-  
-  // Determine whether or not the inpainting is completed by seeing if there are any pixels in the mask that still need to be filled.
-  bool HasMoreToInpaint();
 
-  // Compute the normals of a region boundary.
-  void ComputeBoundaryNormals();
+  // Compute the isophotes (the gradient of the L channel of CIELabImage, rotated by 90 degrees) of the pixels
+  // in 'region', writing them row by row into 'isophotes'. Hole pixels get a zero isophote.
+  void ComputeIsophotes(const itk::ImageRegion<2>& region, FloatVector2Type* isophotes);
+
+  // The region IsophoteImage covers: the bounding box of the expanded original hole, padded by a patch radius plus the one
+  // pixel the boundary can be outside the hole. It only depends on OriginalMask, so Resume() finds the same region.
+  itk::ImageRegion<2> GetIsophoteRegion();
+
+  // Copy the isophotes of the source patch into the hole pixels of the target patch. The source patch is usually
+  // outside the band IsophoteImage covers, so its isophotes are computed here.
+  void CopyIsophotesIntoHole(const itk::ImageRegion<2>& sourceRegion, const itk::ImageRegion<2>& targetRegion);
+  
+  // Compute the normals of the hole boundary inside 'region', writing them into BoundaryNormals.
+  void ComputeBoundaryNormals(const itk::ImageRegion<2>& region);
 
   // Enlarge the mask so that isophotes are not computed over the mask/image boundary
   void ExpandMask();
 
   // Criminisi specific functions
-  // Compute the priorities at all boundary pixels.
+  // Compute the priorities at all boundary pixels and put them in the PriorityQueue.
   void ComputeAllPriorities();
+
+  // Recompute the data terms and priorities of the boundary pixels in a region, and remove pixels that are no longer on the boundary from the PriorityQueue.
+  void UpdatePriorities(const itk::ImageRegion<2>& region);
+
+  // Create the kernel used to blur the mask in ComputeBoundaryNormals(), and from it the PriorityUpdateRadius.
+  void InitializeBlurKernel();
+
+  // The most memory one iteration takes from Scratch.
+  size_t GetScratchSize();
   
   // Compute the priority of a specific pixel.
   float ComputePriority(const itk::Index<2>& queryPixel);
@@ -226,22 +437,33 @@ private:
   float ComputeDataTerm(const itk::Index<2>& queryPixel);
 
   // Find the highest priority patch to be filled.
-  itk::Index<2> FindHighestPriority(FloatScalarImageType::Pointer priorityImage);
+  itk::Index<2> FindHighestPriority();
 
-  // Update the mask so that the pixel that was filled is marked as filled.
+  // Copy the pixels of sourceRegion into the hole pixels of targetRegion (which may extend past the image).
+  template <typename TImage>
+  void CopyPatchIntoHole(TImage* image, const itk::ImageRegion<2>& sourceRegion, const itk::ImageRegion<2>& targetRegion);
+
+  // Update the mask so that the patch around the pixel that was filled is marked as filled.
   void UpdateMask(const itk::Index<2> pixel);
 
-  // Locate all patches that are completely inside of the image and completely inside of the source region
+  // Count the hole pixels in CurrentMask.
+  void CountHolePixels();
+
+  // Locate all patches that are completely inside of the image and completely inside of the source region, and give them to PatchCompare.
   void ComputeSourcePatches();
-  
-  // Store the list of source patches computed with ComputeSourcePatches()
-  std::vector<itk::ImageRegion<2> > SourcePatches;
+
+  // Give PatchCompare the patches that became completely valid when 'filledRegion' was filled. Call this after UpdateMask().
+  void AddSourcePatches(const itk::ImageRegion<2>& filledRegion);
   
  // This member tracks the current iteration. This is only necessary to help construct useful filenames for debugging outputs from anywhere in the class.
   unsigned int Iteration;
   
   // This flag can be set whiel the algorithm is running to tell it to stop at the end of the current iteration.
   bool Stop;
+
+  // True once Initialize() or Resume() has prepared the image and mask that are set, until Inpaint() finishes or
+  // they (or the patch radius) are changed, so Inpaint() does not start over a run that was resumed.
+  bool Initialized;
   
   // This variable determines which Difference subclass is instantiated.
   int DifferenceType;
@@ -249,16 +471,19 @@ private:
   //// Debugging ////
   // Should we output images at every iteration?
   bool DebugImages;
+
+  // Writes the debugging images on another thread.
+  DebugImageWriter DebugWriter;
   
   // Should we output verbose information about what is happenening at every iteration?
   bool DebugMessages;
   
-  // Output a message if DebugMessages is set to true.
-  void DebugMessage(const std::string&);
+  // Output a message if DebugMessages is set to true. The messages are plain C strings so that a disabled message costs nothing.
+  void DebugMessage(const char*);
   
   // Output a message and a value if DebugMessages is set to true.
   template <typename T>
-  void DebugMessage(const std::string& message, T value);
+  void DebugMessage(const char* message, T value);
 
 };
 
@@ -1,6 +1,6 @@
 
 template <typename T>
-void CriminisiInpainting::DebugMessage(const std::string& message, T value)
+void CriminisiInpainting::DebugMessage(const char* message, T value)
 {
   if(this->DebugMessages)
     {
@@ -9,3 +9,23 @@ void CriminisiInpainting::DebugMessage(const std::string& message, T value)
     std::cout << message << " " << ss.str() << std::endl;
     }
 }
+
+template <typename TImage>
+void CriminisiInpainting::CopyPatchIntoHole(TImage* image, const itk::ImageRegion<2>& sourceRegion, const itk::ImageRegion<2>& targetRegion)
+{
+  // Work on the buffer directly: for a VectorImage, every Get() through an iterator allocates a new pixel.
+  typename TImage::InternalPixelType* buffer = image->GetBufferPointer();
+  const long valuesPerPixel = image->GetPixelContainer()->Size() / image->GetLargestPossibleRegion().GetNumberOfPixels();
+  const long shift = image->ComputeOffset(sourceRegion.GetIndex()) - image->ComputeOffset(targetRegion.GetIndex());
+
+  itk::ImageRegionConstIteratorWithIndex<Mask> maskIterator(this->CurrentMask, CropToValidRegion(targetRegion));
+  while(!maskIterator.IsAtEnd())
+    {
+    if(this->CurrentMask->IsHole(maskIterator.GetIndex()))
+      {
+      const long target = image->ComputeOffset(maskIterator.GetIndex()) * valuesPerPixel;
+      std::copy(buffer + target + shift * valuesPerPixel, buffer + target + (shift + 1) * valuesPerPixel, buffer + target);
+      }
+    ++maskIterator;
+    }
+}
@@ -0,0 +1,113 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "DebugImageWriter.h"
+
+// STL
+#include <iostream>
+
+DebugImageWriter::DebugImageWriter() : Jobs(8)
+{
+  this->Layers = AllLayers;
+  this->IterationInterval = 1;
+  this->UseCompression = false;
+  this->NumberOfPendingJobs = 0;
+}
+
+DebugImageWriter::~DebugImageWriter()
+{
+  this->Jobs.Close();
+  if(this->Thread.joinable())
+    {
+    this->Thread.join();
+    }
+}
+
+void DebugImageWriter::SetLayers(const unsigned int layers)
+{
+  this->Layers = layers;
+}
+
+bool DebugImageWriter::IsLayerSelected(const Layer layer) const
+{
+  return (this->Layers & layer) != 0;
+}
+
+void DebugImageWriter::SetIterationInterval(const unsigned int interval)
+{
+  this->IterationInterval = interval > 0 ? interval : 1;
+}
+
+bool DebugImageWriter::IsIterationSelected(const unsigned int iteration) const
+{
+  return iteration % this->IterationInterval == 0;
+}
+
+void DebugImageWriter::SetUseCompression(const bool useCompression)
+{
+  this->UseCompression = useCompression;
+}
+
+void DebugImageWriter::SetQueueSize(const unsigned int queueSize)
+{
+  this->Jobs.SetCapacity(queueSize);
+}
+
+void DebugImageWriter::Flush()
+{
+  std::unique_lock<std::mutex> lock(this->PendingMutex);
+  this->PendingDone.wait(lock, [this]() { return this->NumberOfPendingJobs == 0; });
+}
+
+void DebugImageWriter::Enqueue(Job job)
+{
+  if(!this->Thread.joinable())
+    {
+    this->Thread = std::thread(&DebugImageWriter::Run, this);
+    }
+
+  {
+  std::lock_guard<std::mutex> lock(this->PendingMutex);
+  this->NumberOfPendingJobs++;
+  }
+
+  this->Jobs.Push(std::move(job));
+}
+
+void DebugImageWriter::Run()
+{
+  Job job;
+  while(this->Jobs.Pop(job))
+    {
+    // A debugging image that cannot be written should not stop the algorithm.
+    try
+    {
+      job();
+    }
+    catch( itk::ExceptionObject & err )
+    {
+      std::cerr << "ExceptionObject caught in DebugImageWriter!" << std::endl;
+      std::cerr << err << std::endl;
+    }
+    job = Job(); // Release the copy of the image now rather than when the next job arrives
+
+    std::lock_guard<std::mutex> lock(this->PendingMutex);
+    this->NumberOfPendingJobs--;
+    this->PendingDone.notify_all();
+    }
+}
@@ -0,0 +1,112 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef DebugImageWriter_H
+#define DebugImageWriter_H
+
+/*
+ * This class writes debugging images on a background thread. Write() and WriteRegion() copy the
+ * requested region of the image right away (so the caller can keep changing the image) and queue the
+ * copy to be written. The queue is bounded, so if the disk cannot keep up the caller waits rather
+ * than holding an unlimited number of copies.
+ *
+ * Writing every layer at every iteration is rarely needed, so the layers to write and how often
+ * (every Nth iteration) can be chosen. A region written with WriteRegion() keeps its position:
+ * the origin of the file is the physical position of the corner of the region.
+ */
+
+// Custom
+#include "BoundedQueue.h"
+
+// ITK
+#include "itkImageFileWriter.h"
+#include "itkImageRegion.h"
+
+// STL
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class DebugImageWriter
+{
+public:
+  // The images an algorithm can write. These can be combined to select several layers.
+  enum Layer { ImageLayer = 1, MaskLayer = 2, ConfidenceLayer = 4, PriorityLayer = 8, DataLayer = 16,
+               BoundaryLayer = 32, BoundaryNormalsLayer = 64, IsophoteLayer = 128, AllLayers = 255 };
+
+  DebugImageWriter();
+
+  // Write everything that is queued, then stop the thread.
+  ~DebugImageWriter();
+
+  // Only write the selected layers (a combination of Layer values). The default is AllLayers.
+  void SetLayers(const unsigned int layers);
+  bool IsLayerSelected(const Layer layer) const;
+
+  // Only write at every Nth iteration. The default is 1 (every iteration).
+  void SetIterationInterval(const unsigned int interval);
+  bool IsIterationSelected(const unsigned int iteration) const;
+
+  // Compress the files (if the format supports it). This is off by default, because it makes writing much slower.
+  void SetUseCompression(const bool useCompression);
+
+  // The most images waiting to be written before Write() waits.
+  void SetQueueSize(const unsigned int queueSize);
+
+  // Queue a copy of the whole image to be written, if the layer is selected.
+  template <typename TImage>
+  void Write(const TImage* image, const std::string& fileName, const Layer layer);
+
+  // Queue a copy of the part of the image inside 'region' to be written, if the layer is selected.
+  template <typename TImage>
+  void WriteRegion(const TImage* image, const itk::ImageRegion<2>& region, const std::string& fileName, const Layer layer);
+
+  // Wait until everything queued so far has been written.
+  void Flush();
+
+private:
+  DebugImageWriter(const DebugImageWriter&); // Not implemented
+  void operator=(const DebugImageWriter&); // Not implemented
+
+  typedef std::function<void()> Job;
+
+  // Queue a job for the writing thread, starting the thread if it is not running.
+  void Enqueue(Job job);
+
+  // The writing thread.
+  void Run();
+
+  unsigned int Layers;
+  unsigned int IterationInterval;
+  bool UseCompression;
+
+  BoundedQueue<Job> Jobs;
+  std::thread Thread;
+
+  // The number of jobs queued but not finished, so Flush() knows when to return.
+  unsigned int NumberOfPendingJobs;
+  std::mutex PendingMutex;
+  std::condition_variable PendingDone;
+};
+
+#include "DebugImageWriter.hxx"
+
+#endif
@@ -0,0 +1,51 @@
+template <typename TImage>
+void DebugImageWriter::Write(const TImage* image, const std::string& fileName, const Layer layer)
+{
+  WriteRegion(image, image->GetLargestPossibleRegion(), fileName, layer);
+}
+
+template <typename TImage>
+void DebugImageWriter::WriteRegion(const TImage* image, const itk::ImageRegion<2>& inputRegion, const std::string& fileName, const Layer layer)
+{
+  if(!IsLayerSelected(layer))
+    {
+    return;
+    }
+
+  itk::ImageRegion<2> region = inputRegion;
+  if(!region.Crop(image->GetLargestPossibleRegion()))
+    {
+    return;
+    }
+
+  // Copy the region now, so the image can keep changing while the copy waits to be written.
+  typename TImage::Pointer snapshot = TImage::New();
+  snapshot->CopyInformation(image);
+  snapshot->SetNumberOfComponentsPerPixel(image->GetNumberOfComponentsPerPixel());
+  snapshot->SetRegions(region);
+  snapshot->Allocate();
+
+  // Copy whole rows of the buffer. For a VectorImage, copying pixel by pixel would allocate every pixel.
+  const size_t valuesPerPixel = image->GetPixelContainer()->Size() / image->GetLargestPossibleRegion().GetNumberOfPixels();
+  const size_t rowLength = region.GetSize()[0] * valuesPerPixel;
+  const typename TImage::InternalPixelType* source = image->GetBufferPointer();
+  typename TImage::InternalPixelType* destination = snapshot->GetBufferPointer();
+  itk::Index<2> rowStart = region.GetIndex();
+  for(unsigned int row = 0; row < region.GetSize()[1]; ++row)
+    {
+    rowStart[1] = region.GetIndex()[1] + row;
+    const typename TImage::InternalPixelType* sourceRow = source + image->ComputeOffset(rowStart) * valuesPerPixel;
+    std::copy(sourceRow, sourceRow + rowLength, destination + snapshot->ComputeOffset(rowStart) * valuesPerPixel);
+    }
+
+  const bool useCompression = this->UseCompression;
+  Enqueue([snapshot, fileName, useCompression]()
+    {
+    typedef itk::ImageFileWriter<TImage> WriterType;
+    typename WriterType::Pointer writer = WriterType::New();
+    writer->SetFileName(fileName);
+    writer->SetInput(snapshot);
+    writer->SetUseCompression(useCompression);
+    writer->Update();
+    });
+}
@@ -0,0 +1,143 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "ImageDisplayUpdater.h"
+
+// Custom
+#include "RegionHelpers.h"
+
+// VTK
+#include <vtkImageData.h>
+#include <vtkRenderWindow.h>
+
+// STL
+#include <algorithm>
+#include <iostream>
+
+namespace
+{
+// Copy the pixels of 'region' (clamped to 0-255 for unsigned char images) into a vtkImageData with scalars of type T.
+template <typename T>
+void CopyRegionToVTK(const FloatVectorImageType* image, const itk::ImageRegion<2>& region, vtkImageData* vtkImage)
+{
+  const unsigned int imageComponents = image->GetNumberOfComponentsPerPixel();
+  const unsigned int vtkComponents = vtkImage->GetNumberOfScalarComponents();
+  const unsigned int components = std::min(imageComponents, vtkComponents);
+  const bool clamp = vtkImage->GetScalarType() == VTK_UNSIGNED_CHAR;
+
+  const itk::Index<2> corner = image->GetLargestPossibleRegion().GetIndex();
+  for(unsigned int row = 0; row < region.GetSize()[1]; ++row)
+    {
+    itk::Index<2> rowStart = {{region.GetIndex()[0], region.GetIndex()[1] + row}};
+    const float* source = image->GetBufferPointer() + image->ComputeOffset(rowStart) * imageComponents;
+    T* target = static_cast<T*>(vtkImage->GetScalarPointer(rowStart[0] - corner[0], rowStart[1] - corner[1], 0));
+    for(unsigned int column = 0; column < region.GetSize()[0]; ++column, source += imageComponents, target += vtkComponents)
+      {
+      for(unsigned int component = 0; component < components; ++component)
+        {
+        const float value = clamp ? std::min(255.0f, std::max(0.0f, source[component])) : source[component];
+        target[component] = static_cast<T>(value);
+        }
+      }
+    }
+}
+} // end anonymous namespace
+
+const int ImageDisplayUpdater::RenderInterval;
+
+ImageDisplayUpdater::ImageDisplayUpdater()
+{
+  this->RenderTimer.setSingleShot(true);
+  this->RenderTimer.setInterval(RenderInterval);
+  connect(&this->RenderTimer, SIGNAL(timeout()), this, SLOT(TimerSlot()));
+}
+
+void ImageDisplayUpdater::SetImages(FloatVectorImageType* image, vtkImageData* vtkImage, vtkRenderWindow* renderWindow)
+{
+  this->Image = image;
+  this->VTKImage = vtkImage;
+  this->RenderWindow = renderWindow;
+  this->PendingRegion = itk::ImageRegion<2>();
+}
+
+void ImageDisplayUpdater::RegionModifiedSlot(const itk::ImageRegion<2>& inputRegion)
+{
+  if(!this->Image)
+    {
+    return;
+    }
+
+  itk::ImageRegion<2> region = inputRegion;
+  if(!region.Crop(this->Image->GetLargestPossibleRegion()))
+    {
+    return;
+    }
+
+  RegionHelpers::ExpandToInclude(this->PendingRegion, region);
+
+  // Render when the interval is over. Regions modified in the meantime are rendered together.
+  if(!this->RenderTimer.isActive())
+    {
+    this->RenderTimer.start();
+    }
+}
+
+void ImageDisplayUpdater::TimerSlot()
+{
+  Flush();
+}
+
+void ImageDisplayUpdater::Flush()
+{
+  this->RenderTimer.stop();
+  if(!this->Image || this->PendingRegion.GetNumberOfPixels() == 0)
+    {
+    return;
+    }
+
+  CopyRegion(this->PendingRegion);
+  this->PendingRegion = itk::ImageRegion<2>();
+
+  this->VTKImage->Modified();
+  if(this->RenderWindow)
+    {
+    this->RenderWindow->Render();
+    }
+}
+
+void ImageDisplayUpdater::CopyRegion(const itk::ImageRegion<2>& region)
+{
+  // A vtkImageData that shares the ITK buffer already has the new pixels.
+  if(this->VTKImage->GetScalarPointer() == static_cast<void*>(this->Image->GetBufferPointer()))
+    {
+    return;
+    }
+
+  switch(this->VTKImage->GetScalarType())
+    {
+    case VTK_UNSIGNED_CHAR:
+      CopyRegionToVTK<unsigned char>(this->Image, region, this->VTKImage);
+      break;
+    case VTK_FLOAT:
+      CopyRegionToVTK<float>(this->Image, region, this->VTKImage);
+      break;
+    default:
+      std::cerr << "ImageDisplayUpdater: unsupported VTK scalar type " << this->VTKImage->GetScalarTypeAsString() << std::endl;
+      break;
+    }
+}
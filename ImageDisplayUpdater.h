@@ -0,0 +1,87 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef ImageDisplayUpdater_H
+#define ImageDisplayUpdater_H
+
+/*
+ * This class keeps a vtkImageData that displays an ITK image up to date while the ITK image is being
+ * changed (e.g. by CriminisiInpainting: connect its RefreshSignal, which carries the region that changed, to
+ * RegionModifiedSlot(); CriminisiInpainting registers the region type, so the connection can be queued).
+ * RegionModifiedSlot() only records the region; the pixels of all of the regions recorded since the
+ * last render are copied into the vtkImageData (only that sub-extent) and the window is rendered at
+ * most once per RenderInterval milliseconds, so an algorithm that changes the image thousands of
+ * times per second does not spend its time converting and rendering.
+ *
+ * If the vtkImageData shares the ITK buffer (see SharedVTKImage.h), nothing needs to be copied.
+ */
+
+// Custom
+#include "Types.h"
+
+// ITK
+#include "itkImageRegion.h"
+
+// VTK
+#include <vtkSmartPointer.h>
+
+// Qt
+#include <QObject>
+#include <QTimer>
+
+class vtkImageData;
+class vtkRenderWindow;
+
+class ImageDisplayUpdater : public QObject
+{
+  Q_OBJECT
+
+public:
+  ImageDisplayUpdater();
+
+  // The shortest time between two renders, in milliseconds. The default (16) is about the refresh rate of a display.
+  static const int RenderInterval = 16;
+
+  // Display 'image' in 'vtkImage' (which must already be set up with the image's size), rendering 'renderWindow' after updates.
+  void SetImages(FloatVectorImageType* image, vtkImageData* vtkImage, vtkRenderWindow* renderWindow);
+
+  // Copy the pending regions and render now, rather than waiting for the timer.
+  void Flush();
+
+public slots:
+  // The pixels in 'region' of the ITK image changed.
+  void RegionModifiedSlot(const itk::ImageRegion<2>& region);
+
+private slots:
+  void TimerSlot();
+
+private:
+  // Copy the pixels of 'region' from the ITK image into the vtkImageData.
+  void CopyRegion(const itk::ImageRegion<2>& region);
+
+  FloatVectorImageType::Pointer Image;
+  vtkSmartPointer<vtkImageData> VTKImage;
+  vtkSmartPointer<vtkRenderWindow> RenderWindow;
+
+  // The bounding box of the regions modified since the last render. Its size is zero if nothing is pending.
+  itk::ImageRegion<2> PendingRegion;
+
+  QTimer RenderTimer;
+};
+
+#endif
@@ -0,0 +1,206 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef IndexedPriorityQueue_H
+#define IndexedPriorityQueue_H
+
+/*
+ * A max-heap of keys in [0, NumberOfKeys) (e.g. linear pixel offsets) that also stores where each key is in the heap,
+ * so the priority of any key can be changed, or the key removed, in O(log n). Equal priorities are ordered by the
+ * smaller key first, so with raster order offsets the top is the same pixel a raster scan for the maximum would find.
+ */
+
+// STL
+#include <vector>
+
+template <typename TPriority>
+class IndexedPriorityQueue
+{
+public:
+  typedef unsigned int KeyType;
+
+  // Remove all keys and allow keys in [0, numberOfKeys).
+  void Initialize(const unsigned int numberOfKeys)
+  {
+    this->Heap.clear();
+    this->Positions.assign(numberOfKeys, NotInHeap);
+  }
+
+  bool IsEmpty() const
+  {
+    return this->Heap.empty();
+  }
+
+  unsigned int GetSize() const
+  {
+    return this->Heap.size();
+  }
+
+  bool Contains(const KeyType key) const
+  {
+    return this->Positions[key] != NotInHeap;
+  }
+
+  // The key with the highest priority. The queue must not be empty.
+  KeyType GetTop() const
+  {
+    return this->Heap[0].Key;
+  }
+
+  TPriority GetTopPriority() const
+  {
+    return this->Heap[0].Priority;
+  }
+
+  // The number of keys closer to the top than 'key' (0 for the top), which must be in the queue.
+  // Only those keys (and their children) are visited, so this is fast for keys near the top.
+  unsigned int GetRank(const KeyType key) const
+  {
+    return CountHigher(0, this->Heap[this->Positions[key]]);
+  }
+
+  // Insert the key, or change its priority if it is already in the queue.
+  void Set(const KeyType key, const TPriority priority)
+  {
+    unsigned int position = this->Positions[key];
+    if(position == NotInHeap)
+      {
+      position = this->Heap.size();
+      Entry entry;
+      entry.Key = key;
+      entry.Priority = priority;
+      this->Heap.push_back(entry);
+      this->Positions[key] = position;
+      SiftUp(position);
+      return;
+      }
+
+    this->Heap[position].Priority = priority;
+    SiftUp(position);
+    SiftDown(this->Positions[key]);
+  }
+
+  // Remove the key if it is in the queue.
+  void Remove(const KeyType key)
+  {
+    const unsigned int position = this->Positions[key];
+    if(position == NotInHeap)
+      {
+      return;
+      }
+
+    const unsigned int last = this->Heap.size() - 1;
+    if(position != last)
+      {
+      Swap(position, last);
+      }
+    this->Heap.pop_back();
+    this->Positions[key] = NotInHeap;
+
+    // The entry moved into the hole may belong higher or lower.
+    if(position < this->Heap.size())
+      {
+      const KeyType movedKey = this->Heap[position].Key;
+      SiftUp(position);
+      SiftDown(this->Positions[movedKey]);
+      }
+  }
+
+private:
+  struct Entry
+  {
+    KeyType Key;
+    TPriority Priority;
+  };
+
+  static const unsigned int NotInHeap = static_cast<unsigned int>(-1);
+
+  // True if 'a' should be closer to the top than 'b'.
+  bool IsHigher(const Entry& a, const Entry& b) const
+  {
+    return a.Priority > b.Priority || (a.Priority == b.Priority && a.Key < b.Key);
+  }
+
+  // Count the entries higher than 'entry' in the subtree at 'position'. A subtree whose root is not higher can be skipped.
+  unsigned int CountHigher(const unsigned int position, const Entry& entry) const
+  {
+    if(position >= this->Heap.size() || !IsHigher(this->Heap[position], entry))
+      {
+      return 0;
+      }
+    return 1 + CountHigher(2 * position + 1, entry) + CountHigher(2 * position + 2, entry);
+  }
+
+  void Swap(const unsigned int a, const unsigned int b)
+  {
+    Entry temporary = this->Heap[a];
+    this->Heap[a] = this->Heap[b];
+    this->Heap[b] = temporary;
+    this->Positions[this->Heap[a].Key] = a;
+    this->Positions[this->Heap[b].Key] = b;
+  }
+
+  void SiftUp(unsigned int position)
+  {
+    while(position > 0)
+      {
+      unsigned int parent = (position - 1) / 2;
+      if(!IsHigher(this->Heap[position], this->Heap[parent]))
+        {
+        return;
+        }
+      Swap(position, parent);
+      position = parent;
+      }
+  }
+
+  void SiftDown(unsigned int position)
+  {
+    const unsigned int size = this->Heap.size();
+    while(true)
+      {
+      unsigned int highest = position;
+      unsigned int left = 2 * position + 1;
+      unsigned int right = left + 1;
+      if(left < size && IsHigher(this->Heap[left], this->Heap[highest]))
+        {
+        highest = left;
+        }
+      if(right < size && IsHigher(this->Heap[right], this->Heap[highest]))
+        {
+        highest = right;
+        }
+      if(highest == position)
+        {
+        return;
+        }
+      Swap(position, highest);
+      position = highest;
+      }
+  }
+
+  std::vector<Entry> Heap;
+
+  // Positions[key] is the index of the key in Heap, or NotInHeap.
+  std::vector<unsigned int> Positions;
+};
+
+template <typename TPriority>
+const unsigned int IndexedPriorityQueue<TPriority>::NotInHeap;
+
+#endif
@@ -0,0 +1,99 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef IndexedSet_H
+#define IndexedSet_H
+
+/*
+ * A set of keys in [0, NumberOfKeys) (e.g. linear pixel offsets) with O(1) Insert, Erase and Contains.
+ * The keys are stored densely (in no particular order) so they can be iterated quickly, and a position
+ * array maps each key to its slot. Unlike std::set, inserting does not allocate a node, so once the set has
+ * been as large as it will get, it never touches the heap.
+ */
+
+// STL
+#include <vector>
+
+class IndexedSet
+{
+public:
+  typedef unsigned int KeyType;
+  typedef std::vector<KeyType>::const_iterator ConstIterator;
+
+  // Remove all keys and allow keys in [0, numberOfKeys).
+  void Initialize(const unsigned int numberOfKeys)
+  {
+    this->Keys.clear();
+    this->Positions.assign(numberOfKeys, static_cast<unsigned int>(NotInSet)); // Copy, so NotInSet needs no definition
+  }
+
+  bool Contains(const KeyType key) const
+  {
+    return this->Positions[key] != NotInSet;
+  }
+
+  void Insert(const KeyType key)
+  {
+    if(this->Positions[key] == NotInSet)
+      {
+      this->Positions[key] = this->Keys.size();
+      this->Keys.push_back(key);
+      }
+  }
+
+  void Erase(const KeyType key)
+  {
+    const unsigned int position = this->Positions[key];
+    if(position == NotInSet)
+      {
+      return;
+      }
+
+    // Move the last key into the hole.
+    const KeyType lastKey = this->Keys.back();
+    this->Keys[position] = lastKey;
+    this->Positions[lastKey] = position;
+    this->Keys.pop_back();
+    this->Positions[key] = NotInSet;
+  }
+
+  unsigned int GetSize() const
+  {
+    return this->Keys.size();
+  }
+
+  ConstIterator Begin() const
+  {
+    return this->Keys.begin();
+  }
+
+  ConstIterator End() const
+  {
+    return this->Keys.end();
+  }
+
+private:
+  static const unsigned int NotInSet = static_cast<unsigned int>(-1);
+
+  std::vector<KeyType> Keys;
+
+  // Positions[key] is the index of the key in Keys, or NotInSet.
+  std::vector<unsigned int> Positions;
+};
+
+#endif
@@ -60,7 +60,10 @@
 #include <vtkXMLImageDataWriter.h> // For debugging only
 
 // Custom
+#include "CIELab.h"
 #include "ClickableLabel.h"
+#include "RadixSort.h"
+#include "SharedVTKImage.h"
 #include "SwitchBetweenStyle.h"
 //#include "MyGraphicsItem.h"
 #include "Types.h"
@@ -74,6 +77,7 @@
 
 const unsigned char InteractiveBestPatchesWidget::Green[3] = {0,255,0};
 const unsigned char InteractiveBestPatchesWidget::Red[3] = {255,0,0};
+const size_t InteractiveBestPatchesWidget::LargeImageNumberOfPixels = 16 * 1024 * 1024;
 
 void InteractiveBestPatchesWidget::on_actionHelp_activated()
 {
@@ -137,6 +141,9 @@ void InteractiveBestPatchesWidget::SharedConstructor()
   this->ImageSliceMapper->SetInputData(this->VTKImage);
   this->ImageSlice->SetMapper(this->ImageSliceMapper);
   this->ImageSlice->GetProperty()->SetInterpolationTypeToNearest();
+  // The image may be displayed directly from the float pixels (see SharedVTKImage.h), so map [0,255] to the full display range.
+  this->ImageSlice->GetProperty()->SetColorWindow(255);
+  this->ImageSlice->GetProperty()->SetColorLevel(127.5);
   
   // Initialize and link the mask image display objects
   this->VTKMaskImage = vtkSmartPointer<vtkImageData>::New();
@@ -148,6 +155,32 @@ void InteractiveBestPatchesWidget::SharedConstructor()
   this->MaskImageSlice->SetMapper(this->MaskImageSliceMapper);
   this->MaskImageSlice->GetProperty()->SetInterpolationTypeToNearest();
   
+  // Initialize the score map display objects. Invalid centers are NaN, which the lookup table makes transparent.
+  this->ScoreMapImage = vtkSmartPointer<vtkImageData>::New();
+  this->ScoreMapSlice = vtkSmartPointer<vtkImageSlice>::New();
+  this->ScoreMapSliceMapper = vtkSmartPointer<vtkImageSliceMapper>::New();
+  this->ScoreMapLookupTable = vtkSmartPointer<vtkLookupTable>::New();
+  this->ScoreMapLookupTable->SetHueRange(0.0, 0.667); // Red (good match) to blue (bad match)
+  this->ScoreMapLookupTable->SetAlphaRange(0.6, 0.6);
+  this->ScoreMapLookupTable->SetNanColor(0, 0, 0, 0);
+  this->ScoreMapLookupTable->Build();
+  this->ScoreMapSlice->PickableOff();
+  this->ScoreMapSlice->VisibilityOff();
+  this->ScoreMapSliceMapper->SetInputData(this->ScoreMapImage);
+  this->ScoreMapSlice->SetMapper(this->ScoreMapSliceMapper);
+  this->ScoreMapSlice->GetProperty()->SetInterpolationTypeToNearest();
+  this->ScoreMapSlice->GetProperty()->SetLookupTable(this->ScoreMapLookupTable);
+  this->ScoreMapSlice->GetProperty()->UseLookupTableScalarRangeOn();
+
+  this->PartialResultsTimer.setInterval(100);
+  connect(&this->PartialResultsTimer, SIGNAL(timeout()), this, SLOT(PartialResultsSlot()));
+  this->ScoringFinished = false;
+  this->btnStop->setEnabled(false);
+
+  this->ScoreMapRefineTimer.setSingleShot(true);
+  this->ScoreMapRefineTimer.setInterval(250);
+  connect(&this->ScoreMapRefineTimer, SIGNAL(timeout()), this, SLOT(RefineScoreMapSlot()));
+
   // Initialize patches
   this->SourcePatch = vtkSmartPointer<vtkImageData>::New();
   this->SourcePatchSlice = vtkSmartPointer<vtkImageSlice>::New();
@@ -171,6 +204,9 @@ void InteractiveBestPatchesWidget::SharedConstructor()
   this->qvtkWidget->GetRenderWindow()->AddRenderer(this->Renderer);
   
   this->Renderer->AddViewProp(this->ImageSlice);
+  this->Renderer->AddViewProp(this->ImagePyramid.GetProp());
+  this->ImagePyramid.SetRenderer(this->Renderer);
+  this->Renderer->AddViewProp(this->ScoreMapSlice);
   this->Renderer->AddViewProp(this->MaskImageSlice);
   this->Renderer->AddViewProp(this->SourcePatchSlice);
   this->Renderer->AddViewProp(this->TargetPatchSlice);
@@ -181,6 +217,8 @@ void InteractiveBestPatchesWidget::SharedConstructor()
 
   this->Image = NULL;
   this->MaskImage = NULL;
+  this->ImageHash = 0;
+  this->MaskHash = 0;
   
   this->InteractorStyle->TrackballStyle->AddObserver(CustomTrackballStyle::PatchesMovedEvent,
                                                      this, &InteractiveBestPatchesWidget::PatchesMoved);
@@ -188,23 +226,39 @@ void InteractiveBestPatchesWidget::SharedConstructor()
   this->tableWidget->resizeColumnsToContents();
 };
 
+InteractiveBestPatchesWidget::~InteractiveBestPatchesWidget()
+{
+  // Don't leave the scoring thread running on an object that is being destroyed.
+  if(IsScoring())
+    {
+    this->PatchCompare.RequestStop();
+    this->ScoringThread.join();
+    }
+}
+
 void InteractiveBestPatchesWidget::on_btnResort_clicked()
 {
+  // The source patches belong to the scoring thread until it finishes.
+  if(IsScoring())
+    {
+    return;
+    }
+
   if(this->radTotalAbsolute->isChecked())
     {
-    std::sort(this->PatchCompare.SourcePatches.begin(), this->PatchCompare.SourcePatches.end(), SortByTotalAbsoluteScore);
+    this->PatchCompare.SortSourcePatches(&Patch::TotalAbsoluteScore);
     }
   else if(this->radAverageAbsolute->isChecked())
     {
-    std::sort(this->PatchCompare.SourcePatches.begin(), this->PatchCompare.SourcePatches.end(), SortByAverageAbsoluteScore);
+    this->PatchCompare.SortSourcePatches(&Patch::AverageAbsoluteScore);
     }
   else if(this->radTotalSquared->isChecked())
     {
-    std::sort(this->PatchCompare.SourcePatches.begin(), this->PatchCompare.SourcePatches.end(), SortByTotalSquaredScore);
+    this->PatchCompare.SortSourcePatches(&Patch::TotalSquaredScore);
     }
   else if(this->radAverageSquared->isChecked())
     {
-    std::sort(this->PatchCompare.SourcePatches.begin(), this->PatchCompare.SourcePatches.end(), SortByAverageSquaredScore);
+    this->PatchCompare.SortSourcePatches(&Patch::AverageSquaredScore);
     }
     
   DisplaySourcePatches();
@@ -217,6 +271,8 @@ void InteractiveBestPatchesWidget::on_actionQuit_activated()
 
 void InteractiveBestPatchesWidget::LoadImage(const std::string& fileName)
 {
+  StopScoring();
+
   // Set the working directory
   QFileInfo fileInfo(fileName.c_str());
   std::string workingDirectory = fileInfo.absoluteDir().absolutePath().toStdString() + "/";
@@ -228,11 +284,33 @@ void InteractiveBestPatchesWidget::LoadImage(const std::string& fileName)
   reader->SetFileName(fileName);
   reader->Update();
 
-  //this->Image = reader->GetOutput();
-  this->Image = FloatVectorImageType::New();
-  ITKHelpers::DeepCopy(reader->GetOutput(), this->Image.GetPointer());
+  // Take ownership of the reader's buffer rather than copying it.
+  this->Image = reader->GetOutput();
+  this->Image->DisconnectPipeline();
+  this->LabImage = NULL;
+
+  itk::Size<2> imageSize = this->Image->GetLargestPossibleRegion().GetSize();
+  if(static_cast<size_t>(imageSize[0]) * imageSize[1] > LargeImageNumberOfPixels)
+    {
+    // Only the tiles that are on screen, at the resolution of the current zoom, are sent to the GPU.
+    this->ImagePyramid.SetImage(this->Image);
+    this->VTKImage->Initialize();
+    this->ImageSlice->VisibilityOff();
+    }
+  else
+    {
+    // Display the ITK buffer directly if possible, otherwise fall back to converting it.
+    this->ImagePyramid.Clear();
+    if(!ShareITKImageWithVTK(this->Image.GetPointer(), this->VTKImage))
+      {
+      ITKVTKHelpers::ITKVectorImageToVTKImageFromDimension(this->Image.GetPointer(), this->VTKImage);
+      }
+    this->ImageSlice->VisibilityOn();
+    }
 
-  ITKVTKHelpers::ITKVectorImageToVTKImageFromDimension(this->Image.GetPointer(), this->VTKImage);
+  this->ImageHash = ScoreCache::HashImage(this->Image);
+  this->Cache.SetDirectory(workingDirectory + "ScoreCache");
+  this->ScoreMapEngine.SetImage(GetComparisonImage());
 
   this->statusBar()->showMessage("Opened image.");
   actionOpenMask->setEnabled(true);
@@ -327,13 +405,17 @@ void InteractiveBestPatchesWidget::InitializePatch(vtkImageData* image, const un
 void InteractiveBestPatchesWidget::on_actionOpenMaskInverted_activated()
 {
   std::cout << "on_actionOpenMaskInverted_activated()" << std::endl;
+  StopScoring();
   on_actionOpenMask_activated();
   this->MaskImage->Invert();
   this->MaskImage->Cleanup();
-  }
+  this->MaskHash = ScoreCache::HashMask(this->MaskImage);
+  this->ScoreMapEngine.SetMask(this->MaskImage); // The mask was changed in place
+}
 
 void InteractiveBestPatchesWidget::LoadMask(const std::string& fileName)
 {
+  StopScoring();
 
   typedef itk::ImageFileReader<Mask> ReaderType;
   ReaderType::Pointer reader = ReaderType::New();
@@ -355,6 +437,8 @@ void InteractiveBestPatchesWidget::LoadMask(const std::string& fileName)
   this->MaskImage->SetHoleValue(255);
 
   this->MaskImage->Cleanup();
+  this->MaskHash = ScoreCache::HashMask(this->MaskImage);
+  this->ScoreMapEngine.SetMask(this->MaskImage);
 
   MaskOperations::SetMaskTransparency(this->MaskImage, this->VTKMaskImage);
 
@@ -456,6 +540,13 @@ void InteractiveBestPatchesWidget::PatchesMoved()
   
   this->TargetPatchScene->addPixmap(QPixmap::fromImage(targetImage));
 
+  // Show a coarse score map right away, and refine it if the target stays here.
+  if(this->chkShowScoreMap->isChecked())
+    {
+    UpdateScoreMap(4);
+    this->ScoreMapRefineTimer.start();
+    }
+
   Refresh();
 
 }
@@ -546,24 +637,35 @@ void InteractiveBestPatchesWidget::on_txtNumberOfPatches_returnPressed()
 
 void InteractiveBestPatchesWidget::DisplaySourcePatches()
 {
-  
+  if(IsScoring())
+    {
+    return;
+    }
+
   unsigned int numberOfPatches = this->txtNumberOfPatches->text().toUInt();
   
-  if(numberOfPatches > this->PatchCompare.SourcePatches.size())
+  const std::vector<Patch>& sourcePatches = this->PatchCompare.GetSourcePatches();
+  if(numberOfPatches > sourcePatches.size())
     {
-    std::cout << "You have requested more patches (" << numberOfPatches << ") than have been computed (" << this->PatchCompare.SourcePatches.size() << ")" << std::endl;
+    std::cout << "You have requested more patches (" << numberOfPatches << ") than have been computed (" << sourcePatches.size() << ")" << std::endl;
     return;
     }
-    
+
+  DisplayPatches(std::vector<Patch>(sourcePatches.begin(), sourcePatches.begin() + numberOfPatches));
+}
+
+void InteractiveBestPatchesWidget::DisplayPatches(const std::vector<Patch>& patches)
+{
+  this->DisplayedPatches = patches;
+
   // Clear the table
   this->tableWidget->setRowCount(0);
   
-  for(unsigned int i = 0; i < numberOfPatches; ++i)
+  for(unsigned int i = 0; i < this->DisplayedPatches.size(); ++i)
     {
     this->tableWidget->insertRow(this->tableWidget->rowCount());
   
-    Patch currentPatch = this->PatchCompare.SourcePatches[i];
-    std::cout << "Generating table row for " << currentPatch.Region << std::endl;
+    Patch currentPatch = this->DisplayedPatches[i];
   
     QImage sourceImage = GetQImage(currentPatch.Region);
   
@@ -610,10 +712,16 @@ void InteractiveBestPatchesWidget::DisplaySourcePatches()
 
 void InteractiveBestPatchesWidget::on_btnCompute_clicked()
 {
+  if(IsScoring())
+    {
+    return;
+    }
+
   PositionTarget();
   
-  this->PatchCompare.SetNumberOfComponentsPerPixel(this->Image->GetNumberOfComponentsPerPixel());
-  this->PatchCompare.SetImage(this->Image);
+  FloatVectorImageType::Pointer comparisonImage = GetComparisonImage();
+  this->PatchCompare.SetNumberOfComponentsPerPixel(comparisonImage->GetNumberOfComponentsPerPixel());
+  this->PatchCompare.SetImage(comparisonImage);
   this->PatchCompare.SetMask(this->MaskImage);
   this->PatchCompare.SetTargetRegion(GetTargetRegion());
   
@@ -625,12 +733,114 @@ void InteractiveBestPatchesWidget::on_btnCompute_clicked()
     return;
     }
 
-  this->PatchCompare.ComputePatchScores();
-  
-  DisplaySourcePatches();
+  // ComputePatchScores() ranks by total absolute score, so that is the metric the cached list is stored under
+  // (separately for the scores computed in Lab).
+  const char* metric = this->chkCompareInLab->isChecked() ? "totalAbsoluteLab" : "totalAbsolute";
+  uint64_t key = ScoreCache::ComputeKey(this->ImageHash, this->MaskHash, GetTargetRegion(), metric);
+  uint64_t totalNumberOfCandidates = 0;
+  std::vector<Patch> cachedPatches;
+  if(this->Cache.Load(key, cachedPatches, totalNumberOfCandidates))
+    {
+    // Add them one at a time so the patch finder knows where they are.
+    this->PatchCompare.ClearSourcePatches();
+    for(unsigned int i = 0; i < cachedPatches.size(); ++i)
+      {
+      this->PatchCompare.AddSourcePatch(cachedPatches[i]);
+      }
+    this->statusBar()->showMessage("Loaded scores from cache.");
+    DisplaySourcePatches();
+
+    // Automatically display the best patch
+    PatchClickedSlot(0);
+    return;
+    }
 
-  // Automatically display the best patch
-  PatchClickedSlot(0);
+  // Score in the background. PartialResultsSlot() shows the best patches found so far until it finishes.
+  this->ScoringCacheKey = key;
+  this->PatchCompare.SetNumberOfPartialResults(this->txtNumberOfPatches->text().toUInt());
+  this->ScoringFinished = false;
+  this->btnCompute->setEnabled(false);
+  this->btnStop->setEnabled(true);
+  this->statusBar()->showMessage("Computing scores...");
+  // Clear any earlier stop before the thread starts, so that a Stop clicked right away is not undone by it.
+  this->PatchCompare.ClearStopRequest();
+  this->ScoringThread = std::thread([this]()
+    {
+    this->PatchCompare.ComputePatchScores();
+    this->ScoringFinished = true;
+    });
+  this->PartialResultsTimer.start();
+}
+
+void InteractiveBestPatchesWidget::on_btnStop_clicked()
+{
+  if(IsScoring())
+    {
+    this->PatchCompare.RequestStop();
+    }
+}
+
+bool InteractiveBestPatchesWidget::IsScoring()
+{
+  return this->ScoringThread.joinable();
+}
+
+void InteractiveBestPatchesWidget::StopScoring()
+{
+  if(!IsScoring())
+    {
+    return;
+    }
+
+  // The partial ranking is of the old image or mask, so it is neither cached nor displayed.
+  this->PatchCompare.RequestStop();
+  this->ScoringThread.join();
+  this->PartialResultsTimer.stop();
+  this->btnCompute->setEnabled(true);
+  this->btnStop->setEnabled(false);
+  this->statusBar()->showMessage("Scoring stopped.");
+}
+
+void InteractiveBestPatchesWidget::PartialResultsSlot()
+{
+  if(!IsScoring())
+    {
+    this->PartialResultsTimer.stop();
+    return;
+    }
+
+  if(this->ScoringFinished)
+    {
+    this->PartialResultsTimer.stop();
+    this->ScoringThread.join();
+    this->btnCompute->setEnabled(true);
+    this->btnStop->setEnabled(false);
+
+    // Only complete rankings are cached.
+    if(this->PatchCompare.IsStopRequested())
+      {
+      this->statusBar()->showMessage("Scoring stopped early.");
+      }
+    else
+      {
+      this->Cache.Save(this->ScoringCacheKey, this->PatchCompare.GetSourcePatches(), this->PatchCompare.GetSourcePatches().size());
+      this->statusBar()->showMessage("Finished computing scores.");
+      }
+
+    DisplaySourcePatches();
+
+    // Automatically display the best patch
+    PatchClickedSlot(0);
+    return;
+    }
+
+  std::vector<Patch> partialResults;
+  this->PatchCompare.GetPartialResults(partialResults);
+  if(!partialResults.empty())
+    {
+    DisplayPatches(partialResults);
+    PatchClickedSlot(0);
+    }
 }
 
 itk::ImageRegion<2> InteractiveBestPatchesWidget::GetTargetRegion()
@@ -658,7 +868,11 @@ void InteractiveBestPatchesWidget::PatchClickedSlot(const unsigned int value)
   
   std::cout << "PatchClickedSlot " << value << std::endl;
   
-  Patch patch = this->PatchCompare.SourcePatches[value];
+  if(value >= this->DisplayedPatches.size())
+    {
+    return;
+    }
+  Patch patch = this->DisplayedPatches[value];
   
   std::cout << "Region: " << patch.Region << std::endl;
   
@@ -682,3 +896,83 @@ void InteractiveBestPatchesWidget::on_chkShowMask_clicked()
 {
   Refresh();
 }
+
+void InteractiveBestPatchesWidget::on_chkShowScoreMap_clicked()
+{
+  if(this->chkShowScoreMap->isChecked())
+    {
+    UpdateScoreMap(1);
+    }
+  else
+    {
+    this->ScoreMapRefineTimer.stop();
+    this->ScoreMapSlice->VisibilityOff();
+    }
+  Refresh();
+}
+
+void InteractiveBestPatchesWidget::on_chkCompareInLab_clicked()
+{
+  // The patch list is left alone until Compute is clicked again; the score map is shown in the new space right away.
+  if(this->Image)
+    {
+    this->ScoreMapEngine.SetImage(GetComparisonImage());
+    }
+  if(this->chkShowScoreMap->isChecked())
+    {
+    UpdateScoreMap(1);
+    Refresh();
+    }
+}
+
+FloatVectorImageType::Pointer InteractiveBestPatchesWidget::GetComparisonImage()
+{
+  if(!this->chkCompareInLab->isChecked() || this->Image->GetNumberOfComponentsPerPixel() < 3)
+    {
+    return this->Image;
+    }
+
+  // Convert the whole image once, rather than converting pixels every time they are compared.
+  if(!this->LabImage)
+    {
+    this->LabImage = FloatVectorImageType::New();
+    CIELab::ConvertImage(this->Image, this->LabImage);
+    }
+  return this->LabImage;
+}
+
+void InteractiveBestPatchesWidget::RefineScoreMapSlot()
+{
+  if(this->chkShowScoreMap->isChecked())
+    {
+    UpdateScoreMap(1);
+    Refresh();
+    }
+}
+
+void InteractiveBestPatchesWidget::UpdateScoreMap(const unsigned int stride)
+{
+  if(!this->Image || !this->MaskImage)
+    {
+    this->ScoreMapSlice->VisibilityOff();
+    return;
+    }
+
+  // The image and mask are given to the engine when they are loaded, so only the target changes here. Setting the
+  // radius does nothing unless it changed.
+  this->ScoreMapEngine.SetPatchRadius(this->txtPatchRadius->text().toUInt());
+  this->ScoreMapEngine.Compute(GetTargetRegion(), stride);
+
+  // Copy the scores into the VTK image
+  FloatScalarImageType* scores = this->ScoreMapEngine.GetOutput();
+  itk::Size<2> size = scores->GetLargestPossibleRegion().GetSize();
+  this->ScoreMapImage->SetDimensions(size[0], size[1], 1);
+  this->ScoreMapImage->AllocateScalars(VTK_FLOAT, 1);
+  memcpy(this->ScoreMapImage->GetScalarPointer(), scores->GetBufferPointer(), size[0] * size[1] * sizeof(float));
+  this->ScoreMapImage->Modified();
+
+  float maximum = std::max(this->ScoreMapEngine.GetMaximumScore(), this->ScoreMapEngine.GetMinimumScore() + 1.0f);
+  this->ScoreMapLookupTable->SetTableRange(this->ScoreMapEngine.GetMinimumScore(), maximum);
+
+  this->ScoreMapSlice->VisibilityOn();
+}
@@ -27,6 +27,7 @@
 class vtkImageData;
 class vtkImageSlice;
 class vtkImageSliceMapper;
+class vtkLookupTable;
 
 // ITK
 #include "itkImage.h"
@@ -34,10 +35,18 @@ class vtkImageSliceMapper;
 // Qt
 #include <QMainWindow>
 #include <QImage>
+#include <QTimer>
+
+// STL
+#include <atomic>
+#include <thread>
 
 // Custom
 #include "Types.h"
+#include "ScoreCache.h"
+#include "ScoreMap.h"
 #include "SelfPatchCompare.h"
+#include "TiledImagePyramid.h"
 
 // Submodules
 #include "Mask/Mask.h"
@@ -53,7 +62,7 @@ public:
   InteractiveBestPatchesWidget();
   InteractiveBestPatchesWidget(const std::string& imageFileName, const std::string& maskFileName);
   void SharedConstructor();
-  ~InteractiveBestPatchesWidget() {};
+  ~InteractiveBestPatchesWidget();
   
   // These function deal with flipping the image
   void SetCameraPosition(const double leftToRight[3], const double bottomToTop[3]);
@@ -65,6 +74,9 @@ public:
   const static unsigned int DisplayPatchSize = 50;
   
   void DisplaySourcePatches();
+
+  // Show 'patches' in the table, best first.
+  void DisplayPatches(const std::vector<Patch>& patches);
   
   void PositionTarget();
   
@@ -73,6 +85,11 @@ public slots:
   void PatchClickedSlot(const unsigned int);
   
   void on_chkShowMask_clicked();
+  void on_chkShowScoreMap_clicked();
+  void on_chkCompareInLab_clicked();
+
+  // Compute the full resolution score map once the target has stopped moving.
+  void RefineScoreMapSlot();
   
   void on_actionOpenImage_activated();
   void on_actionOpenMask_activated();
@@ -90,6 +107,10 @@ public slots:
   void on_txtTargetY_returnPressed();
   
   void on_btnCompute_clicked();
+  void on_btnStop_clicked();
+
+  // Show the best patches found so far while scoring runs in the background.
+  void PartialResultsSlot();
   void on_btnResort_clicked();
 
   void on_chkFillPatch_clicked();
@@ -118,6 +139,18 @@ protected:
   
   void PatchesMoved();
   void SetupPatches();
+
+  // Recompute the score map overlay for the current target, scoring every 'stride'th center.
+  void UpdateScoreMap(const unsigned int stride);
+
+  // The image that patches are compared in: Image, or its Lab conversion if "Compare in Lab" is checked.
+  FloatVectorImageType::Pointer GetComparisonImage();
+
+  // True while ComputePatchScores() is running (or has finished but not been collected by PartialResultsSlot()).
+  bool IsScoring();
+
+  // Stop the scoring thread (if it is running) and wait for it, e.g. before the image or mask it reads is replaced.
+  void StopScoring();
   
   // Allow us to interact with the objects as we would like.
   vtkSmartPointer<SwitchBetweenStyle> InteractorStyle;
@@ -131,12 +164,24 @@ protected:
   vtkSmartPointer<vtkImageData> VTKImage;
   vtkSmartPointer<vtkImageSlice> ImageSlice;
   vtkSmartPointer<vtkImageSliceMapper> ImageSliceMapper;
+
+  // Large images are displayed from a tiled pyramid instead of ImageSlice.
+  TiledImagePyramid ImagePyramid;
+  static const size_t LargeImageNumberOfPixels;
   
   // Mask image display
   vtkSmartPointer<vtkImageData> VTKMaskImage;
   vtkSmartPointer<vtkImageSlice> MaskImageSlice;
   vtkSmartPointer<vtkImageSliceMapper> MaskImageSliceMapper;
   
+  // Score map display (between the image and the patches)
+  vtkSmartPointer<vtkImageData> ScoreMapImage;
+  vtkSmartPointer<vtkImageSlice> ScoreMapSlice;
+  vtkSmartPointer<vtkImageSliceMapper> ScoreMapSliceMapper;
+  vtkSmartPointer<vtkLookupTable> ScoreMapLookupTable;
+  ScoreMap ScoreMapEngine;
+  QTimer ScoreMapRefineTimer;
+
   // Movable target patch
   vtkSmartPointer<vtkImageData> TargetPatch;
   vtkSmartPointer<vtkImageSlice> TargetPatchSlice;
@@ -150,6 +195,9 @@ protected:
   // The data that the user loads
   FloatVectorImageType::Pointer Image;
   Mask::Pointer MaskImage;
+
+  // The Lab conversion of Image, computed the first time it is needed.
+  FloatVectorImageType::Pointer LabImage;
   
   itk::Size<2> PatchSize;
   unsigned int PatchScale;
@@ -159,7 +207,21 @@ protected:
   
   SelfPatchCompare PatchCompare;
 
+  // Previously computed scores, and the hashes of the current image and mask that key them.
+  ScoreCache Cache;
+  uint64_t ImageHash;
+  uint64_t MaskHash;
+
   unsigned int DisplayedSourcePatch;
+
+  // The patches currently shown in the table.
+  std::vector<Patch> DisplayedPatches;
+
+  // Background scoring
+  std::thread ScoringThread;
+  std::atomic<bool> ScoringFinished;
+  QTimer PartialResultsTimer;
+  uint64_t ScoringCacheKey;
 };
 
 #endif // InteractiveBestPatchesWidget_H
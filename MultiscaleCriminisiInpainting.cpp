@@ -0,0 +1,214 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "MultiscaleCriminisiInpainting.h"
+
+// Custom
+#include "CriminisiInpainting.h"
+
+// ITK
+#include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkImageRegionIteratorWithIndex.h"
+
+// STL
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+MultiscaleCriminisiInpainting::MultiscaleCriminisiInpainting()
+{
+  this->PatchRadius = 3;
+  this->NumberOfLevels = 3;
+  this->SearchRadius = 2;
+}
+
+void MultiscaleCriminisiInpainting::SetImage(FloatVectorImageType::Pointer image)
+{
+  this->Image = image;
+}
+
+void MultiscaleCriminisiInpainting::SetMask(Mask::Pointer mask)
+{
+  this->MaskImage = mask;
+}
+
+void MultiscaleCriminisiInpainting::SetPatchRadius(const unsigned int radius)
+{
+  this->PatchRadius = radius;
+}
+
+void MultiscaleCriminisiInpainting::SetNumberOfLevels(const unsigned int numberOfLevels)
+{
+  this->NumberOfLevels = numberOfLevels > 0 ? numberOfLevels : 1;
+}
+
+void MultiscaleCriminisiInpainting::SetSearchRadius(const unsigned int searchRadius)
+{
+  this->SearchRadius = searchRadius;
+}
+
+FloatVectorImageType::Pointer MultiscaleCriminisiInpainting::GetResult()
+{
+  return this->Result;
+}
+
+void MultiscaleCriminisiInpainting::Inpaint()
+{
+  // Level 0 is the full size image.
+  std::vector<FloatVectorImageType::Pointer> images(1, this->Image);
+  std::vector<Mask::Pointer> masks(1, this->MaskImage);
+
+  // Each level must still be several patches wide to have source patches to choose from.
+  const unsigned int minimumSize = 4 * (2 * this->PatchRadius + 1);
+  while(images.size() < this->NumberOfLevels)
+    {
+    const itk::Size<2> size = images.back()->GetLargestPossibleRegion().GetSize();
+    if(size[0] / 2 < minimumSize || size[1] / 2 < minimumSize)
+      {
+      break;
+      }
+
+    FloatVectorImageType::Pointer image = FloatVectorImageType::New();
+    Downsample(images.back(), image);
+    images.push_back(image);
+
+    Mask::Pointer mask = Mask::New();
+    Downsample(masks.back(), mask);
+    masks.push_back(mask);
+    }
+
+  OffsetImageType::Pointer hints;
+  for(int level = static_cast<int>(images.size()) - 1; level >= 0; --level)
+    {
+    std::cout << "Inpainting level " << level << " (" << images[level]->GetLargestPossibleRegion().GetSize() << ")" << std::endl;
+
+    CriminisiInpainting inpainting;
+    inpainting.SetPatchRadius(this->PatchRadius);
+    inpainting.SetImage(images[level]);
+    inpainting.SetMask(masks[level]);
+    if(hints)
+      {
+      inpainting.SetSearchHints(hints, this->SearchRadius);
+      }
+    inpainting.Inpaint();
+
+    if(level == 0)
+      {
+      this->Result = inpainting.GetResult();
+      }
+    else
+      {
+      hints = OffsetImageType::New();
+      UpsampleOffsets(inpainting.GetSourceOffsetImage(), images[level - 1]->GetLargestPossibleRegion(), hints);
+      }
+    }
+}
+
+void MultiscaleCriminisiInpainting::Downsample(const FloatVectorImageType* image, FloatVectorImageType* output)
+{
+  const itk::ImageRegion<2> region = image->GetLargestPossibleRegion();
+  const unsigned int components = image->GetNumberOfComponentsPerPixel();
+
+  itk::Size<2> outputSize = {{(region.GetSize()[0] + 1) / 2, (region.GetSize()[1] + 1) / 2}};
+  output->SetRegions(itk::ImageRegion<2>(region.GetIndex(), outputSize));
+  output->SetNumberOfComponentsPerPixel(components);
+  output->Allocate();
+
+  const float* buffer = image->GetBufferPointer();
+  float* outputPixel = output->GetBufferPointer();
+  for(unsigned int y = 0; y < outputSize[1]; ++y)
+    {
+    for(unsigned int x = 0; x < outputSize[0]; ++x, outputPixel += components)
+      {
+      // The block is cut off at the last row and column of an image with an odd size.
+      const unsigned int lastX = std::min<unsigned int>(2 * x + 1, region.GetSize()[0] - 1);
+      const unsigned int lastY = std::min<unsigned int>(2 * y + 1, region.GetSize()[1] - 1);
+      const float weight = 1.0f / ((lastX - 2 * x + 1) * (lastY - 2 * y + 1));
+      for(unsigned int component = 0; component < components; ++component)
+        {
+        outputPixel[component] = 0;
+        }
+      for(unsigned int blockY = 2 * y; blockY <= lastY; ++blockY)
+        {
+        for(unsigned int blockX = 2 * x; blockX <= lastX; ++blockX)
+          {
+          const float* pixel = buffer + (static_cast<size_t>(blockY) * region.GetSize()[0] + blockX) * components;
+          for(unsigned int component = 0; component < components; ++component)
+            {
+            outputPixel[component] += weight * pixel[component];
+            }
+          }
+        }
+      }
+    }
+}
+
+void MultiscaleCriminisiInpainting::Downsample(const Mask* mask, Mask* output)
+{
+  const itk::ImageRegion<2> region = mask->GetLargestPossibleRegion();
+
+  itk::Size<2> outputSize = {{(region.GetSize()[0] + 1) / 2, (region.GetSize()[1] + 1) / 2}};
+  output->SetRegions(itk::ImageRegion<2>(region.GetIndex(), outputSize));
+  output->Allocate();
+  output->SetHoleValue(mask->GetHoleValue());
+  output->SetValidValue(mask->GetValidValue());
+  output->FillBuffer(mask->GetValidValue());
+
+  itk::ImageRegionConstIteratorWithIndex<Mask> maskIterator(mask, region);
+  while(!maskIterator.IsAtEnd())
+    {
+    if(maskIterator.Get() == mask->GetHoleValue())
+      {
+      itk::Index<2> index = maskIterator.GetIndex();
+      index[0] = region.GetIndex()[0] + (index[0] - region.GetIndex()[0]) / 2;
+      index[1] = region.GetIndex()[1] + (index[1] - region.GetIndex()[1]) / 2;
+      output->SetPixel(index, mask->GetHoleValue());
+      }
+    ++maskIterator;
+    }
+}
+
+void MultiscaleCriminisiInpainting::UpsampleOffsets(const OffsetImageType* offsets, const itk::ImageRegion<2>& fineRegion,
+                                                    OffsetImageType* output)
+{
+  // The region the offsets cover, at the finer level.
+  const itk::ImageRegion<2> coarseRegion = offsets->GetLargestPossibleRegion();
+  const itk::Index<2> origin = fineRegion.GetIndex();
+  itk::ImageRegion<2> region;
+  for(unsigned int i = 0; i < 2; ++i)
+    {
+    region.SetIndex(i, origin[i] + 2 * (coarseRegion.GetIndex()[i] - origin[i]));
+    region.SetSize(i, 2 * coarseRegion.GetSize()[i]);
+    }
+  region.Crop(fineRegion);
+
+  output->SetRegions(region);
+  output->Allocate();
+
+  itk::ImageRegionIteratorWithIndex<OffsetImageType> outputIterator(output, region);
+  while(!outputIterator.IsAtEnd())
+    {
+    itk::Index<2> index = outputIterator.GetIndex();
+    index[0] = origin[0] + (index[0] - origin[0]) / 2;
+    index[1] = origin[1] + (index[1] - origin[1]) / 2;
+    const itk::Offset<2> offset = offsets->GetPixel(index);
+    itk::Offset<2> hint = {{2 * offset[0], 2 * offset[1]}};
+    outputIterator.Set(hint);
+    ++outputIterator;
+    }
+}
@@ -0,0 +1,79 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef MultiscaleCriminisiInpainting_H
+#define MultiscaleCriminisiInpainting_H
+
+/*
+ * Coarse to fine Criminisi inpainting. The image and mask are halved in size NumberOfLevels - 1 times
+ * (a pixel of a smaller mask is a hole if any of the four pixels it covers is). The smallest image is
+ * inpainted with the full search. Each larger one is then inpainted with the offsets to where its pixels
+ * were copied from at the level below, doubled, as search hints (see CriminisiInpainting::SetSearchHints()),
+ * so instead of comparing every source patch, each target only compares the few near the position the
+ * smaller image chose.
+ */
+
+// Custom
+#include "Types.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+class MultiscaleCriminisiInpainting
+{
+public:
+  MultiscaleCriminisiInpainting();
+
+  void SetImage(FloatVectorImageType::Pointer image);
+  void SetMask(Mask::Pointer mask);
+
+  // The patch radius at every level.
+  void SetPatchRadius(const unsigned int radius);
+
+  // The number of images inpainted, including the full size one. 1 is the single scale algorithm. The default is 3.
+  // There are fewer levels if the smallest image would be too small to hold a few patches.
+  void SetNumberOfLevels(const unsigned int numberOfLevels);
+
+  // How far (in pixels of that level) from the hinted position source patches are compared. The default is 2.
+  void SetSearchRadius(const unsigned int searchRadius);
+
+  void Inpaint();
+
+  FloatVectorImageType::Pointer GetResult();
+
+private:
+  // Halve the size of an image by averaging each 2x2 block of pixels.
+  static void Downsample(const FloatVectorImageType* image, FloatVectorImageType* output);
+
+  // Halve the size of a mask. An output pixel is a hole if any of the pixels of its 2x2 block is.
+  static void Downsample(const Mask* mask, Mask* output);
+
+  // Make hints for an image of size 'fineRegion' from the source offsets of the level below: the hint of each
+  // pixel is twice the offset of the pixel below it.
+  static void UpsampleOffsets(const OffsetImageType* offsets, const itk::ImageRegion<2>& fineRegion, OffsetImageType* output);
+
+  FloatVectorImageType::Pointer Image;
+  Mask::Pointer MaskImage;
+  FloatVectorImageType::Pointer Result;
+
+  unsigned int PatchRadius;
+  unsigned int NumberOfLevels;
+  unsigned int SearchRadius;
+};
+
+#endif
@@ -0,0 +1,69 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef Parallel_H
+#define Parallel_H
+
+// STL
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace Parallel
+{
+
+// Return 'requested' if it is non-zero, otherwise the number of hardware threads (at least 1).
+inline unsigned int GetNumberOfThreads(const unsigned int requested = 0)
+{
+  if(requested > 0)
+    {
+    return requested;
+    }
+  unsigned int hardwareThreads = std::thread::hardware_concurrency();
+  return hardwareThreads > 0 ? hardwareThreads : 1;
+}
+
+// Call function(threadId) on 'numberOfThreads' threads and wait for all of them to finish.
+// Thread 0 runs on the calling thread.
+inline void ParallelFor(const unsigned int numberOfThreads, const std::function<void(unsigned int)>& function)
+{
+  std::vector<std::thread> threads;
+  for(unsigned int threadId = 1; threadId < numberOfThreads; ++threadId)
+    {
+    threads.push_back(std::thread(function, threadId));
+    }
+
+  function(0);
+
+  for(unsigned int i = 0; i < threads.size(); ++i)
+    {
+    threads[i].join();
+    }
+}
+
+// Split [0, numberOfElements) into 'numberOfChunks' contiguous pieces and return the bounds of piece 'chunkId'.
+inline void GetChunk(const size_t numberOfElements, const unsigned int numberOfChunks, const unsigned int chunkId,
+                     size_t& begin, size_t& end)
+{
+  begin = (numberOfElements * chunkId) / numberOfChunks;
+  end = (numberOfElements * (chunkId + 1)) / numberOfChunks;
+}
+
+} // end namespace
+
+#endif
@@ -25,4 +25,22 @@ bool SortByAverageAbsoluteScore(const Patch& patch1, const Patch& patch2);
 bool SortByTotalSquaredScore(const Patch& patch1, const Patch& patch2);
 bool SortByAverageSquaredScore(const Patch& patch1, const Patch& patch2);
 
+// Order patches by one of their scores (e.g. &Patch::TotalAbsoluteScore), breaking ties by Id so that
+// the order does not depend on the order in which the patches were scored.
+struct PatchScoreComparison
+{
+  PatchScoreComparison(float Patch::*score) : Score(score) {}
+
+  bool operator()(const Patch& patch1, const Patch& patch2) const
+  {
+    if(patch1.*Score != patch2.*Score)
+      {
+      return patch1.*Score < patch2.*Score;
+      }
+    return patch1.Id < patch2.Id;
+  }
+
+  float Patch::*Score;
+};
+
 #endif
@@ -0,0 +1,199 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "PhaseTimer.h"
+
+// STL
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+namespace
+{
+// The value below which 'fraction' of the sorted values are (nearest rank).
+double Percentile(const std::vector<double>& sortedValues, const double fraction)
+{
+  unsigned int rank = static_cast<unsigned int>(fraction * sortedValues.size() + 0.5);
+  rank = std::min(std::max(rank, 1u), static_cast<unsigned int>(sortedValues.size()));
+  return sortedValues[rank - 1];
+}
+}
+
+PhaseTimer::PhaseTimer()
+{
+  this->Enabled = false;
+}
+
+void PhaseTimer::SetPhaseNames(const std::vector<std::string>& phaseNames)
+{
+  this->PhaseNames = phaseNames;
+  Clear();
+}
+
+void PhaseTimer::SetEnabled(const bool enabled)
+{
+  this->Enabled = enabled;
+}
+
+bool PhaseTimer::IsEnabled() const
+{
+  return this->Enabled;
+}
+
+void PhaseTimer::Clear()
+{
+  this->Current.assign(this->PhaseNames.size(), 0);
+  this->InitializationTimes.assign(this->PhaseNames.size(), 0);
+  this->Iterations.clear();
+  this->IterationTimes.clear();
+}
+
+void PhaseTimer::EndInitialization()
+{
+  if(!this->Enabled)
+    {
+    return;
+    }
+  this->InitializationTimes = this->Current;
+  std::fill(this->Current.begin(), this->Current.end(), 0);
+}
+
+void PhaseTimer::EndIteration(const unsigned int iteration)
+{
+  if(!this->Enabled)
+    {
+    return;
+    }
+  this->Iterations.push_back(iteration);
+  this->IterationTimes.insert(this->IterationTimes.end(), this->Current.begin(), this->Current.end());
+  std::fill(this->Current.begin(), this->Current.end(), 0);
+}
+
+unsigned int PhaseTimer::GetNumberOfIterations() const
+{
+  return this->Iterations.size();
+}
+
+bool PhaseTimer::WriteCSV(const std::string& fileName) const
+{
+  std::ofstream fout(fileName.c_str());
+  if(!fout)
+    {
+    std::cerr << "Could not write " << fileName << std::endl;
+    return false;
+    }
+
+  const unsigned int numberOfPhases = this->PhaseNames.size();
+  fout << "iteration";
+  for(unsigned int phase = 0; phase < numberOfPhases; ++phase)
+    {
+    fout << "," << this->PhaseNames[phase];
+    }
+  fout << ",total" << std::endl;
+
+  fout << std::setprecision(6);
+  fout << "initialization";
+  double total = 0;
+  for(unsigned int phase = 0; phase < numberOfPhases; ++phase)
+    {
+    fout << "," << this->InitializationTimes[phase];
+    total += this->InitializationTimes[phase];
+    }
+  fout << "," << total << std::endl;
+
+  for(unsigned int row = 0; row < this->Iterations.size(); ++row)
+    {
+    fout << this->Iterations[row];
+    total = 0;
+    for(unsigned int phase = 0; phase < numberOfPhases; ++phase)
+      {
+      const double time = this->IterationTimes[row * numberOfPhases + phase];
+      fout << "," << time;
+      total += time;
+      }
+    fout << "," << total << std::endl;
+    }
+  return true;
+}
+
+void PhaseTimer::PrintSummary(std::ostream& stream) const
+{
+  const unsigned int numberOfPhases = this->PhaseNames.size();
+  const unsigned int numberOfIterations = this->Iterations.size();
+  if(numberOfIterations == 0)
+    {
+    stream << "No iterations were timed." << std::endl;
+    return;
+    }
+
+  // The last column is the whole iteration.
+  std::vector<std::vector<double> > columns(numberOfPhases + 1, std::vector<double>(numberOfIterations));
+  for(unsigned int row = 0; row < numberOfIterations; ++row)
+    {
+    double total = 0;
+    for(unsigned int phase = 0; phase < numberOfPhases; ++phase)
+      {
+      columns[phase][row] = this->IterationTimes[row * numberOfPhases + phase];
+      total += columns[phase][row];
+      }
+    columns[numberOfPhases][row] = total;
+    }
+
+  double initializationTotal = 0;
+  for(unsigned int phase = 0; phase < numberOfPhases; ++phase)
+    {
+    initializationTotal += this->InitializationTimes[phase];
+    }
+
+  stream << "Initialization: " << initializationTotal << " s. " << numberOfIterations << " iterations"
+         << " (times per iteration in ms):" << std::endl;
+  stream << std::left << std::setw(24) << "phase" << std::right << std::setw(12) << "total (s)" << std::setw(8) << "share"
+         << std::setw(10) << "mean" << std::setw(10) << "median" << std::setw(10) << "p90" << std::setw(10) << "p99"
+         << std::setw(10) << "max" << std::endl;
+
+  double grandTotal = 0;
+  for(unsigned int row = 0; row < numberOfIterations; ++row)
+    {
+    grandTotal += columns[numberOfPhases][row];
+    }
+
+  const std::ios::fmtflags flags = stream.flags();
+  const std::streamsize precision = stream.precision();
+  stream << std::fixed;
+  for(unsigned int phase = 0; phase <= numberOfPhases; ++phase)
+    {
+    std::vector<double>& values = columns[phase];
+    std::sort(values.begin(), values.end());
+    double total = 0;
+    for(unsigned int row = 0; row < numberOfIterations; ++row)
+      {
+      total += values[row];
+      }
+
+    const std::string name = phase < numberOfPhases ? this->PhaseNames[phase] : "total";
+    const double share = grandTotal > 0 ? 100.0 * total / grandTotal : 0;
+    stream << std::left << std::setw(24) << name << std::right
+           << std::setprecision(3) << std::setw(12) << total << std::setprecision(1) << std::setw(7) << share << "%"
+           << std::setprecision(3) << std::setw(10) << 1000.0 * total / numberOfIterations
+           << std::setw(10) << 1000.0 * Percentile(values, 0.5) << std::setw(10) << 1000.0 * Percentile(values, 0.9)
+           << std::setw(10) << 1000.0 * Percentile(values, 0.99) << std::setw(10) << 1000.0 * values.back() << std::endl;
+    }
+  stream.flags(flags);
+  stream.precision(precision);
+}
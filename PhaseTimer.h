@@ -0,0 +1,111 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef PhaseTimer_H
+#define PhaseTimer_H
+
+/*
+ * This class measures how long each phase of an iterative algorithm takes, iteration by iteration.
+ * A phase is timed by a Scope object that lives as long as the phase; the time of every phase in
+ * the iteration is summed until EndIteration() stores them as a row. The rows can be written to a
+ * CSV file (one line per iteration, one column per phase) and summarized (total, mean and
+ * percentiles of each phase over the iterations).
+ *
+ * Reading the clock costs a few tens of nanoseconds, which is nothing next to an iteration. When
+ * the timer is disabled (the default) a Scope does not read the clock at all.
+ */
+
+// STL
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class PhaseTimer
+{
+public:
+  PhaseTimer();
+
+  // Name the phases. Phases are identified by their position in this list. This clears the stored times.
+  void SetPhaseNames(const std::vector<std::string>& phaseNames);
+
+  void SetEnabled(const bool enabled);
+  bool IsEnabled() const;
+
+  // Forget all stored times.
+  void Clear();
+
+  // Time one phase, from the construction of this object to its destruction.
+  class Scope
+  {
+  public:
+    Scope(PhaseTimer& timer, const unsigned int phase) : Timer(timer), Phase(phase)
+    {
+      if(this->Timer.Enabled)
+        {
+        this->Start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~Scope()
+    {
+      if(this->Timer.Enabled)
+        {
+        this->Timer.Current[this->Phase] += std::chrono::duration<double>(std::chrono::steady_clock::now() - this->Start).count();
+        }
+    }
+
+  private:
+    Scope(const Scope&); // Not implemented
+    void operator=(const Scope&); // Not implemented
+
+    PhaseTimer& Timer;
+    unsigned int Phase;
+    std::chrono::steady_clock::time_point Start;
+  };
+
+  // Store the times measured since the last call as the setup before the first iteration.
+  void EndInitialization();
+
+  // Store the times measured since the last call as the row of 'iteration'.
+  void EndIteration(const unsigned int iteration);
+
+  unsigned int GetNumberOfIterations() const;
+
+  // Write a line with the phase names, a line with the initialization times, and a line for each iteration (in seconds).
+  bool WriteCSV(const std::string& fileName) const;
+
+  // Write a table with the time spent in each phase over all of the iterations: total, share of the total,
+  // mean, median, 90th and 99th percentile and maximum per iteration.
+  void PrintSummary(std::ostream& stream) const;
+
+private:
+  std::vector<std::string> PhaseNames;
+  bool Enabled;
+
+  // The time of each phase since the last EndInitialization() or EndIteration().
+  std::vector<double> Current;
+
+  std::vector<double> InitializationTimes;
+
+  // The iteration of each row, and the rows (one time per phase) one after the other.
+  std::vector<unsigned int> Iterations;
+  std::vector<double> IterationTimes;
+};
+
+#endif
@@ -0,0 +1,185 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "PlanarShadowImage.h"
+
+// Custom
+#include "Parallel.h"
+
+// STL
+#include <algorithm>
+
+#include <stdint.h>
+
+namespace
+{
+const long FloatsPerAlignment = PlanarShadowImage::Alignment / sizeof(float);
+
+long RoundUpToAlignment(const long numberOfFloats)
+{
+  return (numberOfFloats + FloatsPerAlignment - 1) / FloatsPerAlignment * FloatsPerAlignment;
+}
+
+long Clamp(const long value, const long minimum, const long maximum)
+{
+  return std::min(maximum, std::max(minimum, value));
+}
+}
+
+PlanarShadowImage::PlanarShadowImage()
+{
+  this->NumberOfComponents = 0;
+  this->BorderWidth = 0;
+  this->RowStride = 0;
+  this->PlaneStride = 0;
+  this->Origin = 0;
+}
+
+void PlanarShadowImage::SetImage(const FloatVectorImageType* image, const unsigned int borderWidth, const unsigned int numberOfThreads)
+{
+  this->Region = image->GetLargestPossibleRegion();
+  this->NumberOfComponents = image->GetNumberOfComponentsPerPixel();
+  this->BorderWidth = borderWidth;
+
+  const long width = this->Region.GetSize()[0];
+  const long height = this->Region.GetSize()[1];
+  const long border = borderWidth;
+
+  // The left border is padded so that the first pixel of each row is aligned.
+  const long leftPadding = RoundUpToAlignment(border);
+  this->RowStride = RoundUpToAlignment(leftPadding + width + border);
+  this->PlaneStride = this->RowStride * (height + 2 * border);
+
+  // Room for the planes, and for moving their start to the next aligned address.
+  this->Buffer.resize(this->PlaneStride * this->NumberOfComponents + FloatsPerAlignment);
+  const uintptr_t address = reinterpret_cast<uintptr_t>(&this->Buffer[0]);
+  const uintptr_t alignedAddress = (address + Alignment - 1) / Alignment * Alignment;
+  this->Origin = &this->Buffer[0] + (alignedAddress - address) / sizeof(float) + border * this->RowStride + leftPadding;
+
+  if(width == 0 || height == 0)
+    {
+    return;
+    }
+
+  const unsigned int threads = Parallel::GetNumberOfThreads(numberOfThreads);
+  Parallel::ParallelFor(threads, [&](unsigned int threadId)
+    {
+    size_t begin;
+    size_t end;
+    Parallel::GetChunk(height, threads, threadId, begin, end);
+    CopyRows(image, this->Region, begin, end);
+    });
+
+  ReplicateBorder(this->Region);
+}
+
+void PlanarShadowImage::Update(const FloatVectorImageType* image, const itk::ImageRegion<2>& inputRegion)
+{
+  itk::ImageRegion<2> region = inputRegion;
+  if(!region.Crop(this->Region))
+    {
+    return;
+    }
+  CopyRows(image, region, 0, region.GetSize()[1]);
+  ReplicateBorder(region);
+}
+
+const itk::ImageRegion<2>& PlanarShadowImage::GetRegion() const
+{
+  return this->Region;
+}
+
+unsigned int PlanarShadowImage::GetNumberOfComponents() const
+{
+  return this->NumberOfComponents;
+}
+
+unsigned int PlanarShadowImage::GetBorderWidth() const
+{
+  return this->BorderWidth;
+}
+
+FloatVectorImageType::OffsetValueType PlanarShadowImage::GetRowStride() const
+{
+  return this->RowStride;
+}
+
+void PlanarShadowImage::CopyRows(const FloatVectorImageType* image, const itk::ImageRegion<2>& region, const long firstRow, const long endRow)
+{
+  const unsigned int components = this->NumberOfComponents;
+  const long width = region.GetSize()[0];
+  for(long row = firstRow; row < endRow; ++row)
+    {
+    itk::Index<2> rowStart = {{region.GetIndex()[0], region.GetIndex()[1] + row}};
+    const float* input = image->GetBufferPointer() + image->ComputeOffset(rowStart) * components;
+    const FloatVectorImageType::OffsetValueType offset = ComputeOffset(rowStart);
+    for(unsigned int component = 0; component < components; ++component)
+      {
+      const float* pixel = input + component;
+      float* output = GetWritablePlane(component) + offset;
+      for(long x = 0; x < width; ++x, pixel += components)
+        {
+        output[x] = *pixel;
+        }
+      }
+    }
+}
+
+void PlanarShadowImage::ReplicateBorder(const itk::ImageRegion<2>& region)
+{
+  // The border pixels that repeat a pixel of 'region' are the ones beyond the edges of the image that 'region' touches.
+  const long border = this->BorderWidth;
+  const long imageBegin[2] = {this->Region.GetIndex()[0], this->Region.GetIndex()[1]};
+  const long imageEnd[2] = {imageBegin[0] + static_cast<long>(this->Region.GetSize()[0]),
+                            imageBegin[1] + static_cast<long>(this->Region.GetSize()[1])};
+  long begin[2];
+  long end[2];
+  for(unsigned int dimension = 0; dimension < 2; ++dimension)
+    {
+    begin[dimension] = region.GetIndex()[dimension];
+    end[dimension] = begin[dimension] + region.GetSize()[dimension];
+    if(begin[dimension] == imageBegin[dimension])
+      {
+      begin[dimension] -= border;
+      }
+    if(end[dimension] == imageEnd[dimension])
+      {
+      end[dimension] += border;
+      }
+    }
+
+  for(unsigned int component = 0; component < this->NumberOfComponents; ++component)
+    {
+    float* plane = GetWritablePlane(component);
+    for(long y = begin[1]; y < end[1]; ++y)
+      {
+      const long sourceY = Clamp(y, imageBegin[1], imageEnd[1] - 1);
+      float* row = plane + (y - imageBegin[1]) * this->RowStride - imageBegin[0];
+      const float* sourceRow = plane + (sourceY - imageBegin[1]) * this->RowStride - imageBegin[0];
+      // Rows inside the image only have the pixels beyond its left and right edges to fill.
+      const bool insideRow = (y == sourceY);
+      for(long x = begin[0]; x < end[0]; ++x)
+        {
+        if(!insideRow || x < imageBegin[0] || x >= imageEnd[0])
+          {
+          row[x] = sourceRow[Clamp(x, imageBegin[0], imageEnd[0] - 1)];
+          }
+        }
+      }
+    }
+}
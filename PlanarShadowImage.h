@@ -0,0 +1,105 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef PlanarShadowImage_H
+#define PlanarShadowImage_H
+
+/*
+ * A copy of a FloatVectorImageType made for the patch comparison kernels. The image stores the
+ * components of each pixel next to each other with no padding between rows. Here each component
+ * has its own plane:
+ *
+ *  - pixel (0, 0) of every plane, and so the start of every row, is aligned to Alignment bytes
+ *    (the rows are padded to a multiple of it), so rows can be read with aligned vector loads
+ *  - the image is surrounded by a border of BorderWidth pixels that repeat the nearest edge pixel,
+ *    so a kernel can read up to BorderWidth pixels outside the image without checking
+ *
+ * A pixel has the same offset (ComputeOffset()) in every plane, so one offset table serves all of
+ * them. The copy is not kept up to date automatically: after pixels of the image change, Update()
+ * copies them (and the border pixels that repeat them) again.
+ */
+
+// Custom
+#include "Types.h"
+
+// ITK
+#include "itkImageRegion.h"
+
+// STL
+#include <vector>
+
+class PlanarShadowImage
+{
+public:
+  PlanarShadowImage();
+
+  // The alignment (in bytes) of the start of every row.
+  static const unsigned int Alignment = 64;
+
+  // Copy 'image' into the planes, with a border of 'borderWidth' pixels around it. If numberOfThreads is 0, all hardware threads are used.
+  void SetImage(const FloatVectorImageType* image, const unsigned int borderWidth, const unsigned int numberOfThreads = 0);
+
+  // Copy the pixels of 'region' from the image (the one given to SetImage(), after they were changed) again.
+  void Update(const FloatVectorImageType* image, const itk::ImageRegion<2>& region);
+
+  // The region of the image (without the border). This is empty before SetImage() is called.
+  const itk::ImageRegion<2>& GetRegion() const;
+
+  unsigned int GetNumberOfComponents() const;
+  unsigned int GetBorderWidth() const;
+
+  // The number of floats from the start of one row to the start of the next.
+  FloatVectorImageType::OffsetValueType GetRowStride() const;
+
+  // The offset of a pixel of the image (or of the border) from pixel (0, 0) of the region, in every plane.
+  FloatVectorImageType::OffsetValueType ComputeOffset(const itk::Index<2>& index) const
+  {
+    return (index[1] - this->Region.GetIndex()[1]) * this->RowStride + (index[0] - this->Region.GetIndex()[0]);
+  }
+
+  // Pixel (0, 0) of the region in the plane of one component.
+  const float* GetPlane(const unsigned int component) const
+  {
+    return this->Origin + component * this->PlaneStride;
+  }
+
+private:
+  float* GetWritablePlane(const unsigned int component)
+  {
+    return this->Origin + component * this->PlaneStride;
+  }
+
+  // Copy the rows [firstRow, endRow) of 'region' from the image.
+  void CopyRows(const FloatVectorImageType* image, const itk::ImageRegion<2>& region, const long firstRow, const long endRow);
+
+  // Fill the border pixels that repeat the pixels of 'region' (a region of the image).
+  void ReplicateBorder(const itk::ImageRegion<2>& region);
+
+  itk::ImageRegion<2> Region;
+  unsigned int NumberOfComponents;
+  unsigned int BorderWidth;
+
+  FloatVectorImageType::OffsetValueType RowStride;
+  FloatVectorImageType::OffsetValueType PlaneStride;
+
+  // The planes, one after the other. Origin is pixel (0, 0) of the first plane, somewhere inside Buffer.
+  std::vector<float> Buffer;
+  float* Origin;
+};
+
+#endif
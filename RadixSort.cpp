@@ -0,0 +1,161 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "RadixSort.h"
+
+// Custom
+#include "Parallel.h"
+
+// STL
+#include <algorithm>
+
+void ParallelRadixSort(std::vector<uint32_t>& keys, std::vector<uint32_t>& values, const unsigned int requestedThreads)
+{
+  const size_t numberOfElements = keys.size();
+  if(numberOfElements < 2)
+    {
+    return;
+    }
+
+  // Don't use more threads than it takes for each one to have a reasonable amount of work
+  unsigned int numberOfThreads = Parallel::GetNumberOfThreads(requestedThreads);
+  const size_t minimumElementsPerThread = 1 << 14;
+  numberOfThreads = std::max<size_t>(1, std::min<size_t>(numberOfThreads, numberOfElements / minimumElementsPerThread));
+
+  const unsigned int RadixBits = 8;
+  const unsigned int NumberOfBuckets = 1 << RadixBits;
+
+  std::vector<uint32_t> keysBuffer(numberOfElements);
+  std::vector<uint32_t> valuesBuffer(numberOfElements);
+
+  // counts[threadId * NumberOfBuckets + digit]
+  std::vector<size_t> counts(numberOfThreads * NumberOfBuckets);
+
+  std::vector<uint32_t>* sourceKeys = &keys;
+  std::vector<uint32_t>* sourceValues = &values;
+  std::vector<uint32_t>* destinationKeys = &keysBuffer;
+  std::vector<uint32_t>* destinationValues = &valuesBuffer;
+
+  for(unsigned int shift = 0; shift < 32; shift += RadixBits)
+    {
+    // Histogram each thread's chunk of the input
+    std::fill(counts.begin(), counts.end(), 0);
+    Parallel::ParallelFor(numberOfThreads, [&](unsigned int threadId)
+      {
+      size_t begin, end;
+      Parallel::GetChunk(numberOfElements, numberOfThreads, threadId, begin, end);
+      size_t* threadCounts = &counts[threadId * NumberOfBuckets];
+      const uint32_t* chunkKeys = sourceKeys->data();
+      for(size_t i = begin; i < end; ++i)
+        {
+        threadCounts[(chunkKeys[i] >> shift) & (NumberOfBuckets - 1)]++;
+        }
+      });
+
+    // If every key has the same digit in this position, this pass would not change anything.
+    bool allInOneBucket = false;
+    for(unsigned int digit = 0; digit < NumberOfBuckets; ++digit)
+      {
+      size_t digitTotal = 0;
+      for(unsigned int threadId = 0; threadId < numberOfThreads; ++threadId)
+        {
+        digitTotal += counts[threadId * NumberOfBuckets + digit];
+        }
+      if(digitTotal == numberOfElements)
+        {
+        allInOneBucket = true;
+        }
+      if(digitTotal != 0)
+        {
+        break;
+        }
+      }
+    if(allInOneBucket)
+      {
+      continue;
+      }
+
+    // Turn the counts into starting positions. Digits are ordered first, then threads, so that
+    // each thread writes its elements of a given digit after those of the previous threads (which keeps the sort stable).
+    size_t position = 0;
+    for(unsigned int digit = 0; digit < NumberOfBuckets; ++digit)
+      {
+      for(unsigned int threadId = 0; threadId < numberOfThreads; ++threadId)
+        {
+        size_t count = counts[threadId * NumberOfBuckets + digit];
+        counts[threadId * NumberOfBuckets + digit] = position;
+        position += count;
+        }
+      }
+
+    // Scatter
+    Parallel::ParallelFor(numberOfThreads, [&](unsigned int threadId)
+      {
+      size_t begin, end;
+      Parallel::GetChunk(numberOfElements, numberOfThreads, threadId, begin, end);
+      size_t* threadOffsets = &counts[threadId * NumberOfBuckets];
+      const uint32_t* inputKeys = sourceKeys->data();
+      const uint32_t* inputValues = sourceValues->data();
+      uint32_t* outputKeys = destinationKeys->data();
+      uint32_t* outputValues = destinationValues->data();
+      for(size_t i = begin; i < end; ++i)
+        {
+        size_t outputPosition = threadOffsets[(inputKeys[i] >> shift) & (NumberOfBuckets - 1)]++;
+        outputKeys[outputPosition] = inputKeys[i];
+        outputValues[outputPosition] = inputValues[i];
+        }
+      });
+
+    std::swap(sourceKeys, destinationKeys);
+    std::swap(sourceValues, destinationValues);
+    }
+
+  // An odd number of passes (some may have been skipped) leaves the result in the scratch buffers.
+  if(sourceKeys != &keys)
+    {
+    keys.swap(keysBuffer);
+    values.swap(valuesBuffer);
+    }
+}
+
+void SortPatchesByScore(std::vector<Patch>& patches, float Patch::*score)
+{
+  if(patches.size() < RadixSortThreshold())
+    {
+    std::stable_sort(patches.begin(), patches.end(),
+                     [score](const Patch& patch1, const Patch& patch2) { return patch1.*score < patch2.*score; });
+    return;
+    }
+
+  std::vector<uint32_t> keys(patches.size());
+  std::vector<uint32_t> indices(patches.size());
+  for(size_t i = 0; i < patches.size(); ++i)
+    {
+    keys[i] = FloatToSortableKey(patches[i].*score);
+    indices[i] = static_cast<uint32_t>(i);
+    }
+
+  ParallelRadixSort(keys, indices);
+
+  std::vector<Patch> sortedPatches(patches.size());
+  for(size_t i = 0; i < indices.size(); ++i)
+    {
+    sortedPatches[i] = patches[indices[i]];
+    }
+  patches.swap(sortedPatches);
+}
@@ -0,0 +1,64 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef RadixSort_H
+#define RadixSort_H
+
+/*
+ * These functions rank very large sets of patches by one of their float scores.
+ * The scores are mapped to unsigned integers whose ordering matches the ordering of
+ * the floats, and then sorted with a least-significant-digit radix sort (four passes
+ * of 8 bits). The patch index is carried along as the payload, so the patches
+ * themselves are only moved once, at the end.
+ */
+
+// Custom
+#include "Patch.h"
+
+// STL
+#include <vector>
+
+#include <stdint.h>
+
+// Map a float to an unsigned int such that a < b (as floats) implies Key(a) < Key(b) (as unsigned ints).
+// The sign bit of positive values is flipped, and all bits of negative values are flipped.
+inline uint32_t FloatToSortableKey(const float value)
+{
+  union
+  {
+    float f;
+    uint32_t u;
+  } converter;
+  converter.f = value;
+  uint32_t mask = (converter.u & 0x80000000u) ? 0xFFFFFFFFu : 0x80000000u;
+  return converter.u ^ mask;
+}
+
+// Sort 'keys' ascending, applying the same permutation to 'values'. The sort is stable.
+// If numberOfThreads is 0, std::thread::hardware_concurrency() threads are used.
+void ParallelRadixSort(std::vector<uint32_t>& keys, std::vector<uint32_t>& values, unsigned int numberOfThreads = 0);
+
+// Sort 'patches' ascending by the score pointed to by 'score', e.g. &Patch::TotalAbsoluteScore.
+// Below RadixSortThreshold() patches this simply calls std::stable_sort, because the radix sort
+// only pays off for large inputs.
+void SortPatchesByScore(std::vector<Patch>& patches, float Patch::*score);
+
+// The number of patches above which SortPatchesByScore() uses ParallelRadixSort().
+inline unsigned int RadixSortThreshold() { return 1u << 16; }
+
+#endif
@@ -0,0 +1,51 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef RegionHelpers_H
+#define RegionHelpers_H
+
+// ITK
+#include "itkImageRegion.h"
+
+// STL
+#include <algorithm>
+
+namespace RegionHelpers
+{
+
+// Grow 'region' to the bounding box of itself and 'other'. An empty 'region' becomes 'other'.
+inline void ExpandToInclude(itk::ImageRegion<2>& region, const itk::ImageRegion<2>& other)
+{
+  if(region.GetNumberOfPixels() == 0)
+    {
+    region = other;
+    return;
+    }
+  for(unsigned int i = 0; i < 2; ++i)
+    {
+    const long start = std::min(region.GetIndex()[i], other.GetIndex()[i]);
+    const long end = std::max(region.GetIndex()[i] + static_cast<long>(region.GetSize()[i]),
+                              other.GetIndex()[i] + static_cast<long>(other.GetSize()[i]));
+    region.SetIndex(i, start);
+    region.SetSize(i, end - start);
+    }
+}
+
+} // end namespace
+
+#endif
@@ -0,0 +1,272 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "ScoreCache.h"
+
+// STL
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace
+{
+const char Magic[8] = {'I', 'B', 'P', 'S', 'C', 'O', 'R', 'E'};
+const uint32_t Version = 1;
+
+struct FileHeader
+{
+  char Magic[8];
+  uint32_t Version;
+  uint32_t PatchSize[2];
+  uint32_t Reserved;
+  uint64_t Key;
+  uint64_t NumberOfRecords;
+  uint64_t TotalNumberOfCandidates;
+};
+
+struct Record
+{
+  int32_t Corner[2];
+  uint32_t Id;
+  float TotalAbsoluteScore;
+  float AverageAbsoluteScore;
+  float TotalSquaredScore;
+  float AverageSquaredScore;
+};
+
+// Mix 'length' bytes into 'hash'. This processes 8 bytes at a time, which matters because
+// the images being hashed can be gigabytes.
+uint64_t HashBytes(uint64_t hash, const void* data, const size_t length)
+{
+  const uint64_t prime = 0x100000001b3ULL;
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  size_t i = 0;
+  for(; i + 8 <= length; i += 8)
+    {
+    uint64_t word;
+    memcpy(&word, bytes + i, 8);
+    hash = (hash ^ word) * prime;
+    hash ^= hash >> 29;
+    }
+  for(; i < length; ++i)
+    {
+    hash = (hash ^ bytes[i]) * prime;
+    }
+  return hash;
+}
+
+template <typename T>
+uint64_t HashValue(const uint64_t hash, const T& value)
+{
+  return HashBytes(hash, &value, sizeof(T));
+}
+
+const uint64_t InitialHash = 0xcbf29ce484222325ULL;
+} // end anonymous namespace
+
+ScoreCache::ScoreCache()
+{
+  this->Directory = "ScoreCache";
+}
+
+void ScoreCache::SetDirectory(const std::string& directory)
+{
+  this->Directory = directory;
+}
+
+std::string ScoreCache::GetDirectory() const
+{
+  return this->Directory;
+}
+
+uint64_t ScoreCache::HashImage(const FloatVectorImageType* image)
+{
+  itk::Size<2> size = image->GetLargestPossibleRegion().GetSize();
+  uint64_t hash = InitialHash;
+  hash = HashValue(hash, static_cast<uint64_t>(size[0]));
+  hash = HashValue(hash, static_cast<uint64_t>(size[1]));
+  hash = HashValue(hash, static_cast<uint32_t>(image->GetNumberOfComponentsPerPixel()));
+  size_t numberOfValues = size[0] * size[1] * image->GetNumberOfComponentsPerPixel();
+  return HashBytes(hash, image->GetBufferPointer(), numberOfValues * sizeof(FloatVectorImageType::InternalPixelType));
+}
+
+uint64_t ScoreCache::HashMask(const Mask* mask)
+{
+  itk::Size<2> size = mask->GetLargestPossibleRegion().GetSize();
+  uint64_t hash = InitialHash;
+  hash = HashValue(hash, static_cast<uint64_t>(size[0]));
+  hash = HashValue(hash, static_cast<uint64_t>(size[1]));
+  hash = HashValue(hash, mask->GetHoleValue());
+  hash = HashValue(hash, mask->GetValidValue());
+  return HashBytes(hash, mask->GetBufferPointer(), size[0] * size[1] * sizeof(Mask::PixelType));
+}
+
+uint64_t ScoreCache::ComputeKey(const uint64_t imageHash, const uint64_t maskHash, const itk::ImageRegion<2>& targetRegion,
+                                const std::string& metric)
+{
+  // The patch radius is part of the key through the size of the target region.
+  uint64_t hash = InitialHash;
+  hash = HashValue(hash, imageHash);
+  hash = HashValue(hash, maskHash);
+  hash = HashValue(hash, static_cast<int64_t>(targetRegion.GetIndex()[0]));
+  hash = HashValue(hash, static_cast<int64_t>(targetRegion.GetIndex()[1]));
+  hash = HashValue(hash, static_cast<uint64_t>(targetRegion.GetSize()[0]));
+  hash = HashValue(hash, static_cast<uint64_t>(targetRegion.GetSize()[1]));
+  return HashBytes(hash, metric.c_str(), metric.size());
+}
+
+std::string ScoreCache::GetFileName(const uint64_t key) const
+{
+  std::stringstream ss;
+  ss << this->Directory << "/" << std::hex << std::setfill('0') << std::setw(16) << key << ".scores";
+  return ss.str();
+}
+
+bool ScoreCache::Load(const uint64_t key, std::vector<Patch>& patches, uint64_t& totalNumberOfCandidates) const
+{
+  std::string fileName = GetFileName(key);
+  int fileDescriptor = open(fileName.c_str(), O_RDONLY);
+  if(fileDescriptor < 0)
+    {
+    return false;
+    }
+
+  struct stat fileStatus;
+  if(fstat(fileDescriptor, &fileStatus) != 0 || static_cast<size_t>(fileStatus.st_size) < sizeof(FileHeader))
+    {
+    close(fileDescriptor);
+    return false;
+    }
+  size_t fileSize = fileStatus.st_size;
+
+  void* mapped = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+  close(fileDescriptor); // The mapping stays valid after the file is closed.
+  if(mapped == MAP_FAILED)
+    {
+    return false;
+    }
+
+  const FileHeader* header = static_cast<const FileHeader*>(mapped);
+  bool valid = memcmp(header->Magic, Magic, sizeof(Magic)) == 0 &&
+               header->Version == Version &&
+               header->Key == key &&
+               fileSize == sizeof(FileHeader) + header->NumberOfRecords * sizeof(Record);
+  if(!valid)
+    {
+    std::cerr << "Ignoring invalid score cache file " << fileName << std::endl;
+    munmap(mapped, fileSize);
+    return false;
+    }
+
+  itk::Size<2> patchSize;
+  patchSize[0] = header->PatchSize[0];
+  patchSize[1] = header->PatchSize[1];
+
+  const Record* records = reinterpret_cast<const Record*>(static_cast<const char*>(mapped) + sizeof(FileHeader));
+  patches.resize(header->NumberOfRecords);
+  for(size_t i = 0; i < patches.size(); ++i)
+    {
+    itk::Index<2> corner;
+    corner[0] = records[i].Corner[0];
+    corner[1] = records[i].Corner[1];
+    patches[i].Region = itk::ImageRegion<2>(corner, patchSize);
+    patches[i].Id = records[i].Id;
+    patches[i].TotalAbsoluteScore = records[i].TotalAbsoluteScore;
+    patches[i].AverageAbsoluteScore = records[i].AverageAbsoluteScore;
+    patches[i].TotalSquaredScore = records[i].TotalSquaredScore;
+    patches[i].AverageSquaredScore = records[i].AverageSquaredScore;
+    }
+  totalNumberOfCandidates = header->TotalNumberOfCandidates;
+
+  munmap(mapped, fileSize);
+  return true;
+}
+
+bool ScoreCache::Save(const uint64_t key, const std::vector<Patch>& patches, const uint64_t totalNumberOfCandidates) const
+{
+  if(patches.empty())
+    {
+    return false;
+    }
+
+  mkdir(this->Directory.c_str(), 0755); // Fails harmlessly if the directory already exists.
+
+  // Write to a temporary file and rename it, so that a concurrent reader never sees a partial file. The temporary
+  // name is unique, so processes (or threads) saving the same key at once do not write into the same file.
+  std::string fileName = GetFileName(key);
+  std::vector<char> temporaryName(fileName.begin(), fileName.end());
+  const char suffix[] = ".XXXXXX";
+  temporaryName.insert(temporaryName.end(), suffix, suffix + sizeof(suffix)); // Including the terminating 0
+  int descriptor = mkstemp(&temporaryName[0]);
+  std::string temporaryFileName(&temporaryName[0]);
+  FILE* file = descriptor >= 0 ? fdopen(descriptor, "wb") : 0;
+  if(!file)
+    {
+    std::cerr << "Could not write score cache file " << temporaryFileName << std::endl;
+    if(descriptor >= 0)
+      {
+      close(descriptor);
+      remove(temporaryFileName.c_str());
+      }
+    return false;
+    }
+  fchmod(descriptor, 0644); // mkstemp creates the file readable only by its owner
+
+  FileHeader header;
+  memset(&header, 0, sizeof(FileHeader));
+  memcpy(header.Magic, Magic, sizeof(Magic));
+  header.Version = Version;
+  header.PatchSize[0] = patches[0].Region.GetSize()[0];
+  header.PatchSize[1] = patches[0].Region.GetSize()[1];
+  header.Key = key;
+  header.NumberOfRecords = patches.size();
+  header.TotalNumberOfCandidates = totalNumberOfCandidates;
+  bool success = fwrite(&header, sizeof(FileHeader), 1, file) == 1;
+
+  std::vector<Record> records(patches.size());
+  for(size_t i = 0; i < patches.size(); ++i)
+    {
+    records[i].Corner[0] = patches[i].Region.GetIndex()[0];
+    records[i].Corner[1] = patches[i].Region.GetIndex()[1];
+    records[i].Id = patches[i].Id;
+    records[i].TotalAbsoluteScore = patches[i].TotalAbsoluteScore;
+    records[i].AverageAbsoluteScore = patches[i].AverageAbsoluteScore;
+    records[i].TotalSquaredScore = patches[i].TotalSquaredScore;
+    records[i].AverageSquaredScore = patches[i].AverageSquaredScore;
+    }
+  success = success && fwrite(records.data(), sizeof(Record), records.size(), file) == records.size();
+  success = (fclose(file) == 0) && success;
+
+  if(!success || rename(temporaryFileName.c_str(), fileName.c_str()) != 0)
+    {
+    std::cerr << "Could not write score cache file " << fileName << std::endl;
+    remove(temporaryFileName.c_str());
+    return false;
+    }
+  return true;
+}
@@ -0,0 +1,79 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef ScoreCache_H
+#define ScoreCache_H
+
+/*
+ * This class stores ranked lists of scored source patches on disk so that a query that has
+ * already been answered (same image, mask, target region, patch radius and metric) can be
+ * loaded instead of recomputed. Each query is stored in its own file, named by its key:
+ *
+ *   header: "IBPSCORE", version, patch size, key, number of records, total number of candidates
+ *   records: x, y (corner of the source region), Id, total absolute, average absolute,
+ *            total squared, average squared
+ *
+ * Files are read through mmap, so loading only touches the pages that are used.
+ */
+
+// Custom
+#include "Patch.h"
+#include "Types.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// STL
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+class ScoreCache
+{
+public:
+  ScoreCache();
+
+  // Set the directory the cache files are stored in. It is created when the first file is saved.
+  void SetDirectory(const std::string& directory);
+  std::string GetDirectory() const;
+
+  // Hash the size and pixel data of an image or mask. These are expensive for large images,
+  // so they should be computed once when the data is loaded.
+  static uint64_t HashImage(const FloatVectorImageType* image);
+  static uint64_t HashMask(const Mask* mask);
+
+  // Combine everything a query depends on into a single key.
+  static uint64_t ComputeKey(const uint64_t imageHash, const uint64_t maskHash, const itk::ImageRegion<2>& targetRegion,
+                             const std::string& metric);
+
+  // Load the ranked patches stored under 'key'. 'totalNumberOfCandidates' is set to the number of source
+  // patches that were ranked, which is larger than patches.size() if only the best ones were stored.
+  // Returns false if there is no (valid) file for this key.
+  bool Load(const uint64_t key, std::vector<Patch>& patches, uint64_t& totalNumberOfCandidates) const;
+
+  // Store ranked patches under 'key'. All patches must have the same region size.
+  bool Save(const uint64_t key, const std::vector<Patch>& patches, const uint64_t totalNumberOfCandidates) const;
+
+private:
+  std::string GetFileName(const uint64_t key) const;
+
+  std::string Directory;
+};
+
+#endif
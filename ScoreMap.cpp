@@ -0,0 +1,486 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "ScoreMap.h"
+
+// Custom
+#include "Parallel.h"
+
+// ITK
+#include "itkImageRegionConstIteratorWithIndex.h"
+
+// STL
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+#include <stdint.h>
+
+// VXL
+#include <vnl/algo/vnl_fft_2d.h>
+
+namespace
+{
+
+// The smallest size that is at least 'size' and has no prime factors but 2, 3 and 5, which vnl_fft_2d requires.
+unsigned int GetFFTSize(const unsigned int size)
+{
+  const unsigned int factors[3] = {2, 3, 5};
+  for(unsigned int fftSize = std::max(size, 1u); ; ++fftSize)
+    {
+    unsigned int remainder = fftSize;
+    for(unsigned int factorId = 0; factorId < 3; ++factorId)
+      {
+      while(remainder % factors[factorId] == 0)
+        {
+        remainder /= factors[factorId];
+        }
+      }
+    if(remainder == 1)
+      {
+      return fftSize;
+      }
+    }
+}
+
+// The cost of a transform of 'numberOfElements' elements, relative to a multiply-add of the direct comparison.
+double GetFFTCost(const double numberOfElements)
+{
+  const double multiplyAddsPerElementAndLevel = 4.0;
+  return multiplyAddsPerElementAndLevel * numberOfElements * std::log(numberOfElements) / std::log(2.0);
+}
+
+} // end anonymous namespace
+
+
+ScoreMap::ScoreMap()
+{
+  this->PatchRadius = 0;
+  this->NumberOfThreads = 0;
+  this->ValidCentersModified = true;
+  this->ImageTime = 0;
+  this->ShadowModified = true;
+  this->SpectraModified = true;
+  this->ComputeMethod = COMPUTE_AUTOMATIC;
+  this->Output = FloatScalarImageType::New();
+  this->MinimumScore = 0;
+  this->MaximumScore = 0;
+}
+
+void ScoreMap::SetImage(FloatVectorImageType::Pointer image)
+{
+  if(image != this->Image || (image && image->GetMTime() != this->ImageTime))
+    {
+    this->ShadowModified = true;
+    this->SpectraModified = true;
+    this->ImageTime = image ? image->GetMTime() : 0;
+    }
+  // The valid centers only depend on the mask and the patch radius.
+  this->Image = image;
+}
+
+void ScoreMap::SetMask(Mask::Pointer mask)
+{
+  this->MaskImage = mask;
+  this->ValidCentersModified = true;
+}
+
+void ScoreMap::SetPatchRadius(const unsigned int radius)
+{
+  if(radius != this->PatchRadius)
+    {
+    this->PatchRadius = radius;
+    this->ValidCentersModified = true;
+    // The spectra do not depend on the patch radius, but the border of the shadow does.
+    this->ShadowModified = true;
+    }
+}
+
+void ScoreMap::SetComputeMethod(const ComputeMethodEnum method)
+{
+  this->ComputeMethod = method;
+}
+
+void ScoreMap::SetNumberOfThreads(const unsigned int numberOfThreads)
+{
+  this->NumberOfThreads = numberOfThreads;
+}
+
+FloatScalarImageType* ScoreMap::GetOutput()
+{
+  return this->Output;
+}
+
+float ScoreMap::GetMinimumScore() const
+{
+  return this->MinimumScore;
+}
+
+float ScoreMap::GetMaximumScore() const
+{
+  return this->MaximumScore;
+}
+
+void ScoreMap::ComputeValidCenters()
+{
+  itk::Size<2> size = this->MaskImage->GetLargestPossibleRegion().GetSize();
+  const size_t width = size[0];
+  const size_t height = size[1];
+
+  // holeSums[(y+1)*(width+1) + (x+1)] is the number of non-valid pixels in [0,x]x[0,y]
+  std::vector<uint32_t> holeSums((width + 1) * (height + 1), 0);
+  itk::ImageRegionConstIteratorWithIndex<Mask> maskIterator(this->MaskImage, this->MaskImage->GetLargestPossibleRegion());
+  for(size_t y = 0; y < height; ++y)
+    {
+    uint32_t rowSum = 0;
+    for(size_t x = 0; x < width; ++x)
+      {
+      rowSum += this->MaskImage->IsValid(maskIterator.GetIndex()) ? 0 : 1;
+      holeSums[(y + 1) * (width + 1) + (x + 1)] = holeSums[y * (width + 1) + (x + 1)] + rowSum;
+      ++maskIterator;
+      }
+    }
+
+  this->ValidCenters.assign(width * height, 0);
+  const size_t radius = this->PatchRadius;
+  if(width < 2 * radius + 1 || height < 2 * radius + 1)
+    {
+    this->ValidCentersModified = false;
+    return;
+    }
+
+  for(size_t y = radius; y + radius < height; ++y)
+    {
+    for(size_t x = radius; x + radius < width; ++x)
+      {
+      size_t x0 = x - radius;
+      size_t y0 = y - radius;
+      size_t x1 = x + radius + 1;
+      size_t y1 = y + radius + 1;
+      uint32_t holes = holeSums[y1 * (width + 1) + x1] - holeSums[y0 * (width + 1) + x1]
+                     - holeSums[y1 * (width + 1) + x0] + holeSums[y0 * (width + 1) + x0];
+      this->ValidCenters[y * width + x] = (holes == 0);
+      }
+    }
+
+  this->ValidCentersModified = false;
+}
+
+void ScoreMap::ComputeSpectra()
+{
+  const unsigned int components = this->Image->GetNumberOfComponentsPerPixel();
+  itk::Size<2> size = this->Image->GetLargestPossibleRegion().GetSize();
+  const unsigned int rows = GetFFTSize(size[1]);
+  const unsigned int columns = GetFFTSize(size[0]);
+  const float* buffer = this->Image->GetBufferPointer();
+
+  // The transforms are independent, so give each thread whole transforms.
+  this->Spectra.resize(components + 1);
+  const unsigned int numberOfThreads = std::min(Parallel::GetNumberOfThreads(this->NumberOfThreads), components + 1);
+  std::atomic<unsigned int> nextSpectrum(0);
+  Parallel::ParallelFor(numberOfThreads, [&](unsigned int)
+    {
+    vnl_fft_2d<double> fft(rows, columns);
+    for(unsigned int spectrumId = nextSpectrum++; spectrumId <= components; spectrumId = nextSpectrum++)
+      {
+      SpectrumType& spectrum = this->Spectra[spectrumId];
+      spectrum.set_size(rows, columns);
+      spectrum.fill(vcl_complex<double>(0, 0));
+      for(size_t y = 0; y < size[1]; ++y)
+        {
+        for(size_t x = 0; x < size[0]; ++x)
+          {
+          const float* pixel = buffer + (y * size[0] + x) * components;
+          double value = 0;
+          if(spectrumId < components)
+            {
+            value = pixel[spectrumId];
+            }
+          else
+            {
+            for(unsigned int component = 0; component < components; ++component)
+              {
+              value += static_cast<double>(pixel[component]) * pixel[component];
+              }
+            }
+          spectrum(y, x) = value;
+          }
+        }
+      fft.fwd_transform(spectrum);
+      }
+    });
+
+  this->SpectraModified = false;
+}
+
+void ScoreMap::Compute(const itk::ImageRegion<2>& targetRegion, const unsigned int inputStride)
+{
+  if(this->ValidCentersModified)
+    {
+    ComputeValidCenters();
+    }
+
+  const unsigned int stride = std::max(1u, inputStride);
+  const unsigned int components = this->Image->GetNumberOfComponentsPerPixel();
+  itk::Size<2> size = this->Image->GetLargestPossibleRegion().GetSize();
+  const long width = size[0];
+  const long height = size[1];
+  const long radius = this->PatchRadius;
+
+  if(this->Output->GetLargestPossibleRegion() != this->Image->GetLargestPossibleRegion())
+    {
+    this->Output->SetRegions(this->Image->GetLargestPossibleRegion());
+    this->Output->Allocate();
+    }
+  this->Output->FillBuffer(std::numeric_limits<float>::quiet_NaN());
+
+  // Gather the valid target pixels (as offsets from the corner of the patch) and their values.
+  itk::ImageRegion<2> croppedTargetRegion = targetRegion;
+  croppedTargetRegion.Crop(this->Image->GetLargestPossibleRegion());
+
+  std::vector<long> targetOffsetX;
+  std::vector<long> targetOffsetY;
+  std::vector<float> targetValues;
+  const float* buffer = this->Image->GetBufferPointer();
+  itk::ImageRegionConstIteratorWithIndex<Mask> targetIterator(this->MaskImage, croppedTargetRegion);
+  while(!targetIterator.IsAtEnd())
+    {
+    if(this->MaskImage->IsValid(targetIterator.GetIndex()))
+      {
+      targetOffsetX.push_back(targetIterator.GetIndex()[0] - targetRegion.GetIndex()[0]);
+      targetOffsetY.push_back(targetIterator.GetIndex()[1] - targetRegion.GetIndex()[1]);
+      const float* pixel = buffer + this->Image->ComputeOffset(targetIterator.GetIndex()) * components;
+      targetValues.insert(targetValues.end(), pixel, pixel + components);
+      }
+    ++targetIterator;
+    }
+
+  this->MinimumScore = 0;
+  this->MaximumScore = 0;
+  if(targetOffsetX.empty() || width < 2 * radius + 1 || height < 2 * radius + 1)
+    {
+    this->Output->Modified();
+    return;
+    }
+
+  bool useFFT = (stride == 1 && this->ComputeMethod == COMPUTE_FFT);
+  if(stride == 1 && this->ComputeMethod == COMPUTE_AUTOMATIC)
+    {
+    // The direct comparison is a multiply-add per center, valid target pixel and component. Once the spectra of
+    // the image exist, the FFT needs a transform per component plus two.
+    const double directCost = static_cast<double>(width - 2 * radius) * (height - 2 * radius) * targetOffsetX.size() * components;
+    const double fftCost = (components + 2) * GetFFTCost(static_cast<double>(GetFFTSize(width)) * GetFFTSize(height));
+    useFFT = fftCost < directCost;
+    }
+
+  if(useFFT)
+    {
+    ComputeWithFFT(targetOffsetX, targetOffsetY, targetValues);
+    }
+  else
+    {
+    ComputeDirectly(targetOffsetX, targetOffsetY, targetValues, stride);
+    }
+
+  this->Output->Modified();
+}
+
+void ScoreMap::ComputeWithFFT(const std::vector<long>& targetOffsetX, const std::vector<long>& targetOffsetY,
+                              const std::vector<float>& targetValues)
+{
+  if(this->SpectraModified)
+    {
+    ComputeSpectra();
+    }
+
+  const unsigned int components = this->Image->GetNumberOfComponentsPerPixel();
+  itk::Size<2> size = this->Image->GetLargestPossibleRegion().GetSize();
+  const long width = size[0];
+  const long height = size[1];
+  const long radius = this->PatchRadius;
+  const unsigned int rows = this->Spectra[0].rows();
+  const unsigned int columns = this->Spectra[0].cols();
+
+  // The transforms of m*t for each component, and the last one of m.
+  this->TargetSpectra.resize(components + 1);
+  const unsigned int numberOfThreads = Parallel::GetNumberOfThreads(this->NumberOfThreads);
+  std::atomic<unsigned int> nextSpectrum(0);
+  Parallel::ParallelFor(std::min(numberOfThreads, components + 1), [&](unsigned int)
+    {
+    vnl_fft_2d<double> fft(rows, columns);
+    for(unsigned int spectrumId = nextSpectrum++; spectrumId <= components; spectrumId = nextSpectrum++)
+      {
+      SpectrumType& spectrum = this->TargetSpectra[spectrumId];
+      spectrum.set_size(rows, columns);
+      spectrum.fill(vcl_complex<double>(0, 0));
+      for(size_t offsetId = 0; offsetId < targetOffsetX.size(); ++offsetId)
+        {
+        spectrum(targetOffsetY[offsetId], targetOffsetX[offsetId]) =
+          (spectrumId < components) ? targetValues[offsetId * components + spectrumId] : 1.0;
+        }
+      fft.fwd_transform(spectrum);
+      }
+    });
+
+  // The transform of the correlation of s with k is F(s) conj(F(k)), so the transform of
+  // sum_x m(x) |s(c+x)|^2 - 2 sum_x m(x) t(x) . s(c+x) is gathered into the transform of m.
+  SpectrumType& correlation = this->TargetSpectra[components];
+  Parallel::ParallelFor(numberOfThreads, [&](unsigned int threadId)
+    {
+    size_t beginRow = 0;
+    size_t endRow = 0;
+    Parallel::GetChunk(rows, numberOfThreads, threadId, beginRow, endRow);
+    for(size_t row = beginRow; row < endRow; ++row)
+      {
+      for(size_t column = 0; column < columns; ++column)
+        {
+        vcl_complex<double> sum = this->Spectra[components](row, column) * vcl_conj(correlation(row, column));
+        for(unsigned int component = 0; component < components; ++component)
+          {
+          sum -= 2.0 * this->Spectra[component](row, column) * vcl_conj(this->TargetSpectra[component](row, column));
+          }
+        correlation(row, column) = sum;
+        }
+      }
+    });
+
+  vnl_fft_2d<double> fft(rows, columns);
+  fft.bwd_transform(correlation);
+
+  double targetSquares = 0;
+  for(size_t valueId = 0; valueId < targetValues.size(); ++valueId)
+    {
+    targetSquares += static_cast<double>(targetValues[valueId]) * targetValues[valueId];
+    }
+
+  // The backward transform is not normalized. The correlation for the source patch centered at c is at its corner,
+  // c - radius. Rounding can leave a perfect match slightly negative.
+  const double normalization = 1.0 / (static_cast<double>(rows) * columns);
+  float* outputBuffer = this->Output->GetBufferPointer();
+  float minimum = std::numeric_limits<float>::max();
+  float maximum = -std::numeric_limits<float>::max();
+  for(long y = radius; y + radius < height; ++y)
+    {
+    for(long x = radius; x + radius < width; ++x)
+      {
+      if(this->ValidCenters[y * width + x])
+        {
+        const float score = std::max(0.0, correlation(y - radius, x - radius).real() * normalization + targetSquares);
+        outputBuffer[y * width + x] = score;
+        minimum = std::min(minimum, score);
+        maximum = std::max(maximum, score);
+        }
+      }
+    }
+
+  if(minimum <= maximum)
+    {
+    this->MinimumScore = minimum;
+    this->MaximumScore = maximum;
+    }
+}
+
+void ScoreMap::ComputeDirectly(const std::vector<long>& targetOffsetX, const std::vector<long>& targetOffsetY,
+                               const std::vector<float>& targetValues, const unsigned int stride)
+{
+  if(this->ShadowModified)
+    {
+    this->Shadow.SetImage(this->Image, this->PatchRadius, this->NumberOfThreads);
+    this->ShadowModified = false;
+    }
+
+  const unsigned int components = this->Image->GetNumberOfComponentsPerPixel();
+  itk::Size<2> size = this->Image->GetLargestPossibleRegion().GetSize();
+  const long width = size[0];
+  const long height = size[1];
+  const long radius = this->PatchRadius;
+  float* outputBuffer = this->Output->GetBufferPointer();
+
+  // Centers that have a full patch inside the image.
+  const long firstCenter = radius;
+  const long lastCenterX = width - 1 - radius;
+  const long lastCenterY = height - 1 - radius;
+  const long centersPerRow = (lastCenterX - firstCenter) / stride + 1;
+  const long numberOfRows = (lastCenterY - firstCenter) / stride + 1;
+
+  const unsigned int numberOfThreads = Parallel::GetNumberOfThreads(this->NumberOfThreads);
+  std::vector<float> threadMinimum(numberOfThreads, std::numeric_limits<float>::max());
+  std::vector<float> threadMaximum(numberOfThreads, -std::numeric_limits<float>::max());
+  std::atomic<long> nextRow(0);
+
+  Parallel::ParallelFor(numberOfThreads, [&](unsigned int threadId)
+    {
+    std::vector<float> scores(centersPerRow);
+    for(long row = nextRow++; row < numberOfRows; row = nextRow++)
+      {
+      const long centerY = firstCenter + row * stride;
+      std::fill(scores.begin(), scores.end(), 0.0f);
+
+      // Compare one target pixel against the corresponding pixel of every source patch in the row. In each plane
+      // these are every stride'th float of a row.
+      for(size_t offsetId = 0; offsetId < targetOffsetX.size(); ++offsetId)
+        {
+        const itk::Index<2> firstSourcePixel = {{targetOffsetX[offsetId], centerY - radius + targetOffsetY[offsetId]}};
+        const FloatVectorImageType::OffsetValueType sourceOffset = this->Shadow.ComputeOffset(firstSourcePixel);
+        for(unsigned int component = 0; component < components; ++component)
+          {
+          const float* sourcePixels = this->Shadow.GetPlane(component) + sourceOffset;
+          const float targetValue = targetValues[offsetId * components + component];
+          for(long centerId = 0; centerId < centersPerRow; ++centerId)
+            {
+            float difference = sourcePixels[centerId * stride] - targetValue;
+            scores[centerId] += difference * difference;
+            }
+          }
+        }
+
+      // Write the scores of valid centers, filling the stride x stride block of each computed center.
+      for(long centerId = 0; centerId < centersPerRow; ++centerId)
+        {
+        const long centerX = firstCenter + centerId * stride;
+        const float score = scores[centerId];
+        bool used = false;
+        for(long y = centerY; y < std::min(centerY + static_cast<long>(stride), lastCenterY + 1); ++y)
+          {
+          for(long x = centerX; x < std::min(centerX + static_cast<long>(stride), lastCenterX + 1); ++x)
+            {
+            if(this->ValidCenters[y * width + x])
+              {
+              outputBuffer[y * width + x] = score;
+              used = true;
+              }
+            }
+          }
+        if(used)
+          {
+          threadMinimum[threadId] = std::min(threadMinimum[threadId], score);
+          threadMaximum[threadId] = std::max(threadMaximum[threadId], score);
+          }
+        }
+      }
+    });
+
+  float minimum = *std::min_element(threadMinimum.begin(), threadMinimum.end());
+  float maximum = *std::max_element(threadMaximum.begin(), threadMaximum.end());
+  if(minimum <= maximum)
+    {
+    this->MinimumScore = minimum;
+    this->MaximumScore = maximum;
+    }
+}
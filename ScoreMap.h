@@ -0,0 +1,143 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef ScoreMap_H
+#define ScoreMap_H
+
+/*
+ * This class computes the total squared difference between a target patch and the source patch
+ * centered at every pixel of the image, producing an image of scores (NaN where the source patch
+ * is not entirely inside the image and valid).
+ *
+ * There are two ways to get the scores. Writing m for the valid target pixels, t for the target and s for the image,
+ * the score of the source patch at c is
+ *
+ *   sum_x m(x) |s(c+x) - t(x)|^2 = sum_x m(x) |s(c+x)|^2 - 2 sum_x m(x) t(x) . s(c+x) + sum_x m(x) |t(x)|^2
+ *
+ * The first two terms are correlations of the image (its planes, and the sum of their squares) with m and m*t, so
+ * they can be computed for every c at once with Fourier transforms. The transforms of the image only change with the
+ * image, so they are computed once per image; each Compute() then costs one transform per component of m*t, one of m
+ * and one inverse transform, whatever the patch size (COMPUTE_FFT).
+ *
+ * Otherwise each valid target pixel is compared against a whole row of source patches at once, so the inner loop
+ * streams through contiguous memory of a planar copy of the image (see PlanarShadowImage). This costs a multiply-add
+ * per valid target pixel, component and center, so it is cheaper for small patches and for the strided previews
+ * (COMPUTE_DIRECT). The copy is made again only when the image (or the patch radius, which is the width of its
+ * border) changes.
+ *
+ * Either way, the validity of every source patch is found in O(1) per pixel from a summed area table of the hole
+ * pixels, and is kept until the mask or the patch radius changes.
+ */
+
+// Custom
+#include "PlanarShadowImage.h"
+#include "Types.h"
+
+// Submodules
+#include "Mask/Mask.h"
+
+// ITK
+#include "itkImageRegion.h"
+
+// STL
+#include <vector>
+
+// VXL
+#include <vcl_complex.h>
+#include <vnl/vnl_matrix.h>
+
+class ScoreMap
+{
+public:
+  ScoreMap();
+
+  // COMPUTE_AUTOMATIC (the default) uses whichever of the methods described above needs fewer operations. Strided
+  // previews are always computed directly.
+  enum ComputeMethodEnum {COMPUTE_AUTOMATIC, COMPUTE_DIRECT, COMPUTE_FFT};
+  void SetComputeMethod(const ComputeMethodEnum method);
+
+  // The next Compute() prepares what it needs from a new image (its planar copy or transforms) or mask (the valid
+  // centers), so set these when they change rather than before every Compute(). Set the image or the mask again after
+  // changing it in place.
+  void SetImage(FloatVectorImageType::Pointer image);
+  void SetMask(Mask::Pointer mask);
+  void SetPatchRadius(const unsigned int radius);
+
+  // If this is 0 (the default), all hardware threads are used.
+  void SetNumberOfThreads(const unsigned int numberOfThreads);
+
+  // Compute the score of every valid source patch against 'targetRegion'. If 'stride' is larger than 1,
+  // only every stride'th center in each direction is scored, and the score is used for the whole
+  // stride x stride block. This gives a quick preview for a fraction (1/stride^2) of the work.
+  void Compute(const itk::ImageRegion<2>& targetRegion, const unsigned int stride = 1);
+
+  // The score image, the same size as the input image, indexed by source patch center.
+  FloatScalarImageType* GetOutput();
+
+  // The smallest and largest scores of the last Compute(), ignoring NaN.
+  float GetMinimumScore() const;
+  float GetMaximumScore() const;
+
+private:
+  typedef vnl_matrix<vcl_complex<double> > SpectrumType;
+
+  // Determine which pixels are the centers of fully valid source patches.
+  void ComputeValidCenters();
+
+  // Compute the transforms of the planes of Image and of the sum of their squares.
+  void ComputeSpectra();
+
+  // Write the scores of the valid centers into Output, given the valid target pixels (as offsets from the corner of
+  // the patch) and their values. 'stride' is as in Compute().
+  void ComputeDirectly(const std::vector<long>& targetOffsetX, const std::vector<long>& targetOffsetY,
+                       const std::vector<float>& targetValues, const unsigned int stride);
+  void ComputeWithFFT(const std::vector<long>& targetOffsetX, const std::vector<long>& targetOffsetY,
+                      const std::vector<float>& targetValues);
+
+  FloatVectorImageType::Pointer Image;
+  Mask::Pointer MaskImage;
+
+  // The modification time of Image when it was last set.
+  unsigned long ImageTime;
+
+  // The copy of Image that is read by ComputeDirectly().
+  PlanarShadowImage Shadow;
+  bool ShadowModified;
+
+  // The transforms read by ComputeWithFFT(), zero padded to a size vnl_fft_2d can transform: one per component of
+  // Image, and the last one of the sum of the squares of the components.
+  std::vector<SpectrumType> Spectra;
+  bool SpectraModified;
+
+  // The transforms of the target made by each ComputeWithFFT(), kept to avoid allocating them again.
+  std::vector<SpectrumType> TargetSpectra;
+
+  ComputeMethodEnum ComputeMethod;
+  unsigned int PatchRadius;
+  unsigned int NumberOfThreads;
+
+  // Row-major flags: non-zero if the patch centered at the pixel is entirely inside the image and valid.
+  std::vector<unsigned char> ValidCenters;
+  bool ValidCentersModified;
+
+  FloatScalarImageType::Pointer Output;
+  float MinimumScore;
+  float MaximumScore;
+};
+
+#endif
@@ -0,0 +1,119 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef ScratchArena_H
+#define ScratchArena_H
+
+/*
+ * A bump allocator for temporary buffers that all die at the same time (e.g. at the end of an iteration).
+ * Allocate() hands out consecutive pieces of one block, and Reset() makes the whole block available again.
+ * If a block runs out, another one is added; at the next Reset() they are merged into a single block big
+ * enough for everything, so once the largest iteration has been seen nothing is allocated from the heap.
+ *
+ * Only use this for trivially destructible types: no destructors are ever called.
+ */
+
+// STL
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+class ScratchArena
+{
+public:
+  ScratchArena() : Capacity(0), Used(0), OverflowSize(0) {}
+
+  // Get uninitialized space for 'count' objects of type T.
+  template <typename T>
+  T* Allocate(const size_t count)
+  {
+    return static_cast<T*>(AllocateBytes(count * sizeof(T)));
+  }
+
+  // Release everything allocated since the last Reset().
+  void Reset()
+  {
+    if(!this->Overflow.empty())
+      {
+      this->Overflow.clear();
+      Reserve(this->Capacity + this->OverflowSize);
+      this->OverflowSize = 0;
+      }
+    this->Used = 0;
+  }
+
+  // Make sure at least 'bytes' can be allocated without touching the heap. Only call this when nothing
+  // is allocated (e.g. right after Reset()), because the existing block may be replaced.
+  void Reserve(const size_t bytes)
+  {
+    if(bytes > this->Capacity)
+      {
+      this->Block.reset(new char[bytes]);
+      this->Capacity = bytes;
+      this->Used = 0;
+      }
+  }
+
+  // Free all of the memory.
+  void Release()
+  {
+    this->Overflow.clear();
+    this->OverflowSize = 0;
+    this->Block.reset();
+    this->Capacity = 0;
+    this->Used = 0;
+  }
+
+  size_t GetCapacity() const
+  {
+    return this->Capacity;
+  }
+
+private:
+  ScratchArena(const ScratchArena&); // Not implemented
+  void operator=(const ScratchArena&); // Not implemented
+
+  // Every allocation starts on a boundary suitable for any scalar type (and SSE loads).
+  static const size_t Alignment = 16;
+
+  void* AllocateBytes(const size_t bytes)
+  {
+    const size_t alignedBytes = (bytes + Alignment - 1) & ~(Alignment - 1);
+    if(this->Used + alignedBytes <= this->Capacity)
+      {
+      void* pointer = this->Block.get() + this->Used;
+      this->Used += alignedBytes;
+      return pointer;
+      }
+
+    // The block is full. Earlier pointers must stay valid, so use a separate block until the next Reset().
+    this->Overflow.push_back(std::unique_ptr<char[]>(new char[alignedBytes]));
+    this->OverflowSize += alignedBytes;
+    return this->Overflow.back().get();
+  }
+
+  // 'new char[]' is aligned for any fundamental type, which covers Alignment on the platforms we build for.
+  std::unique_ptr<char[]> Block;
+  size_t Capacity;
+  size_t Used;
+
+  std::vector<std::unique_ptr<char[]> > Overflow;
+  size_t OverflowSize;
+};
+
+#endif
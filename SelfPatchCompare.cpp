@@ -22,15 +22,45 @@
 #include "Helpers/Helpers.h"
 #include "ITKHelpers/ITKHelpers.h"
 
+// ITK
+#include "itkImageRegionConstIteratorWithIndex.h"
+
+// STL
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
 // Custom
+#include "Parallel.h"
 #include "Patch.h"
+#include "RadixSort.h"
 #include "Types.h"
 
-SelfPatchCompare::SelfPatchCompare(const unsigned int components)
+SelfPatchCompare::SelfPatchCompare() : StopRequested(false)
+{
+  this->NumberOfComponentsPerPixel = 0;
+  this->NumberOfPixelsCompared = 0;
+  this->NumberOfThreads = 0;
+  this->NumberOfSnapshots = 0;
+  this->NumberOfPartialResults = 10;
+  this->PublishInterval = 100;
+  this->Shadow = &this->OwnShadow;
+  this->OwnShadowValid = false;
+  this->ShadowTime = 0;
+}
+
+SelfPatchCompare::SelfPatchCompare(const unsigned int components) : StopRequested(false)
 {
   this->NumberOfComponentsPerPixel = components;
   
   this->NumberOfPixelsCompared = 0;
+  this->NumberOfThreads = 0;
+  this->NumberOfSnapshots = 0;
+  this->NumberOfPartialResults = 10;
+  this->PublishInterval = 100;
+  this->Shadow = &this->OwnShadow;
+  this->OwnShadowValid = false;
+  this->ShadowTime = 0;
 }
 
 void SelfPatchCompare::ComputeSourcePatches()
@@ -39,7 +69,7 @@ void SelfPatchCompare::ComputeSourcePatches()
   
   std::cout << "ComputeSourcePatches() with patch size: " << this->TargetRegion.GetSize() << std::endl;
   
-  this->SourcePatches.clear();
+  ClearSourcePatches();
   itk::ImageRegionConstIterator<FloatVectorImageType> imageIterator(this->Image, this->Image->GetLargestPossibleRegion());
 
   while(!imageIterator.IsAtEnd())
@@ -51,7 +81,7 @@ void SelfPatchCompare::ComputeSourcePatches()
       {
       if(this->MaskImage->IsValid(region))
 	{
-	this->SourcePatches.push_back(Patch(region));
+	AddSourcePatch(region);
 	//DebugMessage("Added a source patch.");
 	}
       }
@@ -62,6 +92,60 @@ void SelfPatchCompare::ComputeSourcePatches()
   
 }
 
+void SelfPatchCompare::ClearSourcePatches()
+{
+  this->SourcePatches.clear();
+  this->SourcePatchCorners.assign(this->Image->GetLargestPossibleRegion().GetNumberOfPixels(), 0);
+}
+
+bool SelfPatchCompare::AddSourcePatch(const itk::ImageRegion<2>& region)
+{
+  return AddSourcePatch(Patch(region));
+}
+
+bool SelfPatchCompare::AddSourcePatch(const Patch& patch)
+{
+  if(!this->Image->GetLargestPossibleRegion().IsInside(patch.Region))
+    {
+    return false;
+    }
+
+  // If the patches were not cleared since an image of another size was set, they (and their corners) belong to that image.
+  if(this->SourcePatchCorners.size() != this->Image->GetLargestPossibleRegion().GetNumberOfPixels())
+    {
+    ClearSourcePatches();
+    }
+
+  unsigned char& added = this->SourcePatchCorners[this->Image->ComputeOffset(patch.Region.GetIndex())];
+  if(added)
+    {
+    return false;
+    }
+  added = 1;
+  this->SourcePatches.push_back(patch);
+  return true;
+}
+
+bool SelfPatchCompare::IsSourcePatch(const itk::ImageRegion<2>& region) const
+{
+  if(this->SourcePatchCorners.size() != this->Image->GetLargestPossibleRegion().GetNumberOfPixels() ||
+     !this->Image->GetLargestPossibleRegion().IsInside(region.GetIndex()))
+    {
+    return false;
+    }
+  return this->SourcePatchCorners[this->Image->ComputeOffset(region.GetIndex())] != 0;
+}
+
+const std::vector<Patch>& SelfPatchCompare::GetSourcePatches() const
+{
+  return this->SourcePatches;
+}
+
+void SelfPatchCompare::SortSourcePatches(float Patch::*score)
+{
+  SortPatchesByScore(this->SourcePatches, score);
+}
+
 void SelfPatchCompare::SetNumberOfComponentsPerPixel(const unsigned int value)
 {
   this->NumberOfComponentsPerPixel = value;
@@ -81,7 +165,60 @@ bool SelfPatchCompare::IsReady()
 
 void SelfPatchCompare::SetImage(FloatVectorImageType::Pointer image)
 {
+  if(image != this->Image)
+    {
+    this->OwnShadowValid = false;
+    }
   this->Image = image;
+  this->Shadow = &this->OwnShadow;
+}
+
+void SelfPatchCompare::UpdateShadow()
+{
+  if(this->Shadow != &this->OwnShadow || !this->Image)
+    {
+    return;
+    }
+  if(!this->OwnShadowValid || this->Image->GetMTime() != this->ShadowTime)
+    {
+    this->OwnShadow.SetImage(this->Image, 0, this->NumberOfThreads);
+    this->OwnShadowValid = true;
+    this->ShadowTime = this->Image->GetMTime();
+    }
+}
+
+void SelfPatchCompare::SetImage(FloatVectorImageType::Pointer image, const PlanarShadowImage* shadow)
+{
+  if(image && (!shadow || shadow->GetRegion() != image->GetLargestPossibleRegion() ||
+                shadow->GetNumberOfComponents() != image->GetNumberOfComponentsPerPixel()))
+    {
+    std::cerr << "SelfPatchCompare::SetImage: the shared copy is not a copy of this image, so the image will be copied again." << std::endl;
+    SetImage(image);
+    return;
+    }
+  // Changes made to the image while the shared copy is used are not made to OwnShadow.
+  this->OwnShadowValid = false;
+  this->Image = image;
+  this->Shadow = shadow;
+}
+
+const PlanarShadowImage* SelfPatchCompare::GetShadow()
+{
+  UpdateShadow();
+  return this->Shadow;
+}
+
+void SelfPatchCompare::UpdateImage(const itk::ImageRegion<2>& region)
+{
+  if(this->Shadow != &this->OwnShadow)
+    {
+    std::cerr << "SelfPatchCompare::UpdateImage: the copy of the image is shared, so it cannot be updated!" << std::endl;
+    return;
+    }
+  if(this->OwnShadowValid)
+    {
+    this->OwnShadow.Update(this->Image, region);
+    }
 }
 
 void SelfPatchCompare::SetMask(Mask::Pointer mask)
@@ -303,28 +440,355 @@ float SelfPatchCompare::SlowAverageSquaredDifference(const itk::ImageRegion<2>&
   return averageSquaredDifferences;
 }
 
+void SelfPatchCompare::ComputeOffsets()
+{
+  UpdateShadow();
+  ComputeOffsets(this->TargetRegion, true, this->ValidOffsets);
+  this->NumberOfPixelsCompared = this->ValidOffsets.size();
+}
+
+void SelfPatchCompare::ComputeOffsets(const itk::ImageRegion<2>& targetRegion, std::vector<FloatVectorImageType::OffsetValueType>& validOffsets) const
+{
+  ComputeOffsets(targetRegion, false, validOffsets);
+}
+
+void SelfPatchCompare::ComputeOffsets(const itk::ImageRegion<2>& targetRegion, const bool inShadow,
+                                      std::vector<FloatVectorImageType::OffsetValueType>& validOffsets) const
+{
+  validOffsets.clear();
+
+  // Only the part of the target region that is inside the image can be compared.
+  itk::ImageRegion<2> croppedTargetRegion = targetRegion;
+  if(!croppedTargetRegion.Crop(this->Image->GetLargestPossibleRegion()))
+    {
+    return;
+    }
+
+  FloatVectorImageType::OffsetValueType cornerOffset = inShadow ? this->Shadow->ComputeOffset(targetRegion.GetIndex()) :
+                                                                   this->Image->ComputeOffset(targetRegion.GetIndex());
+
+  itk::ImageRegionConstIteratorWithIndex<Mask> maskIterator(this->MaskImage, croppedTargetRegion);
+
+  while(!maskIterator.IsAtEnd())
+    {
+    if(this->MaskImage->IsValid(maskIterator.GetIndex()))
+      {
+      const itk::Index<2>& pixel = maskIterator.GetIndex();
+      validOffsets.push_back((inShadow ? this->Shadow->ComputeOffset(pixel) : this->Image->ComputeOffset(pixel)) - cornerOffset);
+      }
+    ++maskIterator;
+    }
+}
+
+bool SelfPatchCompare::ComputeAllScores(Patch& patch) const
+{
+  // This function assumes that all pixels in the source region are unmasked and inside the image.
+
+  if(this->ValidOffsets.empty())
+    {
+    return false;
+    }
+  const float numberOfPixelsCompared = static_cast<float>(this->ValidOffsets.size());
+
+  const FloatVectorImageType::OffsetValueType sourceCornerOffset = this->Shadow->ComputeOffset(patch.Region.GetIndex());
+  const FloatVectorImageType::OffsetValueType targetCornerOffset = this->Shadow->ComputeOffset(this->TargetRegion.GetIndex());
+  const unsigned int components = this->Shadow->GetNumberOfComponents();
+  const FloatVectorImageType::OffsetValueType* validOffsets = &this->ValidOffsets[0];
+  const unsigned int numberOfOffsets = this->ValidOffsets.size();
+
+  float sumDifferences = 0;
+  float sumSquaredDifferences = 0;
+
+  // One plane at a time, so the inner loop only reads two streams of plain floats.
+  for(unsigned int component = 0; component < components; ++component)
+    {
+    const float* source = this->Shadow->GetPlane(component) + sourceCornerOffset;
+    const float* target = this->Shadow->GetPlane(component) + targetCornerOffset;
+    for(unsigned int i = 0; i < numberOfOffsets; ++i)
+      {
+      float difference = source[validOffsets[i]] - target[validOffsets[i]];
+      sumDifferences += fabs(difference);
+      sumSquaredDifferences += difference * difference;
+      }
+    }
+
+  patch.TotalAbsoluteScore = sumDifferences;
+  patch.AverageAbsoluteScore = sumDifferences / numberOfPixelsCompared;
+  patch.TotalSquaredScore = sumSquaredDifferences;
+  patch.AverageSquaredScore = sumSquaredDifferences / numberOfPixelsCompared;
+
+  return true;
+}
+
+unsigned int SelfPatchCompare::FindBestPatch()
+{
+  return FindBestPatch(this->TargetRegion, this->SearchOffsets);
+}
+
+unsigned int SelfPatchCompare::FindBestPatch(const itk::ImageRegion<2>& targetRegion, std::vector<FloatVectorImageType::OffsetValueType>& validOffsets) const
+{
+  ComputeOffsets(targetRegion, validOffsets);
+
+  const FloatVectorImageType::OffsetValueType targetCornerOffset = this->Image->ComputeOffset(targetRegion.GetIndex());
+
+  unsigned int bestPatchId = 0;
+  float bestScore = std::numeric_limits<float>::max();
+  for(unsigned int patchId = 0; patchId < this->SourcePatches.size(); ++patchId)
+    {
+    const FloatVectorImageType::OffsetValueType sourceCornerOffset = this->Image->ComputeOffset(this->SourcePatches[patchId].Region.GetIndex());
+    float score = ComputeSquaredDifference(sourceCornerOffset, targetCornerOffset, validOffsets, bestScore);
+    if(score < bestScore)
+      {
+      bestScore = score;
+      bestPatchId = patchId;
+      }
+    }
+
+  return bestPatchId;
+}
+
+bool SelfPatchCompare::FindBestPatchInWindow(const itk::ImageRegion<2>& targetRegion,
+                                             const std::vector<FloatVectorImageType::OffsetValueType>& validOffsets,
+                                             const itk::ImageRegion<2>& inputCornerWindow, float& bestScore, itk::ImageRegion<2>& bestRegion) const
+{
+  itk::ImageRegion<2> cornerWindow = inputCornerWindow;
+  if(this->SourcePatchCorners.size() != this->Image->GetLargestPossibleRegion().GetNumberOfPixels() ||
+     !cornerWindow.Crop(this->Image->GetLargestPossibleRegion()))
+    {
+    return false;
+    }
+
+  const FloatVectorImageType::OffsetValueType targetCornerOffset = this->Image->ComputeOffset(targetRegion.GetIndex());
+
+  bool found = false;
+  for(unsigned int row = 0; row < cornerWindow.GetSize()[1]; ++row)
+    {
+    itk::Index<2> corner = {{cornerWindow.GetIndex()[0], cornerWindow.GetIndex()[1] + row}};
+    FloatVectorImageType::OffsetValueType cornerOffset = this->Image->ComputeOffset(corner);
+    for(unsigned int column = 0; column < cornerWindow.GetSize()[0]; ++column, ++cornerOffset)
+      {
+      if(!this->SourcePatchCorners[cornerOffset])
+        {
+        continue;
+        }
+      float score = ComputeSquaredDifference(cornerOffset, targetCornerOffset, validOffsets, bestScore);
+      if(score < bestScore)
+        {
+        bestScore = score;
+        corner[0] = cornerWindow.GetIndex()[0] + column;
+        bestRegion = itk::ImageRegion<2>(corner, targetRegion.GetSize());
+        found = true;
+        }
+      }
+    }
+  return found;
+}
+
+bool SelfPatchCompare::FindBestPatchInRing(const itk::ImageRegion<2>& targetRegion,
+                                           const std::vector<FloatVectorImageType::OffsetValueType>& validOffsets,
+                                           const itk::Index<2>& center, const unsigned int innerRadius, const unsigned int outerRadius,
+                                           float& bestScore, itk::ImageRegion<2>& bestRegion) const
+{
+  if(outerRadius <= innerRadius)
+    {
+    return false;
+    }
+
+  // The ring is a strip above and below the inner square (as wide as the outer square), and one on each side of it.
+  const long outer = outerRadius;
+  const long inner = innerRadius;
+  const itk::SizeValueType ringWidth = outerRadius - innerRadius;
+  const itk::SizeValueType outerWidth = 2 * outerRadius + 1;
+  const itk::SizeValueType innerWidth = 2 * innerRadius + 1;
+  itk::Index<2> corners[4] = {{{center[0] - outer, center[1] - outer}}, {{center[0] - outer, center[1] + inner + 1}},
+                              {{center[0] - outer, center[1] - inner}}, {{center[0] + inner + 1, center[1] - inner}}};
+  itk::Size<2> sizes[4] = {{{outerWidth, ringWidth}}, {{outerWidth, ringWidth}},
+                           {{ringWidth, innerWidth}}, {{ringWidth, innerWidth}}};
+
+  bool found = false;
+  for(unsigned int i = 0; i < 4; ++i)
+    {
+    if(FindBestPatchInWindow(targetRegion, validOffsets, itk::ImageRegion<2>(corners[i], sizes[i]), bestScore, bestRegion))
+      {
+      found = true;
+      }
+    }
+  return found;
+}
+
+float SelfPatchCompare::ComputeSquaredDifference(const FloatVectorImageType::OffsetValueType sourceCornerOffset,
+                                                 const FloatVectorImageType::OffsetValueType targetCornerOffset,
+                                                 const std::vector<FloatVectorImageType::OffsetValueType>& validOffsets, const float bestScore) const
+{
+  // This reads the image rather than the planes, which BenchmarkSearchKernels measures to be faster (see the top of the header).
+  const FloatVectorImageType::InternalPixelType* buffer = this->Image->GetBufferPointer();
+  const unsigned int components = this->Image->GetNumberOfComponentsPerPixel();
+
+  // Stop adding up a patch as soon as it can no longer be the best.
+  float score = 0;
+  for(unsigned int i = 0; i < validOffsets.size() && score < bestScore; ++i)
+    {
+    const float* sourcePixel = buffer + (sourceCornerOffset + validOffsets[i]) * components;
+    const float* targetPixel = buffer + (targetCornerOffset + validOffsets[i]) * components;
+    for(unsigned int component = 0; component < components; ++component)
+      {
+      float difference = sourcePixel[component] - targetPixel[component];
+      score += difference * difference;
+      }
+    }
+  return score;
+}
+
+void SelfPatchCompare::SetNumberOfThreads(const unsigned int numberOfThreads)
+{
+  this->NumberOfThreads = numberOfThreads;
+}
+
+void SelfPatchCompare::SetNumberOfPartialResults(const unsigned int numberOfPartialResults)
+{
+  this->NumberOfPartialResults = numberOfPartialResults;
+}
+
+void SelfPatchCompare::SetPublishInterval(const unsigned int milliseconds)
+{
+  this->PublishInterval = milliseconds;
+}
+
+void SelfPatchCompare::RequestStop()
+{
+  this->StopRequested = true;
+}
+
+void SelfPatchCompare::ClearStopRequest()
+{
+  this->StopRequested = false;
+}
+
+bool SelfPatchCompare::IsStopRequested() const
+{
+  return this->StopRequested;
+}
+
+void SelfPatchCompare::GetPartialResults(std::vector<Patch>& patches)
+{
+  patches.clear();
+
+  std::lock_guard<std::mutex> lock(this->SnapshotMutex);
+  for(unsigned int i = 0; i < this->NumberOfSnapshots; ++i)
+    {
+    this->Snapshots[i].Update();
+    const std::vector<Patch>& snapshot = this->Snapshots[i].GetFront();
+    patches.insert(patches.end(), snapshot.begin(), snapshot.end());
+    }
+
+  PatchScoreComparison comparison(&Patch::TotalAbsoluteScore);
+  std::sort(patches.begin(), patches.end(), comparison);
+  if(patches.size() > this->NumberOfPartialResults)
+    {
+    patches.resize(this->NumberOfPartialResults);
+    }
+}
+
 void SelfPatchCompare::ComputePatchScores()
 {
   ComputeSourcePatches();
-  for(unsigned int i = 0; i < this->SourcePatches.size(); ++i)
+  ComputeOffsets();
+
+  if(this->NumberOfPixelsCompared == 0)
     {
-    float totalAbsoluteScore = SlowTotalAbsoluteDifference(this->SourcePatches[i].Region);
-    float averageAbsoluteScore = SlowAverageAbsoluteDifference(this->SourcePatches[i].Region);
-    float totalSquaredScore = SlowTotalSquaredDifference(this->SourcePatches[i].Region);
-    float averageSquaredScore = SlowAverageSquaredDifference(this->SourcePatches[i].Region);
-  
-    if(this->NumberOfPixelsCompared == 0)
+    std::cerr << "No pixels were compared!" << std::endl;
+    return;
+    }
+
+  const unsigned int numberOfThreads = Parallel::GetNumberOfThreads(this->NumberOfThreads);
+  const unsigned int numberOfPartialResults = this->NumberOfPartialResults;
+
+  // Allocate the snapshot buffers up front, so that publishing does not allocate.
+  {
+  std::lock_guard<std::mutex> lock(this->SnapshotMutex);
+  this->Snapshots.reset(new PatchSnapshotBuffer[numberOfThreads]);
+  this->NumberOfSnapshots = numberOfThreads;
+  for(unsigned int threadId = 0; threadId < numberOfThreads; ++threadId)
+    {
+    for(unsigned int i = 0; i < 3; ++i)
+      {
+      this->Snapshots[threadId].GetBuffer(i).reserve(numberOfPartialResults);
+      }
+    }
+  }
+
+  // Threads take blocks of patches until there are none left (or a stop is requested).
+  const size_t BlockSize = 4096;
+  const size_t numberOfPatches = this->SourcePatches.size();
+  const size_t numberOfBlocks = (numberOfPatches + BlockSize - 1) / BlockSize;
+  std::vector<unsigned char> blockScored(numberOfBlocks, 0);
+  std::atomic<size_t> nextBlock(0);
+
+  Parallel::ParallelFor(numberOfThreads, [&](unsigned int threadId)
+    {
+    PatchSnapshotBuffer& snapshot = this->Snapshots[threadId];
+    PatchScoreComparison comparison(&Patch::TotalAbsoluteScore);
+
+    // The best patches this thread has seen, as a max-heap (the worst of them is at the front).
+    std::vector<Patch> best;
+    best.reserve(numberOfPartialResults + 1);
+
+    std::chrono::steady_clock::time_point lastPublish = std::chrono::steady_clock::now();
+
+    for(size_t block = nextBlock++; block < numberOfBlocks && !this->StopRequested; block = nextBlock++)
       {
-      std::cerr << "No pixels were compared!" << std::endl;
-      return;
+      size_t end = std::min(numberOfPatches, (block + 1) * BlockSize);
+      for(size_t i = block * BlockSize; i < end; ++i)
+        {
+        Patch& patch = this->SourcePatches[i];
+        ComputeAllScores(patch);
+        patch.Id = i;
+
+        if(best.size() < numberOfPartialResults)
+          {
+          best.push_back(patch);
+          std::push_heap(best.begin(), best.end(), comparison);
+          }
+        else if(numberOfPartialResults > 0 && comparison(patch, best.front()))
+          {
+          std::pop_heap(best.begin(), best.end(), comparison);
+          best.back() = patch;
+          std::push_heap(best.begin(), best.end(), comparison);
+          }
+        }
+      blockScored[block] = 1;
+
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if(std::chrono::duration_cast<std::chrono::milliseconds>(now - lastPublish).count() >= static_cast<long>(this->PublishInterval))
+        {
+        snapshot.GetBack() = best;
+        snapshot.Publish();
+        lastPublish = now;
+        }
       }
 
-    this->SourcePatches[i].TotalAbsoluteScore = totalAbsoluteScore;
-    this->SourcePatches[i].AverageAbsoluteScore = averageAbsoluteScore;
-    this->SourcePatches[i].TotalSquaredScore = totalSquaredScore;
-    this->SourcePatches[i].AverageSquaredScore = averageSquaredScore;
-    this->SourcePatches[i].Id = i;
+    snapshot.GetBack() = best;
+    snapshot.Publish();
+    });
+
+  // If we were stopped early, only keep the patches that were scored.
+  if(this->StopRequested)
+    {
+    size_t numberOfScoredPatches = 0;
+    for(size_t i = 0; i < numberOfPatches; ++i)
+      {
+      if(blockScored[i / BlockSize])
+        {
+        this->SourcePatches[numberOfScoredPatches++] = this->SourcePatches[i];
+        }
+      else
+        {
+        this->SourcePatchCorners[this->Image->ComputeOffset(this->SourcePatches[i].Region.GetIndex())] = 0;
+        }
+      }
+    this->SourcePatches.resize(numberOfScoredPatches);
+    std::cout << "Stopped after scoring " << numberOfScoredPatches << " of " << numberOfPatches << " source patches." << std::endl;
     }
-    
-  std::sort(this->SourcePatches.begin(), this->SourcePatches.end(), SortByTotalAbsoluteScore);
+
+  SortPatchesByScore(this->SourcePatches, &Patch::TotalAbsoluteScore);
 }
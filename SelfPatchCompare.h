@@ -24,11 +24,25 @@
  * that are entirely valid, and you want to compare them all to a target patch
  * that is partially masked. It computes the linear offsets of the masked pixels
  * once, and then uses them to do all of the patch comparisons.
+ *
+ * ComputeAllScores() reads a planar copy of the image (see PlanarShadowImage). The copy is only made
+ * when it is first needed (by ComputeOffsets() or GetShadow()) after SetImage() is given a new (or
+ * modified) image. Once it exists, if pixels of the image are changed in place, UpdateImage() must be
+ * told which ones. Objects that compare patches of the same image on several threads can share one
+ * copy instead (see SetImage(image, shadow)).
+ *
+ * The searches (FindBestPatch() and the others) read the image itself, so they never make the copy.
+ * They stop adding up a patch as soon as it can no longer be the best, after every pixel. Measured with
+ * BenchmarkSearchKernels, that is 2-5 times faster than reading the planes (checking the bound once
+ * per row, either over the valid pixels or over whole rows with a border), because most patches are
+ * rejected after a few pixels.
  */
 
 // Custom
 #include "Mask/Mask.h"
 #include "Patch.h"
+#include "PlanarShadowImage.h"
+#include "TripleBuffer.h"
 #include "Types.h"
 
 // Submodules
@@ -38,25 +52,57 @@
 #include "itkImageRegion.h"
 
 // STL
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 class SelfPatchCompare
 {
   
 public:
-  SelfPatchCompare()
-  {
-    this->NumberOfComponentsPerPixel = 0;
-  }
+  SelfPatchCompare();
   
   SelfPatchCompare(const unsigned int);
   
   void SetNumberOfComponentsPerPixel(const unsigned int);
   
-  //unsigned int FindBestPatch();
-
+  // Find the source patch with the smallest total squared difference to the target region, and return its index in SourcePatches.
+  // This runs on the calling thread and, once SearchOffsets has grown to the size of a patch, does not allocate.
+  unsigned int FindBestPatch();
+
+  // The same search for any target region, using 'validOffsets' instead of the members for its working space.
+  // This does not modify the object, so several targets can be searched at once from different threads.
+  unsigned int FindBestPatch(const itk::ImageRegion<2>& targetRegion, std::vector<FloatVectorImageType::OffsetValueType>& validOffsets) const;
+
+  // Search only the source patches whose corners are in 'cornerWindow', using 'validOffsets' from ComputeOffsets().
+  // A patch is only taken if its total squared difference is below 'bestScore', which is then lowered to it, so
+  // several windows can be searched in turn for the best patch in any of them. Returns true if a patch was taken.
+  bool FindBestPatchInWindow(const itk::ImageRegion<2>& targetRegion, const std::vector<FloatVectorImageType::OffsetValueType>& validOffsets,
+                             const itk::ImageRegion<2>& cornerWindow, float& bestScore, itk::ImageRegion<2>& bestRegion) const;
+
+  // The same search among the source patches whose corners are within 'outerRadius' of 'center' but not within
+  // 'innerRadius' of it, so a growing window can be searched one ring at a time. The corners are looked up in
+  // SourcePatchCorners, so the cost depends on the area of the ring and not on the number of source patches.
+  bool FindBestPatchInRing(const itk::ImageRegion<2>& targetRegion, const std::vector<FloatVectorImageType::OffsetValueType>& validOffsets,
+                           const itk::Index<2>& center, const unsigned int innerRadius, const unsigned int outerRadius,
+                           float& bestScore, itk::ImageRegion<2>& bestRegion) const;
+
+  // Set the image. It is copied for ComputeAllScores() when that is first needed, unless it is the image already copied
+  // and it has not been modified since.
   void SetImage(FloatVectorImageType::Pointer);
 
+  // Set the image, and compare patches in 'shadow' (a copy of it, e.g. from GetShadow() of another object that compares
+  // patches of the same image) instead of copying it again. The shadow must not change or be destroyed while it is used.
+  void SetImage(FloatVectorImageType::Pointer, const PlanarShadowImage* shadow);
+
+  // The copy of the image ComputeAllScores() reads. It is made now if it was not yet.
+  const PlanarShadowImage* GetShadow();
+
+  // The pixels of the image in 'region' were changed (e.g. a patch was copied into them): copy them for the comparisons again.
+  // This does nothing if the copy was not made yet, and cannot be used with a shared copy.
+  void UpdateImage(const itk::ImageRegion<2>& region);
+
   void SetMask(Mask::Pointer mask);
 
   void SetTargetRegion(const itk::ImageRegion<2>&);
@@ -70,25 +116,87 @@ public:
   bool IsReady();
   
   void ComputeSourcePatches();
+
+  // Remove all source patches. The image must be set, because the patches are remembered by their position in it.
+  void ClearSourcePatches();
+
+  // Add a fully valid source region, unless it was already added (or is not inside the image). Returns true if it was added.
+  // Patches can be added at any time between searches (e.g. as the hole is filled and new regions become valid).
+  bool AddSourcePatch(const itk::ImageRegion<2>& region);
+
+  // The same, keeping the scores the patch already has (e.g. when it was loaded from a ScoreCache).
+  bool AddSourcePatch(const Patch& patch);
+
+  // Determine if a region has been added as a source patch.
+  bool IsSourcePatch(const itk::ImageRegion<2>& region) const;
   
   float PixelDifference(const VectorType &a, const VectorType &b);
   float PixelSquaredDifference(const VectorType &a, const VectorType &b);
   
+  // Score all of the source patches (using several threads) and sort them by total absolute score.
+  // While this runs, GetPartialResults() can be called from another thread to see the best patches found so far,
+  // and RequestStop() can be called to finish early with only the patches that have been scored.
   void ComputePatchScores();
+
+  // The number of threads ComputePatchScores() uses. If this is 0 (the default), all hardware threads are used.
+  void SetNumberOfThreads(const unsigned int);
+
+  // How many of the best patches each thread publishes, and how often (in milliseconds).
+  void SetNumberOfPartialResults(const unsigned int);
+  void SetPublishInterval(const unsigned int);
+
+  // Get the best patches published so far by the threads of ComputePatchScores(), sorted by total absolute score.
+  void GetPartialResults(std::vector<Patch>& patches);
+
+  // Ask ComputePatchScores() to stop at the next block of patches. A request made before ComputePatchScores() starts
+  // is kept (so a stop cannot be lost while the scoring thread is starting) until ClearStopRequest() is called.
+  void RequestStop();
+  void ClearStopRequest();
+  bool IsStopRequested() const;
+
+  // Compute the offsets of the valid pixels of the target region. This must be called after the target region,
+  // image and mask are set, and before ComputeAllScores().
+  void ComputeOffsets();
+
+  // Compute the offsets (in the image) of the valid pixels of any target region into 'validOffsets', for FindBestPatchInWindow()
+  // and FindBestPatchInRing().
+  void ComputeOffsets(const itk::ImageRegion<2>& targetRegion, std::vector<FloatVectorImageType::OffsetValueType>& validOffsets) const;
+
+  // Compute all four scores of a source patch in a single pass over the offsets computed by ComputeOffsets().
+  // Returns false if no pixels were compared. This does not modify the object, so it can be called from several threads.
+  bool ComputeAllScores(Patch& patch) const;
   
-  // These are the fully valid source regions
-  std::vector<Patch> SourcePatches;
-  
-  //std::vector<Patch>& GetSourcePatches();
+  // These are the fully valid source regions. Use ClearSourcePatches() and AddSourcePatch() to change them.
+  const std::vector<Patch>& GetSourcePatches() const;
+
+  // Sort the source patches by one of their scores, e.g. &Patch::AverageSquaredScore.
+  void SortSourcePatches(float Patch::*score);
   
 protected:
+  // Make OwnShadow a copy of Image, unless it is one already (or a shared copy is used).
+  void UpdateShadow();
+
+  // Compute the offsets of the valid pixels of a target region, either in the image or in Shadow.
+  void ComputeOffsets(const itk::ImageRegion<2>& targetRegion, const bool inShadow,
+                      std::vector<FloatVectorImageType::OffsetValueType>& validOffsets) const;
+
+  // The total squared difference between the valid pixels of the patches with these corners (pixel offsets in Image),
+  // or a partial sum of at least 'bestScore' as soon as the patch can no longer beat it.
+  float ComputeSquaredDifference(const FloatVectorImageType::OffsetValueType sourceCornerOffset,
+                                 const FloatVectorImageType::OffsetValueType targetCornerOffset,
+                                 const std::vector<FloatVectorImageType::OffsetValueType>& validOffsets, const float bestScore) const;
+
   // If a channel of one pixel was white (255) and the corresponding channel of the other pixel
   // was black (0), the difference would be 255, so the difference squared would be 255*255
   //static const float MaxColorDifference = 255*255; // Doesn't work with c++0x
   static float MaxColorDifference() { return 255.0f*255.0f; }
   
-  // These are the offsets of the target region which we with to compare
-  //std::vector<FloatVectorImageType::OffsetValueType> ValidOffsets;
+  // These are the offsets of the target region which we with to compare. They are linear pixel offsets (in Shadow)
+  // from the corner of the region, so the same offset can be used for the target and any source region.
+  std::vector<FloatVectorImageType::OffsetValueType> ValidOffsets;
+
+  // The same offsets in Image, for FindBestPatch().
+  std::vector<FloatVectorImageType::OffsetValueType> SearchOffsets;
 
   // This is the target region we wish to compare. It may be partially invalid.
   itk::ImageRegion<2> TargetRegion;
@@ -96,6 +204,15 @@ protected:
   // This is the image from which to take the patches
   FloatVectorImageType::Pointer Image;
 
+  // The copy of Image that ComputeAllScores() reads. This is OwnShadow unless a shared copy was given to SetImage().
+  const PlanarShadowImage* Shadow;
+
+  // The copy this object makes, whether it is a copy of Image, and the modification time of Image when it was made.
+  // The patches are always inside the image (and the target pixels outside it are not compared), so it has no border.
+  PlanarShadowImage OwnShadow;
+  bool OwnShadowValid;
+  unsigned long ShadowTime;
+
   // This is the mask to check the validity of target pixels
   Mask::Pointer MaskImage;
 
@@ -103,6 +220,27 @@ protected:
   
   unsigned int NumberOfPixelsCompared;
 
+  unsigned int NumberOfThreads;
+
+  // Each thread of ComputePatchScores() publishes its current best patches through its own triple buffer,
+  // so publishing never blocks. The mutex is only taken by readers and when the buffers are (re)allocated.
+  typedef TripleBuffer<std::vector<Patch> > PatchSnapshotBuffer;
+  std::unique_ptr<PatchSnapshotBuffer[]> Snapshots;
+  unsigned int NumberOfSnapshots;
+  std::mutex SnapshotMutex;
+
+  unsigned int NumberOfPartialResults;
+  unsigned int PublishInterval;
+  std::atomic<bool> StopRequested;
+
+private:
+  // The fully valid source regions, and a non-zero value at the offset (in Image) of the corner of each of them.
+  // They are only changed together (by ClearSourcePatches() and AddSourcePatch()) so they always agree.
+  std::vector<Patch> SourcePatches;
+  std::vector<unsigned char> SourcePatchCorners;
+
+  SelfPatchCompare(const SelfPatchCompare&); // Not implemented
+  void operator=(const SelfPatchCompare&); // Not implemented
 };
 
 #endif
@@ -0,0 +1,66 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "SharedVTKImage.h"
+
+// VTK
+#include <vtkCallbackCommand.h>
+#include <vtkCommand.h>
+#include <vtkFloatArray.h>
+#include <vtkImageData.h>
+#include <vtkPointData.h>
+#include <vtkSmartPointer.h>
+
+// Called when the vtkFloatArray that wraps the ITK buffer is destroyed.
+static void ReleaseITKImage(vtkObject* vtkNotUsed(caller), unsigned long vtkNotUsed(eventId), void* clientData, void* vtkNotUsed(callData))
+{
+  static_cast<FloatVectorImageType*>(clientData)->UnRegister();
+}
+
+bool ShareITKImageWithVTK(FloatVectorImageType* image, vtkImageData* vtkImage)
+{
+  const unsigned int numberOfComponents = image->GetNumberOfComponentsPerPixel();
+  if(numberOfComponents != 1 && numberOfComponents != 3)
+    {
+    return false;
+    }
+
+  itk::Size<2> size = image->GetLargestPossibleRegion().GetSize();
+  vtkIdType numberOfPixels = static_cast<vtkIdType>(size[0]) * static_cast<vtkIdType>(size[1]);
+
+  vtkSmartPointer<vtkFloatArray> array = vtkSmartPointer<vtkFloatArray>::New();
+  array->SetNumberOfComponents(numberOfComponents);
+  array->SetName("ImageScalars");
+  // The last argument (save = 1) prevents VTK from freeing memory that ITK owns.
+  array->SetArray(image->GetBufferPointer(), numberOfPixels * numberOfComponents, 1);
+
+  // Keep the ITK image (and therefore the buffer) alive for as long as the array exists.
+  image->Register();
+  vtkSmartPointer<vtkCallbackCommand> releaseCallback = vtkSmartPointer<vtkCallbackCommand>::New();
+  releaseCallback->SetCallback(ReleaseITKImage);
+  releaseCallback->SetClientData(image);
+  array->AddObserver(vtkCommand::DeleteEvent, releaseCallback);
+
+  vtkImage->SetDimensions(size[0], size[1], 1);
+  vtkImage->SetOrigin(image->GetOrigin()[0], image->GetOrigin()[1], 0);
+  vtkImage->SetSpacing(image->GetSpacing()[0], image->GetSpacing()[1], 1);
+  vtkImage->GetPointData()->SetScalars(array);
+  vtkImage->Modified();
+
+  return true;
+}
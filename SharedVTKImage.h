@@ -0,0 +1,39 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef SharedVTKImage_H
+#define SharedVTKImage_H
+
+/*
+ * ITK's VectorImage and VTK's vtkImageData store multi-component pixels the same way
+ * (interleaved components, x varying fastest), so a vtkImageData can display an ITK image
+ * without copying it. The vtkFloatArray is told not to free the buffer, and instead holds a
+ * reference to the ITK image that is released when the array is deleted.
+ */
+
+// Custom
+#include "Types.h"
+
+class vtkImageData;
+
+// Make 'vtkImage' display the pixel buffer of 'image' directly. Returns false (and leaves 'vtkImage' untouched)
+// if the image does not have 1 or 3 components, because those are the only layouts vtkImageSliceMapper
+// displays as intensity or color.
+bool ShareITKImageWithVTK(FloatVectorImageType* image, vtkImageData* vtkImage);
+
+#endif
@@ -0,0 +1,152 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+// Check that once the inpainter is warmed up, an iteration (almost) never allocates from the heap.
+
+#include "CriminisiInpainting.h"
+#include "Mask.h"
+#include "Types.h"
+
+#include "itkImageRegionIterator.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+static unsigned long NumberOfAllocations = 0;
+
+void* operator new(size_t size)
+{
+  NumberOfAllocations++;
+  void* pointer = malloc(size == 0 ? 1 : size);
+  if(!pointer)
+    {
+    throw std::bad_alloc();
+    }
+  return pointer;
+}
+
+void* operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void* pointer) throw()
+{
+  free(pointer);
+}
+
+void operator delete[](void* pointer) throw()
+{
+  free(pointer);
+}
+
+static float RandomFloat()
+{
+  return static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * 255.0f;
+}
+
+int main(int argc, char *argv[])
+{
+  srand(0);
+
+  itk::Size<2> size;
+  size.Fill(100);
+
+  itk::Index<2> index;
+  index.Fill(0);
+
+  itk::ImageRegion<2> region(index, size);
+
+  FloatVectorImageType::Pointer image = FloatVectorImageType::New();
+  image->SetRegions(region);
+  image->SetNumberOfComponentsPerPixel(3);
+  image->Allocate();
+
+  {
+  itk::ImageRegionIterator<FloatVectorImageType> imageIterator(image, image->GetLargestPossibleRegion());
+
+  while(!imageIterator.IsAtEnd())
+    {
+    FloatVectorImageType::PixelType pixel;
+    pixel.SetSize(3);
+    pixel[0] = RandomFloat();
+    pixel[1] = RandomFloat();
+    pixel[2] = RandomFloat();
+    imageIterator.Set(pixel);
+    ++imageIterator;
+    }
+  }
+
+  // A square hole in the middle of the image.
+  Mask::Pointer mask = Mask::New();
+  mask->SetRegions(region);
+  mask->Allocate();
+  mask->SetValidValue(0);
+  mask->SetHoleValue(255);
+
+  {
+  itk::ImageRegionIterator<Mask> maskIterator(mask, mask->GetLargestPossibleRegion());
+
+  while(!maskIterator.IsAtEnd())
+    {
+    const itk::Index<2> pixel = maskIterator.GetIndex();
+    bool hole = pixel[0] >= 35 && pixel[0] < 65 && pixel[1] >= 35 && pixel[1] < 65;
+    maskIterator.Set(hole ? mask->GetHoleValue() : mask->GetValidValue());
+    ++maskIterator;
+    }
+  }
+
+  CriminisiInpainting inpainting;
+  inpainting.SetPatchRadius(3);
+  inpainting.SetImage(image);
+  inpainting.SetMask(mask);
+  inpainting.Initialize();
+
+  // Let the buffers grow to their working size.
+  const unsigned int numberOfWarmUpIterations = 5;
+  for(unsigned int i = 0; i < numberOfWarmUpIterations && inpainting.HasMoreToInpaint(); ++i)
+    {
+    inpainting.Iterate();
+    }
+
+  // A few vectors may still grow (e.g. when the boundary gets longer), but no iteration should allocate per pixel.
+  const unsigned long maximumAllowed = 4;
+  const unsigned int numberOfIterations = 20;
+  unsigned long maximumAllocations = 0;
+  for(unsigned int i = 0; i < numberOfIterations && inpainting.HasMoreToInpaint(); ++i)
+    {
+    unsigned long before = NumberOfAllocations;
+    inpainting.Iterate();
+    unsigned long allocations = NumberOfAllocations - before;
+    if(allocations > maximumAllocations)
+      {
+      maximumAllocations = allocations;
+      }
+    }
+
+  std::cout << "Most allocations in one iteration: " << maximumAllocations << std::endl;
+
+  if(maximumAllocations > maximumAllowed)
+    {
+    std::cerr << "An iteration allocated " << maximumAllocations << " times (at most " << maximumAllowed << " allowed)." << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
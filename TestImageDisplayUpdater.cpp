@@ -0,0 +1,128 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "ImageDisplayUpdater.h"
+#include "Types.h"
+
+#include <vtkImageData.h>
+#include <vtkSmartPointer.h>
+
+#include <QCoreApplication>
+#include <QTimer>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+bool CheckCopied(const FloatVectorImageType* image, vtkImageData* vtkImage,
+                 const std::vector<itk::ImageRegion<2> >& copiedRegions);
+
+int main(int argc, char *argv[])
+{
+  // The render timer needs an event loop.
+  QCoreApplication app(argc, argv);
+
+  itk::Size<2> size = {{20, 10}};
+  itk::Index<2> corner = {{0, 0}};
+  FloatVectorImageType::Pointer image = FloatVectorImageType::New();
+  image->SetRegions(itk::ImageRegion<2>(corner, size));
+  image->SetNumberOfComponentsPerPixel(3);
+  image->Allocate();
+  float* buffer = image->GetBufferPointer();
+  for(unsigned int i = 0; i < size[0] * size[1] * 3; ++i)
+    {
+    buffer[i] = i;
+    }
+
+  // Everything that was not copied stays -1.
+  vtkSmartPointer<vtkImageData> vtkImage = vtkSmartPointer<vtkImageData>::New();
+  vtkImage->SetDimensions(size[0], size[1], 1);
+  vtkImage->AllocateScalars(VTK_FLOAT, 3);
+  float* vtkBuffer = static_cast<float*>(vtkImage->GetScalarPointer());
+  std::fill(vtkBuffer, vtkBuffer + size[0] * size[1] * 3, -1.0f);
+
+  ImageDisplayUpdater updater;
+  updater.SetImages(image, vtkImage, NULL);
+
+  // Two regions, the second partly outside of the image. Nothing is copied until the render.
+  itk::Index<2> firstCorner = {{2, 1}};
+  itk::Size<2> firstSize = {{3, 2}};
+  itk::Index<2> secondCorner = {{6, 8}};
+  itk::Size<2> secondSize = {{4, 4}};
+  updater.RegionModifiedSlot(itk::ImageRegion<2>(firstCorner, firstSize));
+  updater.RegionModifiedSlot(itk::ImageRegion<2>(secondCorner, secondSize));
+
+  std::vector<itk::ImageRegion<2> > copiedRegions;
+  bool allPassed = CheckCopied(image, vtkImage, copiedRegions);
+
+  // The bounding box of both regions, cropped to the image.
+  itk::Index<2> unionCorner = {{2, 1}};
+  itk::Size<2> unionSize = {{8, 9}};
+  copiedRegions.push_back(itk::ImageRegion<2>(unionCorner, unionSize));
+  updater.Flush();
+  allPassed &= CheckCopied(image, vtkImage, copiedRegions);
+
+  // A region modified later is copied when the timer fires.
+  itk::Index<2> lateCorner = {{15, 3}};
+  itk::Size<2> lateSize = {{2, 2}};
+  copiedRegions.push_back(itk::ImageRegion<2>(lateCorner, lateSize));
+  updater.RegionModifiedSlot(copiedRegions.back());
+  QTimer::singleShot(10 * ImageDisplayUpdater::RenderInterval, &app, SLOT(quit()));
+  app.exec();
+  allPassed &= CheckCopied(image, vtkImage, copiedRegions);
+
+  if(!allPassed)
+    {
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+// Check that the pixels of 'copiedRegions' (and only those) were copied into 'vtkImage'.
+bool CheckCopied(const FloatVectorImageType* image, vtkImageData* vtkImage,
+                 const std::vector<itk::ImageRegion<2> >& copiedRegions)
+{
+  const long width = image->GetLargestPossibleRegion().GetSize()[0];
+  const long height = image->GetLargestPossibleRegion().GetSize()[1];
+  for(long y = 0; y < height; ++y)
+    {
+    for(long x = 0; x < width; ++x)
+      {
+      itk::Index<2> pixel = {{x, y}};
+      bool copied = false;
+      for(unsigned int regionId = 0; regionId < copiedRegions.size(); ++regionId)
+        {
+        copied = copied || copiedRegions[regionId].IsInside(pixel);
+        }
+      const float* imagePixel = image->GetBufferPointer() + image->ComputeOffset(pixel) * 3;
+      const float* vtkPixel = static_cast<float*>(vtkImage->GetScalarPointer(x, y, 0));
+      for(unsigned int component = 0; component < 3; ++component)
+        {
+        const float expected = copied ? imagePixel[component] : -1.0f;
+        if(vtkPixel[component] != expected)
+          {
+          std::cerr << "Error: component " << component << " of pixel " << pixel << " is " << vtkPixel[component]
+                    << " but should be " << expected << std::endl;
+          return false;
+          }
+        }
+      }
+    }
+  return true;
+}
@@ -0,0 +1,125 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "PlanarShadowImage.h"
+#include "Types.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+#include <stdint.h>
+
+bool CheckShadow(const FloatVectorImageType* image, const PlanarShadowImage& shadow);
+
+int main(int argc, char *argv[])
+{
+  srand48(0);
+
+  // An odd size, so the rows need padding.
+  itk::Size<2> size = {{37, 23}};
+  itk::Index<2> corner = {{0, 0}};
+  FloatVectorImageType::Pointer image = FloatVectorImageType::New();
+  image->SetRegions(itk::ImageRegion<2>(corner, size));
+  image->SetNumberOfComponentsPerPixel(3);
+  image->Allocate();
+  float* buffer = image->GetBufferPointer();
+  for(unsigned int i = 0; i < size[0] * size[1] * 3; ++i)
+    {
+    buffer[i] = drand48() * 255.0;
+    }
+
+  PlanarShadowImage shadow;
+  shadow.SetImage(image, 4);
+
+  bool allPassed = CheckShadow(image, shadow);
+
+  if(shadow.GetRowStride() % (PlanarShadowImage::Alignment / sizeof(float)) != 0)
+    {
+    std::cerr << "Error: the row stride " << shadow.GetRowStride() << " is not a multiple of the alignment!" << std::endl;
+    allPassed = false;
+    }
+  for(unsigned int component = 0; component < shadow.GetNumberOfComponents(); ++component)
+    {
+    if(reinterpret_cast<uintptr_t>(shadow.GetPlane(component)) % PlanarShadowImage::Alignment != 0)
+      {
+      std::cerr << "Error: plane " << component << " is not aligned!" << std::endl;
+      allPassed = false;
+      }
+    }
+
+  // Change a patch in the corner (so the border next to it changes too) and one in the middle, as inpainting does.
+  itk::Index<2> cornerPatchIndex = {{32, 18}};
+  itk::Size<2> patchSize = {{7, 7}};
+  itk::ImageRegion<2> cornerPatch(cornerPatchIndex, patchSize);
+  itk::Index<2> middlePatchIndex = {{10, 8}};
+  itk::ImageRegion<2> middlePatch(middlePatchIndex, patchSize);
+  itk::ImageRegion<2> patches[2] = {cornerPatch, middlePatch};
+  for(unsigned int patchId = 0; patchId < 2; ++patchId)
+    {
+    itk::ImageRegion<2> region = patches[patchId];
+    region.Crop(image->GetLargestPossibleRegion());
+    for(unsigned int y = region.GetIndex()[1]; y < region.GetIndex()[1] + region.GetSize()[1]; ++y)
+      {
+      for(unsigned int x = region.GetIndex()[0]; x < region.GetIndex()[0] + region.GetSize()[0]; ++x)
+        {
+        for(unsigned int component = 0; component < 3; ++component)
+          {
+          buffer[(y * size[0] + x) * 3 + component] = -1.0f - component;
+          }
+        }
+      }
+    shadow.Update(image, patches[patchId]);
+    }
+
+  allPassed &= CheckShadow(image, shadow);
+
+  if(!allPassed)
+    {
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+bool CheckShadow(const FloatVectorImageType* image, const PlanarShadowImage& shadow)
+{
+  // Every pixel, including the border, must be the nearest pixel of the image.
+  const long width = image->GetLargestPossibleRegion().GetSize()[0];
+  const long height = image->GetLargestPossibleRegion().GetSize()[1];
+  const long border = shadow.GetBorderWidth();
+  const unsigned int components = image->GetNumberOfComponentsPerPixel();
+  for(long y = -border; y < height + border; ++y)
+    {
+    for(long x = -border; x < width + border; ++x)
+      {
+      itk::Index<2> index = {{x, y}};
+      itk::Index<2> nearest = {{std::min(width - 1, std::max(0L, x)), std::min(height - 1, std::max(0L, y))}};
+      const float* pixel = image->GetBufferPointer() + image->ComputeOffset(nearest) * components;
+      for(unsigned int component = 0; component < components; ++component)
+        {
+        if(shadow.GetPlane(component)[shadow.ComputeOffset(index)] != pixel[component])
+          {
+          std::cerr << "Error: component " << component << " of pixel " << index << " is "
+                    << shadow.GetPlane(component)[shadow.ComputeOffset(index)] << " but should be " << pixel[component] << std::endl;
+          return false;
+          }
+        }
+      }
+    }
+  return true;
+}
@@ -0,0 +1,90 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "Patch.h"
+#include "RadixSort.h"
+
+#include "itkTimeProbe.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+bool TestSortableKey();
+bool TestSortPatches(const unsigned int numberOfPatches);
+
+int main(int argc, char *argv[])
+{
+  srand48(0);
+
+  bool allPassed = true;
+  allPassed &= TestSortableKey();
+  allPassed &= TestSortPatches(1000); // std::stable_sort path
+  allPassed &= TestSortPatches(RadixSortThreshold() * 8); // radix path
+
+  if(!allPassed)
+    {
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+bool TestSortableKey()
+{
+  float values[] = {-1e30f, -255.0f*255.0f, -1.0f, -1e-30f, -0.0f, 0.0f, 1e-30f, 0.5f, 1.0f, 255.0f*255.0f, 1e30f};
+  unsigned int numberOfValues = sizeof(values)/sizeof(float);
+  for(unsigned int i = 1; i < numberOfValues; ++i)
+    {
+    if(FloatToSortableKey(values[i-1]) > FloatToSortableKey(values[i]))
+      {
+      std::cerr << "Error: key order of " << values[i-1] << " and " << values[i] << " does not match float order!" << std::endl;
+      return false;
+      }
+    }
+  return true;
+}
+
+bool TestSortPatches(const unsigned int numberOfPatches)
+{
+  std::vector<Patch> patches(numberOfPatches);
+  for(unsigned int i = 0; i < numberOfPatches; ++i)
+    {
+    // Coarse values so that there are many ties, which checks stability.
+    patches[i].TotalSquaredScore = static_cast<float>(static_cast<int>(drand48() * 2000.0) - 1000) / 4.0f;
+    patches[i].Id = i;
+    }
+
+  std::vector<Patch> expected = patches;
+  std::stable_sort(expected.begin(), expected.end(), SortByTotalSquaredScore);
+
+  itk::TimeProbe timer;
+  timer.Start();
+  SortPatchesByScore(patches, &Patch::TotalSquaredScore);
+  timer.Stop();
+  std::cout << "Sorted " << numberOfPatches << " patches in " << timer.GetTotal() << std::endl;
+
+  for(unsigned int i = 0; i < numberOfPatches; ++i)
+    {
+    if(patches[i].Id != expected[i].Id)
+      {
+      std::cerr << "Error: patch " << i << " has Id " << patches[i].Id << " but should have Id " << expected[i].Id << std::endl;
+      return false;
+      }
+    }
+  return true;
+}
@@ -0,0 +1,167 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "Mask.h"
+#include "ScoreMap.h"
+#include "Types.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+
+bool CheckScores(ScoreMap& scoreMap, const FloatVectorImageType* image, const Mask* mask,
+                 const itk::ImageRegion<2>& targetRegion, const unsigned int patchRadius);
+
+int main(int argc, char *argv[])
+{
+  srand48(0);
+
+  // Sizes that are not products of 2, 3 and 5, so the transforms are padded.
+  itk::Size<2> size = {{37, 29}};
+  itk::Index<2> corner = {{0, 0}};
+  itk::ImageRegion<2> region(corner, size);
+  FloatVectorImageType::Pointer image = FloatVectorImageType::New();
+  image->SetRegions(region);
+  image->SetNumberOfComponentsPerPixel(3);
+  image->Allocate();
+  float* buffer = image->GetBufferPointer();
+  for(unsigned int i = 0; i < size[0] * size[1] * 3; ++i)
+    {
+    buffer[i] = drand48() * 255.0;
+    }
+
+  // A round hole.
+  Mask::Pointer mask = Mask::New();
+  mask->SetRegions(region);
+  mask->Allocate();
+  mask->SetValidValue(0);
+  mask->SetHoleValue(255);
+  mask->FillBuffer(mask->GetValidValue());
+  for(long y = 0; y < static_cast<long>(size[1]); ++y)
+    {
+    for(long x = 0; x < static_cast<long>(size[0]); ++x)
+      {
+      if((x - 18) * (x - 18) + (y - 14) * (y - 14) < 25)
+        {
+        itk::Index<2> pixel = {{x, y}};
+        mask->SetPixel(pixel, mask->GetHoleValue());
+        }
+      }
+    }
+
+  const unsigned int patchRadius = 3;
+  ScoreMap scoreMap;
+  scoreMap.SetImage(image);
+  scoreMap.SetMask(mask);
+  scoreMap.SetPatchRadius(patchRadius);
+
+  // On the edge of the hole, partly outside of the image, and entirely valid.
+  itk::Size<2> patchSize = {{2 * patchRadius + 1, 2 * patchRadius + 1}};
+  itk::Index<2> targetCorners[3] = {{{10, 9}}, {{-2, 25}}, {{27, 2}}};
+
+  bool allPassed = true;
+  for(unsigned int targetId = 0; targetId < 3; ++targetId)
+    {
+    allPassed &= CheckScores(scoreMap, image, mask, itk::ImageRegion<2>(targetCorners[targetId], patchSize), patchRadius);
+    }
+
+  // The transforms of the image must be made again when it changes in place.
+  for(unsigned int i = 0; i < size[0] * 3; ++i)
+    {
+    buffer[i] = 255.0f - buffer[i];
+    }
+  image->Modified();
+  scoreMap.SetImage(image);
+  allPassed &= CheckScores(scoreMap, image, mask, itk::ImageRegion<2>(targetCorners[0], patchSize), patchRadius);
+
+  if(!allPassed)
+    {
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+// Compare the scores of both methods with the sum of squared differences of each source patch.
+bool CheckScores(ScoreMap& scoreMap, const FloatVectorImageType* image, const Mask* mask,
+                 const itk::ImageRegion<2>& targetRegion, const unsigned int patchRadius)
+{
+  const long width = image->GetLargestPossibleRegion().GetSize()[0];
+  const long height = image->GetLargestPossibleRegion().GetSize()[1];
+  const long radius = patchRadius;
+  const unsigned int components = image->GetNumberOfComponentsPerPixel();
+  const float* buffer = image->GetBufferPointer();
+
+  std::vector<float> expected(width * height, std::numeric_limits<float>::quiet_NaN());
+  float maximum = 0;
+  for(long centerY = radius; centerY + radius < height; ++centerY)
+    {
+    for(long centerX = radius; centerX + radius < width; ++centerX)
+      {
+      bool valid = true;
+      double score = 0;
+      for(long y = -radius; y <= radius && valid; ++y)
+        {
+        for(long x = -radius; x <= radius && valid; ++x)
+          {
+          itk::Index<2> sourcePixel = {{centerX + x, centerY + y}};
+          valid = mask->IsValid(sourcePixel);
+          itk::Index<2> targetPixel = {{targetRegion.GetIndex()[0] + radius + x, targetRegion.GetIndex()[1] + radius + y}};
+          if(!valid || targetPixel[0] < 0 || targetPixel[1] < 0 || targetPixel[0] >= width || targetPixel[1] >= height ||
+             !mask->IsValid(targetPixel))
+            {
+            continue;
+            }
+          for(unsigned int component = 0; component < components; ++component)
+            {
+            double difference = buffer[image->ComputeOffset(sourcePixel) * components + component] -
+                                buffer[image->ComputeOffset(targetPixel) * components + component];
+            score += difference * difference;
+            }
+          }
+        }
+      if(valid)
+        {
+        expected[centerY * width + centerX] = score;
+        maximum = std::max(maximum, static_cast<float>(score));
+        }
+      }
+    }
+
+  const char* methodNames[2] = {"direct", "FFT"};
+  const ScoreMap::ComputeMethodEnum methods[2] = {ScoreMap::COMPUTE_DIRECT, ScoreMap::COMPUTE_FFT};
+  for(unsigned int methodId = 0; methodId < 2; ++methodId)
+    {
+    scoreMap.SetComputeMethod(methods[methodId]);
+    scoreMap.Compute(targetRegion);
+    const float* scores = scoreMap.GetOutput()->GetBufferPointer();
+    for(long pixel = 0; pixel < width * height; ++pixel)
+      {
+      const bool bothNaN = std::isnan(scores[pixel]) && std::isnan(expected[pixel]);
+      if(!bothNaN && !(std::fabs(scores[pixel] - expected[pixel]) <= 1e-5f * maximum))
+        {
+        std::cerr << "Error: the " << methodNames[methodId] << " score of the source patch centered at ("
+                  << pixel % width << ", " << pixel / width << ") is " << scores[pixel]
+                  << " but should be " << expected[pixel] << std::endl;
+        return false;
+        }
+      }
+    }
+  return true;
+}
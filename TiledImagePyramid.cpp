@@ -0,0 +1,320 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "TiledImagePyramid.h"
+
+// Custom
+#include "Parallel.h"
+
+// VTK
+#include <vtkCommand.h>
+#include <vtkImageData.h>
+#include <vtkImageProperty.h>
+#include <vtkImageSlice.h>
+#include <vtkImageSliceMapper.h>
+#include <vtkImageStack.h>
+#include <vtkRenderer.h>
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+const unsigned int TiledImagePyramid::TileSize;
+const unsigned int TiledImagePyramid::MaximumNumberOfTiles;
+
+TiledImagePyramid::TiledImagePyramid()
+{
+  this->Clock = 0;
+  this->Stack = vtkSmartPointer<vtkImageStack>::New();
+  this->Stack->PickableOff();
+  this->Renderer = NULL;
+  this->RenderObserverTag = 0;
+}
+
+TiledImagePyramid::~TiledImagePyramid()
+{
+  SetRenderer(NULL);
+}
+
+vtkImageStack* TiledImagePyramid::GetProp()
+{
+  return this->Stack;
+}
+
+void TiledImagePyramid::SetRenderer(vtkRenderer* renderer)
+{
+  if(this->Renderer)
+    {
+    this->Renderer->RemoveObserver(this->RenderObserverTag);
+    }
+  this->Renderer = renderer;
+  if(this->Renderer)
+    {
+    // Choosing the tiles at the start of each render covers panning, zooming and resizing alike.
+    this->RenderObserverTag = this->Renderer->AddObserver(vtkCommand::StartEvent, this, &TiledImagePyramid::Update);
+    }
+}
+
+void TiledImagePyramid::Clear()
+{
+  for(std::map<uint64_t, Tile>::iterator iterator = this->Tiles.begin(); iterator != this->Tiles.end(); ++iterator)
+    {
+    this->Stack->RemoveImage(iterator->second.Slice);
+    }
+  this->Tiles.clear();
+  this->Levels.clear();
+}
+
+void TiledImagePyramid::SetImage(const FloatVectorImageType* image)
+{
+  Clear();
+
+  itk::Size<2> size = image->GetLargestPossibleRegion().GetSize();
+  const unsigned int components = image->GetNumberOfComponentsPerPixel();
+
+  // Level 0 is the full resolution image converted to 8-bit RGB.
+  Level base;
+  base.Width = size[0];
+  base.Height = size[1];
+  base.Scale = 1;
+  base.Pixels.resize(static_cast<size_t>(base.Width) * base.Height * 3);
+
+  const float* buffer = image->GetBufferPointer();
+  const unsigned int numberOfThreads = Parallel::GetNumberOfThreads(0);
+  Parallel::ParallelFor(numberOfThreads, [&](unsigned int threadId)
+    {
+    size_t firstRow;
+    size_t endRow;
+    Parallel::GetChunk(base.Height, numberOfThreads, threadId, firstRow, endRow);
+    for(size_t pixelId = firstRow * base.Width; pixelId < endRow * base.Width; ++pixelId)
+      {
+      const float* pixel = buffer + pixelId * components;
+      for(unsigned int channel = 0; channel < 3; ++channel)
+        {
+        float value = pixel[components >= 3 ? channel : 0];
+        base.Pixels[pixelId * 3 + channel] = static_cast<unsigned char>(std::min(255.0f, std::max(0.0f, value)) + 0.5f);
+        }
+      }
+    });
+  this->Levels.push_back(base);
+
+  // Halve the resolution (averaging 2x2 blocks) until the whole image fits in one tile.
+  while(this->Levels.back().Width > TileSize || this->Levels.back().Height > TileSize)
+    {
+    const Level& fine = this->Levels.back();
+    Level coarse;
+    coarse.Width = (fine.Width + 1) / 2;
+    coarse.Height = (fine.Height + 1) / 2;
+    coarse.Scale = fine.Scale * 2;
+    coarse.Pixels.resize(static_cast<size_t>(coarse.Width) * coarse.Height * 3);
+    for(unsigned int y = 0; y < coarse.Height; ++y)
+      {
+      const unsigned int y0 = 2 * y;
+      const unsigned int y1 = std::min(2 * y + 1, fine.Height - 1);
+      for(unsigned int x = 0; x < coarse.Width; ++x)
+        {
+        const unsigned int x0 = 2 * x;
+        const unsigned int x1 = std::min(2 * x + 1, fine.Width - 1);
+        for(unsigned int channel = 0; channel < 3; ++channel)
+          {
+          unsigned int sum = fine.Pixels[(static_cast<size_t>(y0) * fine.Width + x0) * 3 + channel] +
+                             fine.Pixels[(static_cast<size_t>(y0) * fine.Width + x1) * 3 + channel] +
+                             fine.Pixels[(static_cast<size_t>(y1) * fine.Width + x0) * 3 + channel] +
+                             fine.Pixels[(static_cast<size_t>(y1) * fine.Width + x1) * 3 + channel];
+          coarse.Pixels[(static_cast<size_t>(y) * coarse.Width + x) * 3 + channel] = static_cast<unsigned char>((sum + 2) / 4);
+          }
+        }
+      }
+    this->Levels.push_back(coarse);
+    }
+
+  // Show the coarsest level right away so that the bounds of the prop (and so ResetCamera()) cover the whole image.
+  GetTile(this->Levels.size() - 1, 0, 0);
+}
+
+uint64_t TiledImagePyramid::GetTileKey(const unsigned int level, const unsigned int tileX, const unsigned int tileY)
+{
+  return (static_cast<uint64_t>(level) << 48) | (static_cast<uint64_t>(tileY) << 24) | tileX;
+}
+
+TiledImagePyramid::Tile& TiledImagePyramid::GetTile(const unsigned int levelId, const unsigned int tileX, const unsigned int tileY)
+{
+  Tile& tile = this->Tiles[GetTileKey(levelId, tileX, tileY)];
+  tile.LastUsed = ++this->Clock;
+  if(tile.Slice)
+    {
+    return tile;
+    }
+
+  const Level& level = this->Levels[levelId];
+  const unsigned int firstX = tileX * TileSize;
+  const unsigned int firstY = tileY * TileSize;
+  const unsigned int width = std::min(TileSize, level.Width - firstX);
+  const unsigned int height = std::min(TileSize, level.Height - firstY);
+
+  // A pixel of this level covers Scale x Scale original pixels, so its center is (Scale-1)/2 past the first of them.
+  tile.Data = vtkSmartPointer<vtkImageData>::New();
+  tile.Data->SetDimensions(width, height, 1);
+  tile.Data->SetSpacing(level.Scale, level.Scale, 1);
+  tile.Data->SetOrigin(firstX * level.Scale + (level.Scale - 1) / 2.0, firstY * level.Scale + (level.Scale - 1) / 2.0, 0);
+  tile.Data->AllocateScalars(VTK_UNSIGNED_CHAR, 3);
+  unsigned char* tilePixels = static_cast<unsigned char*>(tile.Data->GetScalarPointer());
+  for(unsigned int y = 0; y < height; ++y)
+    {
+    memcpy(tilePixels + static_cast<size_t>(y) * width * 3,
+           &level.Pixels[((static_cast<size_t>(firstY) + y) * level.Width + firstX) * 3], width * 3);
+    }
+
+  vtkSmartPointer<vtkImageSliceMapper> mapper = vtkSmartPointer<vtkImageSliceMapper>::New();
+  mapper->SetInputData(tile.Data);
+  tile.Slice = vtkSmartPointer<vtkImageSlice>::New();
+  tile.Slice->SetMapper(mapper);
+  tile.Slice->PickableOff();
+  tile.Slice->GetProperty()->SetColorWindow(255);
+  tile.Slice->GetProperty()->SetColorLevel(127.5);
+  if(levelId == 0)
+    {
+    tile.Slice->GetProperty()->SetInterpolationTypeToNearest();
+    }
+  else
+    {
+    tile.Slice->GetProperty()->SetInterpolationTypeToLinear();
+    }
+  this->Stack->AddImage(tile.Slice);
+
+  return tile;
+}
+
+unsigned int TiledImagePyramid::ChooseLevel()
+{
+  // Measure how many screen pixels one original pixel covers.
+  double origin[3];
+  double unitX[3];
+  this->Renderer->SetWorldPoint(0, 0, 0, 1);
+  this->Renderer->WorldToDisplay();
+  this->Renderer->GetDisplayPoint(origin);
+  this->Renderer->SetWorldPoint(1, 0, 0, 1);
+  this->Renderer->WorldToDisplay();
+  this->Renderer->GetDisplayPoint(unitX);
+  double screenPixelsPerPixel = sqrt((unitX[0] - origin[0]) * (unitX[0] - origin[0]) + (unitX[1] - origin[1]) * (unitX[1] - origin[1]));
+  if(!(screenPixelsPerPixel > 0))
+    {
+    return this->Levels.size() - 1;
+    }
+
+  // Use the coarsest level whose pixels are still no larger than a screen pixel.
+  int level = static_cast<int>(floor(log2(1.0 / screenPixelsPerPixel)));
+  return std::max(0, std::min(level, static_cast<int>(this->Levels.size()) - 1));
+}
+
+void TiledImagePyramid::GetVisibleRegion(double& minX, double& minY, double& maxX, double& maxY)
+{
+  // Un-project the corners of the viewport at the depth of the image plane.
+  double origin[3];
+  this->Renderer->SetWorldPoint(0, 0, 0, 1);
+  this->Renderer->WorldToDisplay();
+  this->Renderer->GetDisplayPoint(origin);
+
+  int* size = this->Renderer->GetSize();
+  int* position = this->Renderer->GetOrigin();
+  minX = minY = std::numeric_limits<double>::max();
+  maxX = maxY = -std::numeric_limits<double>::max();
+  for(unsigned int corner = 0; corner < 4; ++corner)
+    {
+    double x = position[0] + ((corner & 1) ? size[0] : 0);
+    double y = position[1] + ((corner & 2) ? size[1] : 0);
+    this->Renderer->SetDisplayPoint(x, y, origin[2]);
+    this->Renderer->DisplayToWorld();
+    double world[4];
+    this->Renderer->GetWorldPoint(world);
+    if(world[3] != 0)
+      {
+      world[0] /= world[3];
+      world[1] /= world[3];
+      }
+    minX = std::min(minX, world[0]);
+    minY = std::min(minY, world[1]);
+    maxX = std::max(maxX, world[0]);
+    maxY = std::max(maxY, world[1]);
+    }
+}
+
+void TiledImagePyramid::Update()
+{
+  if(this->Levels.empty() || !this->Renderer)
+    {
+    return;
+    }
+
+  const unsigned int levelId = ChooseLevel();
+  const Level& level = this->Levels[levelId];
+
+  double minX, minY, maxX, maxY;
+  GetVisibleRegion(minX, minY, maxX, maxY);
+
+  // Convert the visible region to the tiles of the chosen level, clamped to the image.
+  const double tileExtent = static_cast<double>(TileSize) * level.Scale;
+  const int lastTileX = (level.Width - 1) / TileSize;
+  const int lastTileY = (level.Height - 1) / TileSize;
+  const int firstVisibleX = std::max(0, static_cast<int>(floor((minX + 0.5) / tileExtent)));
+  const int firstVisibleY = std::max(0, static_cast<int>(floor((minY + 0.5) / tileExtent)));
+  const int lastVisibleX = std::min(lastTileX, static_cast<int>(floor((maxX + 0.5) / tileExtent)));
+  const int lastVisibleY = std::min(lastTileY, static_cast<int>(floor((maxY + 0.5) / tileExtent)));
+
+  const unsigned long firstUse = this->Clock + 1;
+  for(int tileY = firstVisibleY; tileY <= lastVisibleY; ++tileY)
+    {
+    for(int tileX = firstVisibleX; tileX <= lastVisibleX; ++tileX)
+      {
+      GetTile(levelId, tileX, tileY).Slice->VisibilityOn();
+      }
+    }
+
+  // Hide everything that was not touched above.
+  for(std::map<uint64_t, Tile>::iterator iterator = this->Tiles.begin(); iterator != this->Tiles.end(); ++iterator)
+    {
+    iterator->second.Slice->SetVisibility(iterator->second.LastUsed >= firstUse);
+    }
+
+  ReleaseUnusedTiles();
+}
+
+void TiledImagePyramid::ReleaseUnusedTiles()
+{
+  while(this->Tiles.size() > MaximumNumberOfTiles)
+    {
+    // Find the least recently used hidden tile. Visible tiles are never released.
+    std::map<uint64_t, Tile>::iterator oldest = this->Tiles.end();
+    for(std::map<uint64_t, Tile>::iterator iterator = this->Tiles.begin(); iterator != this->Tiles.end(); ++iterator)
+      {
+      if(!iterator->second.Slice->GetVisibility() &&
+         (oldest == this->Tiles.end() || iterator->second.LastUsed < oldest->second.LastUsed))
+        {
+        oldest = iterator;
+        }
+      }
+    if(oldest == this->Tiles.end())
+      {
+      return;
+      }
+    this->Stack->RemoveImage(oldest->second.Slice);
+    this->Tiles.erase(oldest);
+    }
+}
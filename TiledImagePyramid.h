@@ -0,0 +1,112 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef TiledImagePyramid_H
+#define TiledImagePyramid_H
+
+/*
+ * This class displays a very large image with a level-of-detail scheme. When the image is set,
+ * an 8-bit RGB pyramid is built (each level half the size of the previous one). Each level is
+ * divided into TileSize x TileSize tiles, and before every render only the tiles that are visible,
+ * from the level whose resolution best matches the current zoom, are turned into vtkImageSlices.
+ *
+ * The tiles are positioned and scaled so that pixel (i,j) of the original image is always at world
+ * coordinate (i,j), so other props (the mask, the patches) stay registered with the image.
+ */
+
+// Custom
+#include "Types.h"
+
+// VTK
+#include <vtkSmartPointer.h>
+
+class vtkImageData;
+class vtkImageSlice;
+class vtkImageStack;
+class vtkRenderer;
+
+// STL
+#include <map>
+#include <vector>
+
+#include <stdint.h>
+
+class TiledImagePyramid
+{
+public:
+  TiledImagePyramid();
+  ~TiledImagePyramid();
+
+  // The tiles are drawn by this prop. Add it to the renderer where the image should be in the drawing order.
+  vtkImageStack* GetProp();
+
+  // The renderer whose camera decides which tiles are shown.
+  void SetRenderer(vtkRenderer* renderer);
+
+  // Build the pyramid. Only the first three components (or the only component) of the image are used.
+  void SetImage(const FloatVectorImageType* image);
+
+  // Remove all levels and tiles.
+  void Clear();
+
+  // Show the tiles needed for the current camera. This is called automatically at the start of every render.
+  void Update();
+
+  // The width and height of a tile in pixels (of its own level).
+  static const unsigned int TileSize = 256;
+
+  // The most tiles kept (visible or not) before the least recently used hidden ones are released.
+  static const unsigned int MaximumNumberOfTiles = 64;
+
+private:
+  struct Level
+  {
+    unsigned int Width;
+    unsigned int Height;
+    unsigned int Scale; // The number of original pixels covered by one pixel of this level, in each direction.
+    std::vector<unsigned char> Pixels; // RGB, row-major
+  };
+
+  struct Tile
+  {
+    vtkSmartPointer<vtkImageData> Data;
+    vtkSmartPointer<vtkImageSlice> Slice;
+    unsigned long LastUsed;
+  };
+
+  static uint64_t GetTileKey(const unsigned int level, const unsigned int tileX, const unsigned int tileY);
+  Tile& GetTile(const unsigned int level, const unsigned int tileX, const unsigned int tileY);
+
+  // Choose the level whose pixels are closest to one screen pixel.
+  unsigned int ChooseLevel();
+
+  // Find the part of the original image that is visible (in original pixel coordinates).
+  void GetVisibleRegion(double& minX, double& minY, double& maxX, double& maxY);
+
+  void ReleaseUnusedTiles();
+
+  std::vector<Level> Levels;
+  std::map<uint64_t, Tile> Tiles;
+  unsigned long Clock;
+
+  vtkSmartPointer<vtkImageStack> Stack;
+  vtkRenderer* Renderer;
+  unsigned long RenderObserverTag;
+};
+
+#endif
@@ -0,0 +1,88 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef TripleBuffer_H
+#define TripleBuffer_H
+
+/*
+ * A single producer, single consumer triple buffer. The producer fills GetBack() and calls Publish();
+ * the consumer calls Update() and then reads GetFront(). Neither side ever waits for the other: the
+ * producer always has a buffer to write that the consumer is not reading, and the consumer always
+ * sees a complete value (the most recently published one).
+ */
+
+// STL
+#include <atomic>
+
+template <typename T>
+class TripleBuffer
+{
+public:
+  TripleBuffer() : Middle(1)
+  {
+    this->Back = 0;
+    this->Front = 2;
+  }
+
+  // Producer side
+  T& GetBack()
+  {
+    return this->Buffers[this->Back];
+  }
+
+  void Publish()
+  {
+    this->Back = this->Middle.exchange(this->Back | FreshBit, std::memory_order_acq_rel) & IndexMask;
+  }
+
+  // Consumer side. Returns true if a new value was published since the last Update().
+  bool Update()
+  {
+    if(!(this->Middle.load(std::memory_order_relaxed) & FreshBit))
+      {
+      return false;
+      }
+    this->Front = this->Middle.exchange(this->Front, std::memory_order_acq_rel) & IndexMask;
+    return true;
+  }
+
+  const T& GetFront() const
+  {
+    return this->Buffers[this->Front];
+  }
+
+  // Not thread safe: only use this when neither side is active, e.g. to reserve memory up front.
+  T& GetBuffer(const unsigned int i)
+  {
+    return this->Buffers[i];
+  }
+
+private:
+  TripleBuffer(const TripleBuffer&); // Not implemented
+  void operator=(const TripleBuffer&); // Not implemented
+
+  static const unsigned int FreshBit = 4;
+  static const unsigned int IndexMask = 3;
+
+  T Buffers[3];
+  unsigned int Back;
+  unsigned int Front;
+  std::atomic<unsigned int> Middle;
+};
+
+#endif
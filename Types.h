@@ -22,6 +22,7 @@
 #include "itkCovariantVector.h"
 #include "itkImage.h"
 #include "itkImageFileReader.h"
+#include "itkOffset.h"
 #include "itkVectorImage.h"
 
 typedef itk::VectorImage<float,2> FloatVectorImageType;
@@ -43,5 +44,8 @@ typedef itk::Image<UnsignedCharVectorType ,2> UnsignedCharVectorImageType;
 typedef itk::Image<FloatVector3Type , 2> FloatVector3ImageType;
 typedef itk::Image<FloatVector2Type , 2> FloatVector2ImageType;
 
+// An offset (e.g. from a pixel to where it was copied from) at each pixel
+typedef itk::Image<itk::Offset<2>, 2> OffsetImageType;
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,99 @@
+/*=========================================================================
+ *
+ *  Copyright David Doria 2011 daviddoria@gmail.com
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#ifndef __itkFastRGBToLabColorSpacePixelAccessor_h
+#define __itkFastRGBToLabColorSpacePixelAccessor_h
+
+// Custom
+#include "CIELab.h"
+
+// ITK
+#include "itkRGBPixel.h"
+#include "itkVector.h"
+#include "itkNumericTraits.h"
+
+namespace itk
+{
+namespace Accessor
+{
+/**
+ * \class FastRGBToLabColorSpacePixelAccessor
+ * \brief The same as RGBToLabColorSpacePixelAccessor, but using the tables of CIELab.h.
+ *
+ * The RGB values are first reduced to 8 bits (the tables have one entry per 8-bit value),
+ * so for RGBPixel<unsigned char> the results are those of RGBToLabColorSpacePixelAccessor.
+ * Converting every pixel of an image once with CIELab::ConvertImage() is still much faster
+ * than converting through an ImageAdaptor at every access.
+ *
+ * \sa ImageAdaptor
+ * \ingroup ImageAdaptors
+ */
+
+template <class TInput, class TOutput>
+class ITK_EXPORT FastRGBToLabColorSpacePixelAccessor
+{
+public:
+  /** Standard class typedefs. */
+  typedef   FastRGBToLabColorSpacePixelAccessor        Self;
+
+  /** External typedef. It defines the external aspect
+   * that this class will exhibit */
+  typedef  Vector<TOutput,3>     ExternalType;
+
+  /** Internal typedef. It defines the internal real
+   * representation of data */
+  typedef   RGBPixel<TInput>    InternalType;
+
+  /** Write access to the FastRGBToLabColorSpace component */
+  inline void Set( InternalType & output, const ExternalType & input ) const
+    {
+    float lab[3];
+    CIELab::ConvertPixel(ToByte(input[0]), ToByte(input[1]), ToByte(input[2]), lab);
+
+    output[0] = static_cast<TInput>(lab[0]); // L
+    output[1] = static_cast<TInput>(lab[1]); // a
+    output[2] = static_cast<TInput>(lab[2]); // b
+    }
+
+  /** Read access to the FastRGBToLabColorSpace component */
+  inline ExternalType Get( const InternalType & input ) const
+    {
+    float lab[3];
+    CIELab::ConvertPixel(ToByte(input[0]), ToByte(input[1]), ToByte(input[2]), lab);
+
+    ExternalType output;
+    output[0] = static_cast<TOutput>(lab[0]); // L
+    output[1] = static_cast<TOutput>(lab[1]); // a
+    output[2] = static_cast<TOutput>(lab[2]); // b
+
+    return output;
+    }
+
+private:
+  /** Scale a channel value to 0-255. */
+  template <typename TValue>
+  static unsigned char ToByte(const TValue value)
+    {
+    return static_cast<unsigned char>(255.0 * static_cast<double>(value) / static_cast<double>(NumericTraits<TInput>::max()));
+    }
+};
+
+}  // end namespace Accessor
+}  // end namespace itk
+
+#endif